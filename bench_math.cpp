@@ -0,0 +1,274 @@
+////////////////////////////////////////////////////////////////////////
+//
+//   Microbenchmarks for the math headers (cvec.h, matrix4.h, matrix4f.h,
+//   quat.h, rigtform.h, transformbatch.h, modelview.h).
+//
+//   Every primitive is run over batches of 1 to 1M independent inputs and
+//   reported as ns/op and millions of ops per second. Needs no GL context,
+//   so it runs on a headless machine:
+//
+//     make bench_math
+//     ./bench_math [--json file] [--max-batch n] [--min-ms t] [--filter name]
+//
+//   --json writes the results as JSON ("-" for stdout) for regression
+//   tracking across commits. With "-" the table goes to stderr instead.
+//
+////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cvec.h"
+#include "matrix4.h"
+#include "matrix4f.h"
+#include "quat.h"
+#include "rigtform.h"
+#include "transformbatch.h"
+#include "modelview.h"
+
+using namespace std;
+
+struct BenchResult {
+  string name;
+  string precision;
+  int batch;
+  long long ops;
+  double nsPerOp;
+  double mopsPerSec;
+};
+
+static vector<BenchResult> g_results;
+static double g_minSeconds = 0.05;
+static int g_maxBatch = 1 << 20;
+static string g_filter;
+static volatile double g_sink; // keeps results alive
+static FILE *g_table = stdout; // where the human readable table goes
+
+static double nowSeconds() {
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Runs body(n) repeatedly until g_minSeconds have passed; body performs n ops
+template<typename Body>
+static void runBench(const string& name, const string& precision, const int n, Body body) {
+  if (!g_filter.empty() && name.find(g_filter) == string::npos)
+    return;
+
+  body(n); // warm up caches and page in the buffers
+
+  // small batches run many times between clock reads so the timer stays
+  // out of the measurement
+  const int inner = max(1, 4096 / n);
+  long long reps = 0;
+  const double start = nowSeconds();
+  double elapsed = 0;
+  do {
+    for (int i = 0; i < inner; ++i) {
+      body(n);
+    }
+    reps += inner;
+    elapsed = nowSeconds() - start;
+  } while (elapsed < g_minSeconds);
+
+  BenchResult r;
+  r.name = name;
+  r.precision = precision;
+  r.batch = n;
+  r.ops = reps * n;
+  r.nsPerOp = elapsed * 1e9 / r.ops;
+  r.mopsPerSec = r.ops / elapsed * 1e-6;
+  g_results.push_back(r);
+
+  fprintf(g_table, "%-24s %-7s %8d %12.2f ns/op %10.2f Mops/s\n",
+          name.c_str(), precision.c_str(), n, r.nsPerOp, r.mopsPerSec);
+  fflush(g_table);
+}
+
+static double rnd() {
+  return rand() / double(RAND_MAX) * 2 - 1;
+}
+
+static Matrix4 randomAffine() {
+  return Matrix4::makeTranslation(Cvec3(rnd(), rnd(), rnd()) * 10) *
+         Matrix4::makeXRotation(rnd() * 180) * Matrix4::makeYRotation(rnd() * 180) *
+         Matrix4::makeScale(Cvec3(1.5 + rnd() * 0.5));
+}
+
+static RigTForm randomRbt() {
+  return RigTForm(Cvec3(rnd(), rnd(), rnd()) * 10, normalize(Quat(rnd(), rnd(), rnd(), rnd())));
+}
+
+static void benchBatch(const int n) {
+  vector<Matrix4> md(n), mdOut(n);
+  vector<Matrix4f> mf(n), mfOut(n);
+  vector<Cvec4> vd(n);
+  vector<Cvec4f> vf(n);
+  vector<Cvec3> nd(n);
+  vector<Cvec3f> nf(n);
+  vector<RigTForm> rd(n), rdOut(n);
+  for (int i = 0; i < n; ++i) {
+    md[i] = randomAffine();
+    mf[i] = Matrix4f(md[i]);
+    vd[i] = Cvec4(rnd(), rnd(), rnd(), 1);
+    vf[i] = Cvec4f(vd[i][0], vd[i][1], vd[i][2], 1);
+    nd[i] = Cvec3(vd[i]) + Cvec3(2, 0, 0);
+    nf[i] = Cvec3f(nd[i][0], nd[i][1], nd[i][2]);
+    rd[i] = randomRbt();
+  }
+  const Matrix4 bd = randomAffine();
+  const Matrix4f bf(bd);
+  const RigTForm rb = randomRbt();
+
+  runBench("Matrix4::operator*", "double", n, [&](int n) {
+    for (int i = 0; i < n; ++i) mdOut[i] = md[i] * bd;
+    g_sink = mdOut[n - 1][0];
+  });
+  runBench("Matrix4::operator*", "float", n, [&](int n) {
+    for (int i = 0; i < n; ++i) mfOut[i] = mf[i] * bf;
+    g_sink = mfOut[n - 1][0];
+  });
+  runBench("Matrix4*Cvec4", "double", n, [&](int n) {
+    double s = 0;
+    for (int i = 0; i < n; ++i) s += (bd * vd[i])[0];
+    g_sink = s;
+  });
+  runBench("Matrix4*Cvec4", "float", n, [&](int n) {
+    float s = 0;
+    for (int i = 0; i < n; ++i) s += (bf * vf[i])[0];
+    g_sink = s;
+  });
+  runBench("inv", "double", n, [&](int n) {
+    for (int i = 0; i < n; ++i) mdOut[i] = inv(md[i]);
+    g_sink = mdOut[n - 1][0];
+  });
+  runBench("inv", "float", n, [&](int n) {
+    for (int i = 0; i < n; ++i) mfOut[i] = inv(mf[i]);
+    g_sink = mfOut[n - 1][0];
+  });
+  runBench("transpose", "double", n, [&](int n) {
+    for (int i = 0; i < n; ++i) mdOut[i] = transpose(md[i]);
+    g_sink = mdOut[n - 1][1];
+  });
+  runBench("transpose", "float", n, [&](int n) {
+    for (int i = 0; i < n; ++i) mfOut[i] = transpose(mf[i]);
+    g_sink = mfOut[n - 1][1];
+  });
+  runBench("normalMatrix", "double", n, [&](int n) {
+    for (int i = 0; i < n; ++i) mdOut[i] = normalMatrix(md[i]);
+    g_sink = mdOut[n - 1][0];
+  });
+  runBench("normalMatrix", "float", n, [&](int n) {
+    for (int i = 0; i < n; ++i) mfOut[i] = normalMatrix(mf[i]);
+    g_sink = mfOut[n - 1][0];
+  });
+  runBench("makeProjection", "double", n, [&](int n) {
+    for (int i = 0; i < n; ++i) mdOut[i] = Matrix4::makeProjection(60 + vd[i][0], 1.3, -0.1, -50);
+    g_sink = mdOut[n - 1][0];
+  });
+  runBench("Cvec::normalize", "double", n, [&](int n) {
+    double s = 0;
+    for (int i = 0; i < n; ++i) s += normalize(nd[i])[0];
+    g_sink = s;
+  });
+  runBench("Cvec::normalize", "float", n, [&](int n) {
+    float s = 0;
+    for (int i = 0; i < n; ++i) s += normalize(nf[i])[0];
+    g_sink = s;
+  });
+  runBench("RigTForm::operator*", "double", n, [&](int n) {
+    for (int i = 0; i < n; ++i) rdOut[i] = rd[i] * rb;
+    g_sink = rdOut[n - 1].getTranslation()[0];
+  });
+  runBench("inv(RigTForm)", "double", n, [&](int n) {
+    for (int i = 0; i < n; ++i) rdOut[i] = inv(rd[i]);
+    g_sink = rdOut[n - 1].getTranslation()[0];
+  });
+
+  // batched kernels
+  vector<float> x(n), y(n), z(n), ox(n), oy(n), oz(n);
+  for (int i = 0; i < n; ++i) {
+    x[i] = vf[i][0], y[i] = vf[i][1], z[i] = vf[i][2];
+  }
+  vector<Cvec3f> pOut(n);
+  runBench("transformPoints(SoA)", "float", n, [&](int n) {
+    transformPoints(bf, &x[0], &y[0], &z[0], &ox[0], &oy[0], &oz[0], n);
+    g_sink = ox[n - 1];
+  });
+  runBench("transformPoints(AoS)", "float", n, [&](int n) {
+    transformPoints(bf, &nf[0], sizeof(Cvec3f), &pOut[0], sizeof(Cvec3f), n);
+    g_sink = pOut[n - 1][0];
+  });
+  runBench("transformPoints(SoA,mt)", "float", n, [&](int n) {
+    transformPoints(bf, &x[0], &y[0], &z[0], &ox[0], &oy[0], &oz[0], n, 0);
+    g_sink = ox[n - 1];
+  });
+
+  vector<float> mvm(16 * size_t(n)), nmvm(16 * size_t(n));
+  runBench("computeModelViewNormal", "double", n, [&](int n) {
+    computeModelViewNormalMatrices(bd, &md[0], n, &mvm[0], &nmvm[0]);
+    g_sink = mvm[0];
+  });
+}
+
+static void writeJson(ostream& os) {
+  os << "{\n  \"benchmark\": \"bench_math\",\n";
+#ifdef CS150_AVX
+  os << "  \"simd\": \"avx\",\n";
+#elif defined(CS150_SSE)
+  os << "  \"simd\": \"sse\",\n";
+#else
+  os << "  \"simd\": \"none\",\n";
+#endif
+  os << "  \"min_seconds\": " << g_minSeconds << ",\n  \"results\": [\n";
+  for (size_t i = 0; i < g_results.size(); ++i) {
+    const BenchResult& r = g_results[i];
+    os << "    {\"name\": \"" << r.name << "\", \"precision\": \"" << r.precision
+       << "\", \"batch\": " << r.batch << ", \"ops\": " << r.ops
+       << ", \"ns_per_op\": " << r.nsPerOp << ", \"mops_per_sec\": " << r.mopsPerSec << "}"
+       << (i + 1 < g_results.size() ? ",\n" : "\n");
+  }
+  os << "  ]\n}\n";
+}
+
+int main(int argc, char * argv[]) {
+  const char *jsonFile = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--json") && i + 1 < argc)
+      jsonFile = argv[++i];
+    else if (!strcmp(argv[i], "--max-batch") && i + 1 < argc)
+      g_maxBatch = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--min-ms") && i + 1 < argc)
+      g_minSeconds = atof(argv[++i]) / 1000;
+    else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+      g_filter = argv[++i];
+    else {
+      cerr << "usage: " << argv[0] << " [--json file|-] [--max-batch n] [--min-ms t] [--filter name]" << endl;
+      return 1;
+    }
+  }
+  if (jsonFile && !strcmp(jsonFile, "-"))
+    g_table = stderr; // keep stdout valid JSON
+
+  srand(175);
+  for (int n = 1; n <= g_maxBatch; n *= 16) {
+    benchBatch(n);
+    if (n < g_maxBatch && n * 16 > g_maxBatch)
+      benchBatch(g_maxBatch); // always finish with the largest batch asked for
+  }
+
+  if (jsonFile) {
+    if (!strcmp(jsonFile, "-"))
+      writeJson(cout);
+    else {
+      ofstream f(jsonFile);
+      writeJson(f);
+    }
+  }
+  return 0;
+}
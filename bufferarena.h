@@ -0,0 +1,339 @@
+#ifndef BUFFERARENA_H
+#define BUFFERARENA_H
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "glsupport.h"
+
+//--------------------------------------------------------------------------------
+// Ranges of one big buffer object, handed out and given back
+//--------------------------------------------------------------------------------
+//
+// GlBufferArena owns a single buffer and splits it into ranges on request,
+// so meshes coming and going do not each create and delete a buffer object.
+// Sizes and offsets count elements of a fixed size, such as vertices or
+// indices, so every range starts on an element and its offset is what the
+// base vertex or first index of a draw wants.
+//
+// Free space is a list of holes ordered by offset. allocate takes the lowest
+// hole that fits, and a freed range merges with the holes next to it. When
+// nothing fits, the buffer doubles, copying what it holds (OpenGL 3.1),
+// which gives it a new name: anything pointing at it, such as a VAO, must be
+// set up again when generation changes.
+//
+// Freeing ranges in the middle leaves holes. compact slides the ranges above
+// the lowest hole down onto the end of the packed ones, a bounded amount per
+// call, so calling it once a frame packs the buffer over time whatever the
+// sizes of the holes and ranges. A range sliding by less than its size
+// overlaps its old place, which glCopyBufferSubData does not allow, so it
+// goes through a scratch buffer. A buffer whose ranges all end in its first
+// quarter is then halved, down to its initial capacity, so the memory of
+// freed meshes goes back to the driver; that too changes generation. The
+// copies run after the draws already issued, so those still read the old
+// place, but offsets must be read again after compact rather than remembered.
+
+// Sizes are in elements
+struct BufferArenaStats {
+  int capacity, used;
+  int ranges, holes;
+  int largestHole;
+
+  // The part of the buffer in use
+  double occupancy() const {
+    return capacity > 0 ? double(used) / capacity : 0;
+  }
+
+  // 0 when the free space is one hole, towards 1 as it splits into many
+  // small ones
+  double fragmentation() const {
+    const int free = capacity - used;
+    return free > 0 ? 1 - double(largestHole) / free : 0;
+  }
+};
+
+class GlBufferArena : Noncopyable {
+public:
+  GlBufferArena(const int elementSize, const int initialCapacity = 1 << 16)
+    : elementSize_(elementSize), initialCapacity_(initialCapacity), capacity_(0), used_(0), generation_(0),
+      scratchCapacity_(0) {
+    assert(elementSize > 0 && initialCapacity > 0);
+    grow(initialCapacity);
+  }
+
+  // Takes count elements and returns the id of the range, growing the buffer
+  // if no hole is big enough
+  int allocate(const int count) {
+    assert(count > 0);
+    std::map<int, int>::iterator h = findHole(count, capacity_);
+    if (h == holes_.end()) {
+      grow(count);
+      h = findHole(count, capacity_);
+    }
+    const int first = h->first;
+    takeHole(h, count);
+
+    int id;
+    if (freeIds_.empty()) {
+      id = ranges_.size();
+      ranges_.push_back(Range());
+    }
+    else {
+      id = freeIds_.back();
+      freeIds_.pop_back();
+    }
+    ranges_[id].first = first;
+    ranges_[id].count = count;
+    byFirst_[first] = id;
+    used_ += count;
+    return id;
+  }
+
+  void free(const int id) {
+    Range& r = ranges_[id];
+    assert(r.count > 0);
+    byFirst_.erase(r.first);
+    addHole(r.first, r.count);
+    used_ -= r.count;
+    r.count = 0;
+    freeIds_.push_back(id);
+  }
+
+  // First element of a range, which compact may change
+  int first(const int id) const {
+    return ranges_[id].first;
+  }
+
+  int count(const int id) const {
+    return ranges_[id].count;
+  }
+
+  // Writes a whole range
+  void upload(const int id, const void *data) {
+    const Range& r = ranges_[id];
+    // the copy target leaves the VAO and array buffer bindings alone
+    glBindBuffer(GL_COPY_WRITE_BUFFER, *buffer_);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(r.first) * elementSize_, GLsizeiptr(r.count) * elementSize_, data);
+  }
+
+  // Slides the ranges above the lowest hole down, lowest first, until about
+  // maxCount elements have been copied or only the hole at the end is left,
+  // then shrinks the buffer if it is mostly free. Returns how many elements
+  // were copied.
+  int compact(const int maxCount) {
+    int moved = 0;
+    while (moved < maxCount && !holes_.empty()) {
+      const std::map<int, int>::iterator h = holes_.begin();
+      const int to = h->first, size = h->second;
+      const std::map<int, int>::iterator r = byFirst_.find(to + size);
+      if (r == byFirst_.end())
+        break; // the hole is the end of the buffer, so everything is packed
+      Range& range = ranges_[r->second];
+      moveRange(range.first, to, range.count);
+
+      // the hole moves up past the range, and may meet the next one
+      const int id = r->second;
+      holes_.erase(h);
+      byFirst_.erase(r);
+      byFirst_[to] = id;
+      range.first = to;
+      addHole(to + range.count, size);
+      moved += range.count;
+    }
+    shrink();
+    return moved;
+  }
+
+  BufferArenaStats stats() const {
+    BufferArenaStats s;
+    s.capacity = capacity_;
+    s.used = used_;
+    s.ranges = byFirst_.size();
+    s.holes = holes_.size();
+    s.largestHole = 0;
+    for (std::map<int, int>::const_iterator h = holes_.begin(); h != holes_.end(); ++h) {
+      s.largestHole = std::max(s.largestHole, h->second);
+    }
+    return s;
+  }
+
+  int elementSize() const {
+    return elementSize_;
+  }
+
+  GLuint buffer() const {
+    return *buffer_;
+  }
+
+  // Changes whenever the buffer is replaced
+  int generation() const {
+    return generation_;
+  }
+
+private:
+  struct Range {
+    int first, count; // count is 0 for a free id
+  };
+
+  const int elementSize_;
+  const int initialCapacity_;
+  int capacity_, used_;
+  int generation_;
+  std::unique_ptr<GlBufferObject> buffer_;
+  std::unique_ptr<GlBufferObject> scratch_; // for moves that overlap
+  int scratchCapacity_;
+  std::vector<Range> ranges_;
+  std::vector<int> freeIds_;
+  std::map<int, int> byFirst_; // first element to id of every range
+  std::map<int, int> holes_;   // first element to size of every hole
+
+  // The lowest hole of at least count elements starting below limit
+  std::map<int, int>::iterator findHole(const int count, const int limit) {
+    for (std::map<int, int>::iterator h = holes_.begin(); h != holes_.end() && h->first < limit; ++h) {
+      if (h->second >= count)
+        return h;
+    }
+    return holes_.end();
+  }
+
+  // Takes count elements from the start of h
+  void takeHole(const std::map<int, int>::iterator h, const int count) {
+    const int first = h->first, size = h->second;
+    assert(size >= count);
+    const std::map<int, int>::iterator next = holes_.erase(h);
+    if (size > count)
+      holes_.insert(next, std::make_pair(first + count, size - count));
+  }
+
+  // Frees count elements at first, merging with the holes on either side
+  void addHole(const int first, int count) {
+    std::map<int, int>::iterator next = holes_.lower_bound(first);
+    if (next != holes_.end() && first + count == next->first) {
+      count += next->second;
+      next = holes_.erase(next);
+    }
+    if (next != holes_.begin()) {
+      const std::map<int, int>::iterator prev = std::prev(next);
+      if (prev->first + prev->second == first) {
+        prev->second += count;
+        return;
+      }
+    }
+    holes_.insert(next, std::make_pair(first, count));
+  }
+
+  // Copies count elements from first down to to
+  void moveRange(const int first, const int to, const int count) {
+    const GLintptr from = GLintptr(first) * elementSize_, dest = GLintptr(to) * elementSize_;
+    const GLsizeiptr bytes = GLsizeiptr(count) * elementSize_;
+    glBindBuffer(GL_COPY_READ_BUFFER, *buffer_);
+    if (first - to >= count) {
+      glBindBuffer(GL_COPY_WRITE_BUFFER, *buffer_);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, from, dest, bytes);
+      return;
+    }
+
+    if (scratchCapacity_ < count) {
+      scratch_.reset(new GlBufferObject);
+      scratchCapacity_ = count;
+      glBindBuffer(GL_COPY_WRITE_BUFFER, *scratch_);
+      glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STREAM_COPY);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, *scratch_);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, from, 0, bytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, *scratch_);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, *buffer_);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, dest, bytes);
+  }
+
+  // One past the last element in use
+  int end() const {
+    if (byFirst_.empty())
+      return 0;
+    const Range& last = ranges_[byFirst_.rbegin()->second];
+    return last.first + last.count;
+  }
+
+  // Reallocates so the end of the buffer has at least needed more free
+  // elements, at least doubling
+  void grow(const int needed) {
+    const int c = std::max(2 * capacity_, capacity_ + needed);
+    reallocate(c);
+    addHole(capacity_, c - capacity_);
+    capacity_ = c;
+  }
+
+  // Halves the buffer while what is in use fits in a quarter of it, which
+  // leaves room for it to double again before growing
+  void shrink() {
+    int c = capacity_;
+    while (c / 2 >= initialCapacity_ && end() <= c / 4) {
+      c /= 2;
+    }
+    if (c == capacity_)
+      return;
+
+    reallocate(c);
+    const int e = end();
+    holes_.erase(e);
+    if (c > e)
+      holes_[e] = c - e;
+    capacity_ = c;
+
+    // the scratch buffer is at most as big as a range
+    scratch_.reset();
+    scratchCapacity_ = 0;
+  }
+
+  // Replaces the buffer by one of c elements holding what the old one did up
+  // to the end of the last range
+  void reallocate(const int c) {
+    std::unique_ptr<GlBufferObject> b(new GlBufferObject);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, *b);
+    glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(c) * elementSize_, NULL, GL_STATIC_DRAW);
+    if (end() > 0) {
+      glBindBuffer(GL_COPY_READ_BUFFER, *buffer_);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, GLsizeiptr(end()) * elementSize_);
+    }
+    buffer_.swap(b);
+    ++generation_;
+    checkGlErrors();
+  }
+};
+
+// A range of a GlBufferArena, given back when destroyed. The arena must
+// outlive it.
+class GlArenaRange : Noncopyable {
+public:
+  GlArenaRange(GlBufferArena& arena, const int count) : arena_(arena), id_(arena.allocate(count)) {}
+
+  ~GlArenaRange() {
+    arena_.free(id_);
+  }
+
+  // First element in the arena's buffer, which compact may change
+  int first() const {
+    return arena_.first(id_);
+  }
+
+  int count() const {
+    return arena_.count(id_);
+  }
+
+  void upload(const void *data) {
+    arena_.upload(id_, data);
+  }
+
+private:
+  GlBufferArena& arena_;
+  const int id_;
+};
+
+#endif
@@ -0,0 +1,259 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include "cvec.h"
+#include "matrix4.h"
+#include "matrix4f.h" // for CS150_SSE
+
+//--------------------------------------------------------------------------------
+// View frustum culling over a bounding volume hierarchy
+//--------------------------------------------------------------------------------
+//
+// Bvh keeps one axis-aligned box per object in a binary tree built top down
+// by median splits, so every node's objects are a contiguous run of the
+// tree's object order. Moving objects update their leaf and the boxes above
+// it, without changing the tree's shape, so it should be built again when
+// many objects have moved far.
+//
+// cull walks the tree against a Frustum and stops at nodes outside it. A
+// node wholly inside it hands over its run of objects without testing
+// anything below it, so the walk costs what the visible objects and the
+// frustum's border cost, not what the whole scene does.
+
+// An axis-aligned box as center and half extent
+struct BoundingBox {
+  Cvec3f center, extent;
+
+  BoundingBox() {}
+  BoundingBox(const Cvec3f& center, const Cvec3f& extent) : center(center), extent(extent) {}
+};
+
+// The smallest box containing a and b
+inline BoundingBox unite(const BoundingBox& a, const BoundingBox& b) {
+  Cvec3f lo, hi;
+  for (int i = 0; i < 3; ++i) {
+    lo[i] = std::min(a.center[i] - a.extent[i], b.center[i] - b.extent[i]);
+    hi[i] = std::max(a.center[i] + a.extent[i], b.center[i] + b.extent[i]);
+  }
+  return BoundingBox((lo + hi) * 0.5f, (hi - lo) * 0.5f);
+}
+
+inline bool contains(const BoundingBox& outer, const BoundingBox& inner) {
+  for (int i = 0; i < 3; ++i) {
+    if (std::abs(inner.center[i] - outer.center[i]) + inner.extent[i] > outer.extent[i])
+      return false;
+  }
+  return true;
+}
+
+// The box around the box [lo, hi] after the affine transform m
+inline BoundingBox transformBox(const Matrix4& m, const Cvec3& lo, const Cvec3& hi) {
+  const Cvec3 c = (lo + hi) * 0.5, e = (hi - lo) * 0.5;
+  BoundingBox r;
+  for (int i = 0; i < 3; ++i) {
+    r.center[i] = m(i,0) * c[0] + m(i,1) * c[1] + m(i,2) * c[2] + m(i,3);
+    r.extent[i] = std::abs(m(i,0)) * e[0] + std::abs(m(i,1)) * e[1] + std::abs(m(i,2)) * e[2];
+  }
+  return r;
+}
+
+enum CullResult {
+  CULL_OUTSIDE,
+  CULL_PARTIAL,
+  CULL_INSIDE
+};
+
+// The six planes of the clip volume -w <= x, y, z <= w, taken back through a
+// projection times view matrix into world space, in the layout the SSE test
+// wants: one array per plane coefficient, padded to 8 planes by repeating
+// the first two.
+class Frustum {
+public:
+  explicit Frustum(const Matrix4& viewProj) {
+    for (int k = 0; k < 8; ++k) {
+      const int row = k % 6 / 2;
+      const double sign = k % 2 ? -1 : 1;
+      nx_[k] = float(viewProj(3,0) + sign * viewProj(row,0));
+      ny_[k] = float(viewProj(3,1) + sign * viewProj(row,1));
+      nz_[k] = float(viewProj(3,2) + sign * viewProj(row,2));
+      d_[k] = float(viewProj(3,3) + sign * viewProj(row,3));
+      ax_[k] = std::abs(nx_[k]);
+      ay_[k] = std::abs(ny_[k]);
+      az_[k] = std::abs(nz_[k]);
+    }
+  }
+
+  // A box is outside if it is wholly behind one plane, and inside if it is
+  // wholly in front of all of them
+  CullResult classify(const BoundingBox& b) const {
+    int outside = 0, inside;
+#ifdef CS150_SSE
+    const __m128 cx = _mm_set1_ps(b.center[0]), cy = _mm_set1_ps(b.center[1]), cz = _mm_set1_ps(b.center[2]);
+    const __m128 ex = _mm_set1_ps(b.extent[0]), ey = _mm_set1_ps(b.extent[1]), ez = _mm_set1_ps(b.extent[2]);
+    inside = 0xF;
+    for (int k = 0; k < 8; k += 4) {
+      const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(nx_ + k), cx), _mm_mul_ps(_mm_load_ps(ny_ + k), cy)),
+                                     _mm_add_ps(_mm_mul_ps(_mm_load_ps(nz_ + k), cz), _mm_load_ps(d_ + k)));
+      const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(ax_ + k), ex), _mm_mul_ps(_mm_load_ps(ay_ + k), ey)),
+                                       _mm_mul_ps(_mm_load_ps(az_ + k), ez));
+      outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, radius), _mm_setzero_ps()));
+      inside &= _mm_movemask_ps(_mm_cmpge_ps(dist, radius));
+    }
+    inside = inside == 0xF;
+#else
+    inside = 1;
+    for (int k = 0; k < 6; ++k) {
+      const float dist = nx_[k] * b.center[0] + ny_[k] * b.center[1] + nz_[k] * b.center[2] + d_[k];
+      const float radius = ax_[k] * b.extent[0] + ay_[k] * b.extent[1] + az_[k] * b.extent[2];
+      outside |= dist + radius < 0;
+      inside &= dist >= radius;
+    }
+#endif
+    return outside ? CULL_OUTSIDE : inside ? CULL_INSIDE : CULL_PARTIAL;
+  }
+
+private:
+  alignas(16) float nx_[8];
+  alignas(16) float ny_[8];
+  alignas(16) float nz_[8];
+  alignas(16) float d_[8];
+  alignas(16) float ax_[8]; // absolute values of the normals
+  alignas(16) float ay_[8];
+  alignas(16) float az_[8];
+};
+
+// A leaf whose object moves out of its box gets the new box grown by this
+// fraction of its size, so an object moving a little each frame only
+// refits the tree now and then
+static const float CS150_BVH_MARGIN = 0.25f;
+
+class Bvh {
+public:
+  // Builds the tree over objects 0..n-1, object i having boxes[i]
+  void build(const BoundingBox *boxes, const int n) {
+    nodes_.clear();
+    order_.resize(n);
+    leafOf_.resize(n);
+    for (int i = 0; i < n; ++i) {
+      order_[i] = i;
+    }
+    if (n == 0)
+      return;
+
+    nodes_.resize(1);
+    nodes_.reserve(2 * n - 1);
+    nodes_[0].parent = -1;
+    buildNode(0, boxes, 0, n);
+  }
+
+  int size() const {
+    return order_.size();
+  }
+
+  // Gives object its new box, refitting the boxes above its leaf up to the
+  // first that does not change
+  void update(const int object, const BoundingBox& box) {
+    int n = leafOf_[object];
+    if (contains(nodes_[n].box, box))
+      return;
+    nodes_[n].box = BoundingBox(box.center, box.extent * (1 + CS150_BVH_MARGIN));
+    while ((n = nodes_[n].parent) >= 0) {
+      const int c = nodes_[n].child;
+      const BoundingBox b = unite(nodes_[c].box, nodes_[c + 1].box);
+      if (sameBox(b, nodes_[n].box))
+        break;
+      nodes_[n].box = b;
+    }
+  }
+
+  // Sets visible to the objects whose boxes are not outside f, in the
+  // tree's order, which keeps objects near each other together
+  void cull(const Frustum& f, std::vector<int>& visible) const {
+    visible.clear();
+    if (nodes_.empty())
+      return;
+
+    // median splits keep the depth at about log2 of the object count
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const Node& n = nodes_[stack[--top]];
+      const CullResult r = f.classify(n.box);
+      if (r == CULL_OUTSIDE)
+        continue;
+      if (r == CULL_INSIDE || n.child < 0) {
+        visible.insert(visible.end(), order_.begin() + n.first, order_.begin() + n.first + n.count);
+        continue;
+      }
+      assert(top + 2 <= 64);
+      stack[top++] = n.child + 1;
+      stack[top++] = n.child;
+    }
+  }
+
+private:
+  struct Node {
+    BoundingBox box;
+    int parent;
+    int child;        // the children are child and child + 1, -1 for a leaf
+    int first, count; // the node's objects in order_
+  };
+
+  std::vector<Node> nodes_;
+  std::vector<int> order_;  // objects, each node's contiguous
+  std::vector<int> leafOf_; // per object
+
+  static bool sameBox(const BoundingBox& a, const BoundingBox& b) {
+    for (int i = 0; i < 3; ++i) {
+      if (a.center[i] != b.center[i] || a.extent[i] != b.extent[i])
+        return false;
+    }
+    return true;
+  }
+
+  // Splits order_[first, first + count) at the median of the box centers
+  // along the axis they spread most along
+  void buildNode(const int node, const BoundingBox *boxes, const int first, const int count) {
+    nodes_[node].first = first;
+    nodes_[node].count = count;
+    if (count == 1) {
+      nodes_[node].child = -1;
+      nodes_[node].box = boxes[order_[first]];
+      leafOf_[order_[first]] = node;
+      return;
+    }
+
+    Cvec3f lo = boxes[order_[first]].center, hi = lo;
+    for (int i = first + 1; i < first + count; ++i) {
+      const Cvec3f& c = boxes[order_[i]].center;
+      for (int k = 0; k < 3; ++k) {
+        lo[k] = std::min(lo[k], c[k]);
+        hi[k] = std::max(hi[k], c[k]);
+      }
+    }
+    const Cvec3f spread = hi - lo;
+    const int axis = spread[0] >= spread[1] && spread[0] >= spread[2] ? 0 : spread[1] >= spread[2] ? 1 : 2;
+    const int half = count / 2;
+    std::nth_element(order_.begin() + first, order_.begin() + first + half, order_.begin() + first + count,
+                     [boxes, axis](const int a, const int b) {
+                       return boxes[a].center[axis] < boxes[b].center[axis];
+                     });
+
+    // reserved in build, so this does not move the nodes
+    const int child = nodes_.size();
+    nodes_.resize(child + 2);
+    nodes_[node].child = child;
+    nodes_[child].parent = nodes_[child + 1].parent = node;
+    buildNode(child, boxes, first, half);
+    buildNode(child + 1, boxes, first + half, count - half);
+    nodes_[node].box = unite(nodes_[child].box, nodes_[child + 1].box);
+  }
+};
+
+#endif
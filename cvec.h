@@ -1,6 +1,7 @@
 #ifndef VEC_H
 #define VEC_H
 
+#include <algorithm>
 #include <cmath>
 #include <cassert>
 
@@ -16,36 +17,31 @@ class Cvec {
   T d_[n];
 
 public:
-  Cvec() {
-    for (int i = 0; i < n; ++i) {
-      d_[i] = 0;
-    }
-  }
+  // The constructors are constexpr so that constant vectors (and the
+  // Matrix4 transforms built from them) can be folded at compile time
+  constexpr Cvec() : d_() {}
 
-  Cvec(const T& t) {
+  constexpr Cvec(const T& t) : d_() {
     for (int i = 0; i < n; ++i) {
       d_[i] = t;
     }
   }
 
-  Cvec(const T& t0, const T& t1) {
-    assert(n == 2); // better to use static_assert from c++11
-    d_[0] = t0, d_[1] = t1;
+  constexpr Cvec(const T& t0, const T& t1) : d_{t0, t1} {
+    static_assert(n == 2, "Cvec(t0, t1) needs n == 2");
   }
 
-  Cvec(const T& t0, const T& t1, const T& t2) {
-    assert(n == 3); // better to use static_assert from c++11
-    d_[0] = t0, d_[1] = t1, d_[2] = t2;
+  constexpr Cvec(const T& t0, const T& t1, const T& t2) : d_{t0, t1, t2} {
+    static_assert(n == 3, "Cvec(t0, t1, t2) needs n == 3");
   }
 
-  Cvec(const T& t0, const T& t1, const T& t2, const T& t3) {
-    assert(n == 4); // better to use static_assert from c++11
-    d_[0] = t0, d_[1] = t1, d_[2] = t2, d_[3] = t3;
+  constexpr Cvec(const T& t0, const T& t1, const T& t2, const T& t3) : d_{t0, t1, t2, t3} {
+    static_assert(n == 4, "Cvec(t0, t1, t2, t3) needs n == 4");
   }
 
   // either truncate if m < n, or extend with extendValue
   template<int m>
-  explicit Cvec(const Cvec<T, m>& v, const T& extendValue = T(0)) {
+  constexpr explicit Cvec(const Cvec<T, m>& v, const T& extendValue = T(0)) : d_() {
     for (int i = 0; i < std::min(m, n); ++i) {
       d_[i] = v[i];
     }
@@ -54,48 +50,48 @@ public:
     }
   }
 
-  T& operator [] (const int i) {
+  constexpr T& operator [] (const int i) {
     return d_[i];
   }
 
-  const T& operator [] (const int i) const {
+  constexpr const T& operator [] (const int i) const {
     return d_[i];
   }
 
-  T& operator () (const int i) {
+  constexpr T& operator () (const int i) {
     return d_[i];
   }
 
-  const T& operator () (const int i) const {
+  constexpr const T& operator () (const int i) const {
     return d_[i];
   }
 
-  Cvec operator - () const {
+  constexpr Cvec operator - () const {
     return Cvec(*this) *= -1;
   }
 
-  Cvec& operator += (const Cvec& v) {
+  constexpr Cvec& operator += (const Cvec& v) {
     for (int i = 0; i < n; ++i) {
       d_[i] += v[i];
     }
     return *this;
   }
 
-  Cvec& operator -= (const Cvec& v) {
+  constexpr Cvec& operator -= (const Cvec& v) {
     for (int i = 0; i < n; ++i) {
       d_[i] -= v[i];
     }
     return *this;
   }
 
-  Cvec& operator *= (const T a) {
+  constexpr Cvec& operator *= (const T a) {
     for (int i = 0; i < n; ++i) {
       d_[i] *= a;
     }
     return *this;
   }
 
-  Cvec& operator /= (const T a) {
+  constexpr Cvec& operator /= (const T a) {
     const T inva(1/a);
     for (int i = 0; i < n; ++i) {
       d_[i] *= inva;
@@ -103,19 +99,19 @@ public:
     return *this;
   }
 
-  Cvec operator + (const Cvec& v) const {
+  constexpr Cvec operator + (const Cvec& v) const {
     return Cvec(*this) += v;
   }
 
-  Cvec operator - (const Cvec& v) const {
+  constexpr Cvec operator - (const Cvec& v) const {
     return Cvec(*this) -= v;
   }
 
-  Cvec operator * (const T a) const {
+  constexpr Cvec operator * (const T a) const {
     return Cvec(*this) *= a;
   }
 
-  Cvec operator / (const T a) const {
+  constexpr Cvec operator / (const T a) const {
     return Cvec(*this) /= a;
   }
 
@@ -127,12 +123,12 @@ public:
 };
 
 template<typename T>
-inline Cvec<T,3> cross(const Cvec<T,3>& a, const Cvec<T,3>& b) {
+constexpr Cvec<T,3> cross(const Cvec<T,3>& a, const Cvec<T,3>& b) {
   return Cvec<T,3>(a(1)*b(2)-a(2)*b(1), a(2)*b(0)-a(0)*b(2), a(0)*b(1)-a(1)*b(0));
 }
 
 template<typename T, int n>
-inline T dot(const Cvec<T,n>& a, const Cvec<T,n>& b) {
+constexpr T dot(const Cvec<T,n>& a, const Cvec<T,n>& b) {
   T r(0);
   for (int i = 0; i < n; ++i) {
     r += a(i)*b(i);
@@ -20,9 +20,14 @@
 #include <string>
 #include <memory>
 #include <stdexcept>
-#if __GNUG__
-#   include <tr1/memory>
-#endif
+#include <functional>
+#include <sstream>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#include <sys/stat.h>
 
 #include <GL/glew.h>
 #ifdef __MAC__
@@ -33,12 +38,25 @@
 
 #include "cvec.h"
 #include "matrix4.h"
+#include "matrix4f.h"
+#include "quat.h"
+#include "rigtform.h"
+#include "modelview.h"
 #include "geometrymaker.h"
+#include "meshtools.h"
+#include "vertexpack.h"
+#include "meshcache.h"
+#include "meshimport.h"
+#include "meshsimplify.h"
+#include "renderqueue.h"
+#include "ringbuffer.h"
+#include "geometrypool.h"
+#include "bvh.h"
+#include "occlusion.h"
 #include "ppm.h"
 #include "glsupport.h"
 
-using namespace std; // for string, vector, iostream, and other standard C++ stuff
-using namespace tr1; // for shared_ptr
+using namespace std; // for string, vector, iostream, shared_ptr, and other standard C++ stuff
 
 // G L O B A L S ///////////////////////////////////////////////////
 
@@ -59,6 +77,10 @@ using namespace tr1; // for shared_ptr
 // ----------------------------------------------------------------------------
 static const bool g_Gl2Compatible = false;
 
+// Store vertices in the 16-byte VertexPNXc layout instead of the 32-byte
+// VertexPNX one. Selects the matching basic-packed vertex shaders.
+static const bool g_compactVertices = true;
+
 static float g_frustMinFov = 60.0;        // Show at least 60 degree field of view
 static float g_frustFovY = g_frustMinFov; // FOV in y direction (updated by updateFrustFovY)
 
@@ -81,6 +103,57 @@ static float g_animSpeed = 0.5;         // clock units per second
 static int g_elapsedTime = 0;           // keeps track of how long it takes between frames
 static float g_animIncrement = g_animSpeed/60.0; // updated by idle() based on GPU speed
 
+// Per-frame (projection, lights) and per-object (matrices, color) uniforms
+// go through std140 uniform blocks written into g_uniformRing instead of one
+// glUniform call each, and draws pick their slice with glBindBufferRange.
+// Needs fences from OpenGL 3.2; main turns it off without them. The
+// instanced shaders need it for their per-frame uniforms.
+static bool g_useUniformBuffers = !g_Gl2Compatible;
+
+// Whether g_uniformRing stays mapped, which needs OpenGL 4.4 or
+// ARB_buffer_storage. Set by main.
+static bool g_persistentMapping = false;
+
+// Binding points of the FrameUniforms and ObjectUniforms blocks
+static const GLuint g_frameUniformBinding = 0;
+static const GLuint g_objectUniformBinding = 1;
+
+// std140 layouts of the blocks, vec3s padded to 4 floats
+struct FrameUniforms {
+  GLfloat projMatrix[16];
+  GLfloat light[4], light2[4];
+};
+
+struct ObjectUniforms {
+  GLfloat modelView[16], normalMatrix[16];
+  GLfloat color[4];
+};
+
+// Draw the whole scene with one glMultiDrawElementsIndirect per program and
+// primitive type, each object's data in the std430 ObjectStorage block.
+// Needs OpenGL 4.3, g_useGeometryPool and g_useUniformBuffers; main turns it
+// off without them.
+static bool g_useMultiDrawIndirect = !g_Gl2Compatible;
+
+// Binding point of the ObjectStorage block
+static const GLuint g_objectStorageBinding = 0;
+
+// std430 layout of an ObjectStorage entry
+struct ObjectStorageData {
+  GLfloat modelView[16], normalMatrix[16];
+  GLfloat color[4];
+  GLfloat posScale[4], posBias[4]; // of the object's level, for compact vertices
+};
+
+// Ties the uniform block called name, if the program has it, to binding
+static void bindUniformBlock(const GLuint program, const char name[], const GLuint binding) {
+  const GLuint index = glGetUniformBlockIndex(program, name);
+  if (index == GL_INVALID_INDEX)
+    cerr << "WARN: uniform block " << name << " cannot be bound (it either doesn't exist or has been optimized away).\n" << endl;
+  else
+    glUniformBlockBinding(program, index, binding);
+}
+
 struct ShaderState {
   GlProgram program;
 
@@ -90,23 +163,65 @@ struct ShaderState {
   GLint h_uModelViewMatrix;
   GLint h_uNormalMatrix;
   GLint h_uColor;
+  GLint h_uPosScale, h_uPosBias; // only used with compact vertices
 
   // Handles to vertex attributes
   GLint h_aPosition;
   GLint h_aNormal;
 
-  ShaderState(const char* vsfn, const char* fsfn) {
+  // Handles to per-instance attributes, only used by the instanced shaders,
+  // which take them in place of uModelViewMatrix, uNormalMatrix, and uColor
+  GLint h_aModelViewMatrix, h_aNormalMatrix, h_aColor;
+
+  // Handle to the object number of the indirect shaders, which look
+  // everything else up in the ObjectStorage block
+  GLint h_aObjectIndex;
+
+  // Where a shader takes its per-frame and per-object data from. All but
+  // SHADER_PLAIN take the per-frame data from the FrameUniforms block, and
+  // leave the handles of what they do not use at -1.
+  enum Kind {
+    SHADER_PLAIN,     // uniforms
+    SHADER_BLOCKS,    // per-object data from the ObjectUniforms block
+    SHADER_INSTANCED, // per-object data from per-instance attributes
+    SHADER_INDIRECT   // per-object data from the ObjectStorage block
+  };
+  Kind kind;
+
+  ShaderState(const char* vsfn, const char* fsfn, const Kind kind = SHADER_PLAIN) : kind(kind) {
     readAndCompileShader(program, vsfn, fsfn);
 
     const GLuint h = program; // short hand
 
     // Retrieve handles to uniform variables
-    h_uLight = safe_glGetUniformLocation(h, "uLight");
-    h_uLight2 = safe_glGetUniformLocation(h, "uLight2");
-    h_uProjMatrix = safe_glGetUniformLocation(h, "uProjMatrix");
-    h_uModelViewMatrix = safe_glGetUniformLocation(h, "uModelViewMatrix");
-    h_uNormalMatrix = safe_glGetUniformLocation(h, "uNormalMatrix");
-    h_uColor = safe_glGetUniformLocation(h, "uColor");
+    h_uLight = h_uLight2 = h_uProjMatrix = -1;
+    h_uModelViewMatrix = h_uNormalMatrix = h_uColor = -1;
+    if (kind == SHADER_PLAIN) {
+      h_uLight = safe_glGetUniformLocation(h, "uLight");
+      h_uLight2 = safe_glGetUniformLocation(h, "uLight2");
+      h_uProjMatrix = safe_glGetUniformLocation(h, "uProjMatrix");
+      h_uModelViewMatrix = safe_glGetUniformLocation(h, "uModelViewMatrix");
+      h_uNormalMatrix = safe_glGetUniformLocation(h, "uNormalMatrix");
+      h_uColor = safe_glGetUniformLocation(h, "uColor");
+    }
+    else
+      bindUniformBlock(h, "FrameUniforms", g_frameUniformBinding);
+    if (kind == SHADER_BLOCKS)
+      bindUniformBlock(h, "ObjectUniforms", g_objectUniformBinding);
+
+    h_aModelViewMatrix = h_aNormalMatrix = h_aColor = h_aObjectIndex = -1;
+    if (kind == SHADER_INSTANCED) {
+      h_aModelViewMatrix = safe_glGetAttribLocation(h, "aModelViewMatrix");
+      h_aNormalMatrix = safe_glGetAttribLocation(h, "aNormalMatrix");
+      h_aColor = safe_glGetAttribLocation(h, "aColor");
+    }
+    if (kind == SHADER_INDIRECT)
+      h_aObjectIndex = safe_glGetAttribLocation(h, "aObjectIndex");
+    h_uPosScale = h_uPosBias = -1;
+    if (g_compactVertices && kind != SHADER_INDIRECT) {
+      h_uPosScale = safe_glGetUniformLocation(h, "uPosScale");
+      h_uPosBias = safe_glGetUniformLocation(h, "uPosBias");
+    }
 
     // Retrieve handles to vertex attributes
     h_aPosition = safe_glGetAttribLocation(h, "aPosition");
@@ -127,8 +242,41 @@ static const char * const g_shaderFilesGl2[g_numShaders][2] = {
   {"./shaders/basic-gl2.vshader", "./shaders/solid-gl2.fshader"},
   {"./shaders/basic-gl2.vshader", "./shaders/phong-gl2.fshader"}
 };
+// vertex shaders that decode VertexPNXc, replacing basic-gl* when
+// g_compactVertices is set
+static const char * const g_compactVertexShader = "./shaders/basic-packed-gl3.vshader";
+static const char * const g_compactVertexShaderGl2 = "./shaders/basic-packed-gl2.vshader";
+// the shaders used with g_useUniformBuffers
+static const char * const g_uboShaderFiles[g_numShaders][2] = {
+  {"./shaders/basic-ubo-gl3.vshader", "./shaders/solid-ubo-gl3.fshader"},
+  {"./shaders/basic-ubo-gl3.vshader", "./shaders/phong-ubo-gl3.fshader"}
+};
+static const char * const g_compactUboVertexShader = "./shaders/basic-packed-ubo-gl3.vshader";
 static vector<shared_ptr<ShaderState> > g_shaderStates; // our global shader states
 
+// Draw all objects showing the same level of the same Geometry with one
+// glDrawElementsInstanced per chunk, reading each object's matrices and color
+// from an instance buffer. Needs glVertexAttribDivisor from OpenGL 3.3; main
+// turns it off when that or g_useUniformBuffers is missing.
+static bool g_useInstancing = !g_Gl2Compatible;
+
+// the instanced counterparts of g_shaderFiles and g_compactVertexShader
+static const char * const g_instancedShaderFiles[g_numShaders][2] = {
+  {"./shaders/basic-instanced-gl3.vshader", "./shaders/solid-instanced-gl3.fshader"},
+  {"./shaders/basic-instanced-gl3.vshader", "./shaders/phong-instanced-gl3.fshader"}
+};
+static const char * const g_compactInstancedVertexShader = "./shaders/basic-packed-instanced-gl3.vshader";
+static vector<shared_ptr<ShaderState> > g_instancedShaderStates;
+
+// the shaders used with g_useMultiDrawIndirect, which share the fragment
+// shaders of the instanced ones
+static const char * const g_indirectShaderFiles[g_numShaders][2] = {
+  {"./shaders/basic-indirect-gl4.vshader", "./shaders/solid-instanced-gl3.fshader"},
+  {"./shaders/basic-indirect-gl4.vshader", "./shaders/phong-instanced-gl3.fshader"}
+};
+static const char * const g_compactIndirectVertexShader = "./shaders/basic-packed-indirect-gl4.vshader";
+static vector<shared_ptr<ShaderState> > g_indirectShaderStates;
+
 // --------- Geometry
 
 // Macro used to obtain relative offset of a field within a struct
@@ -167,41 +315,595 @@ struct VertexPNX {
   }
 };
 
+// VertexPNX has no tangent frame, so the make* functions skip computing one
+// and write the remaining attributes directly
+template<>
+struct VertexTraits<VertexPNX> {
+  static const bool hasTexCoord = true;
+  static const bool hasTangents = false;
+
+  static void write(VertexPNX& v, const Cvec3f& pos, const Cvec3f& normal, const Cvec2f& tex,
+                    const Cvec3f&, const Cvec3f&) {
+    v.p = pos;
+    v.n = normal;
+    v.x = tex;
+  }
+};
+
+// The compact version of VertexPNX, 16 instead of 32 bytes: 16-bit positions
+// relative to a per-mesh PositionQuantization, an octahedral 16-bit normal
+// and 16-bit texture coordinates (see vertexpack.h). It has no VertexTraits:
+// the quantization comes from the bounding box of the finished mesh, so the
+// make* functions write VertexPNX and the mesh is packed afterwards.
+struct VertexPNXc {
+  short p[4]; // p[3] is padding
+  short n[2];
+  unsigned short x[2];
+
+  VertexPNXc() {}
+
+  VertexPNXc(const Cvec3f& pos, const Cvec3f& normal, const Cvec2f& texCoords,
+             const PositionQuantization& q) {
+    quantizePosition(pos, q, p);
+    p[3] = 0;
+    octEncodeNormal(normal, n);
+    x[0] = quantizeUnorm16(texCoords[0]);
+    x[1] = quantizeUnorm16(texCoords[1]);
+  }
+
+  VertexPNXc(const VertexPNX& v, const PositionQuantization& q) {
+    *this = VertexPNXc(v.p, v.n, v.x, q);
+  }
+
+  VertexPNXc(const GenericVertex& v, const PositionQuantization& q) {
+    *this = VertexPNXc(v.pos, v.normal, v.tex, q);
+  }
+};
+
+// Layout of the vertices Geometry uploads, as recorded in mesh cache files.
+// Must match the attribute pointers set in Geometry::draw.
+static MeshCacheFormat geometryVertexFormat() {
+  MeshCacheFormat f;
+  memset(&f, 0, sizeof(f));
+  f.numAttribs = 3;
+  if (g_compactVertices) {
+    const MeshCacheAttrib p = {3, GL_SHORT, GL_FALSE, offsetof(VertexPNXc, p)};
+    const MeshCacheAttrib n = {2, GL_SHORT, GL_FALSE, offsetof(VertexPNXc, n)};
+    const MeshCacheAttrib x = {2, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(VertexPNXc, x)};
+    f.vertexSize = sizeof(VertexPNXc);
+    f.attribs[0] = p, f.attribs[1] = n, f.attribs[2] = x;
+  }
+  else {
+    const MeshCacheAttrib p = {3, GL_FLOAT, GL_FALSE, offsetof(VertexPNX, p)};
+    const MeshCacheAttrib n = {3, GL_FLOAT, GL_FALSE, offsetof(VertexPNX, n)};
+    const MeshCacheAttrib x = {2, GL_FLOAT, GL_FALSE, offsetof(VertexPNX, x)};
+    f.vertexSize = sizeof(VertexPNX);
+    f.attribs[0] = p, f.attribs[1] = n, f.attribs[2] = x;
+  }
+  return f;
+}
+
+// Meshes with more vertices than this are split into chunks of at most this
+// many vertices so every chunk can keep 16-bit indices. Set to 0 to keep such
+// meshes whole and draw them with 32-bit indices instead.
+static int g_geometryChunkLimit = CS150_MAX_SHORT_INDEXED_VERTICES;
+
+// Record the attribute setup of every chunk in a vertex array object, one
+// per shader attribute layout, so a draw binds one object instead of
+// specifying the attributes again. Vertex array objects need OpenGL 3.0.
+static const bool g_useVertexArrays = !g_Gl2Compatible;
+
+// What the instanced shaders read per object, all column major
+struct InstanceData {
+  GLfloat modelView[16];
+  GLfloat normalMatrix[9]; // upper 3x3 of the normal matrix
+  GLfloat color[3];
+
+  InstanceData() {}
+
+  // MVM and NMVM are 4x4 as made by computeModelViewNormalMatrices
+  InstanceData(const GLfloat MVM[], const GLfloat NMVM[], const Cvec3f& c) {
+    memcpy(modelView, MVM, sizeof(modelView));
+    for (int j = 0; j < 3; ++j) {
+      for (int i = 0; i < 3; ++i) {
+        normalMatrix[3 * j + i] = NMVM[4 * j + i];
+      }
+      color[j] = c[j];
+    }
+  }
+};
+
+// Program and VAO bindings of the scene's draws, and what they cost
+static GlStateCache g_glState;
+
+// Put every Geometry into g_geometryPool instead of buffers of its own and
+// draw with the base vertex draw calls, so changing geometry binds nothing
+// and all geometries can be drawn by one glMultiDrawElementsIndirect. Needs
+// OpenGL 3.2; main turns it off without.
+static bool g_useGeometryPool = !g_Gl2Compatible;
+static shared_ptr<GlGeometryPool> g_geometryPool; // made by initGeometry
+
+// Bytes of g_geometryPool moved per frame to close the holes left by freed
+// geometry
+static const int g_geometryCompactBytes = 1 << 20;
+
+// InstanceData of the last drawInstanced. The VAOs of instanced layouts
+// point into it.
+static shared_ptr<GlBufferObject> g_instanceVbo;
+
+// The numbers 0, 1, 2, ... as an instanced attribute, which the indirect
+// shaders get as aObjectIndex. A command's baseInstance offsets it, so it
+// numbers the objects of a whole multi-draw.
+static shared_ptr<GlBufferObject> g_objectIndexVbo;
+static int g_objectIndexCount = 0; // how many numbers it has
+
 struct Geometry {
-  GlBufferObject vbo, ibo;
-  int vboLen, iboLen;
+  // Attribute locations of a shader, which decide what a VAO holds
+  struct AttribLayout {
+    GLint position, normal;
+    GLint modelView, normalMatrix, color; // per instance, -1 if not instanced
+    GLint objectIndex; // per instance, -1 if not indirect
+
+    explicit AttribLayout(const ShaderState& ss)
+      : position(ss.h_aPosition), normal(ss.h_aNormal),
+        modelView(ss.h_aModelViewMatrix), normalMatrix(ss.h_aNormalMatrix), color(ss.h_aColor),
+        objectIndex(ss.h_aObjectIndex) {}
+
+    bool operator == (const AttribLayout& a) const {
+      return position == a.position && normal == a.normal && modelView == a.modelView
+             && normalMatrix == a.normalMatrix && color == a.color && objectIndex == a.objectIndex;
+    }
+  };
+  typedef vector<pair<AttribLayout, shared_ptr<GlVertexArrayObject> > > VertexArrays;
+
+  // One VBO/IBO pair, or one range of g_geometryPool, drawn with a single
+  // glDrawElements
+  struct Chunk {
+    shared_ptr<GlBufferObject> vbo, ibo; // not with g_useGeometryPool
+    shared_ptr<GlArenaRange> vertices, indices; // only with g_useGeometryPool
+    int vboLen, iboLen;
+    GLenum indexType; // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    VertexArrays vaos; // made on first draw, not with g_useGeometryPool
+
+    // Where the chunk is in g_geometryPool, which compacting it changes
+    int baseVertex() const {
+      return vertices ? vertices->first() : 0;
+    }
+
+    int firstIndex() const {
+      return indices ? indices->first() : 0;
+    }
+  };
+
+  // The whole mesh at one resolution
+  struct Level {
+    vector<Chunk> chunks;
+    int vboLen, iboLen; // totals over all chunks
+    PositionQuantization posQuant; // for compact vertices, shared by all chunks
+    double error; // how far the mesh may be from the true surface, in object units
+  };
+
+  vector<Level> levels; // levels of detail, finest first
+  double radius;        // bounding sphere around the object's origin
+  Cvec3 boxMin, boxMax; // bounding box in object space
+
+  // Whether the geometry is a closed convex shape whose levels all have their
+  // vertices on its surface, so each coarser level lies inside the finer ones.
+  // Set it before adding levels. Only such geometry is used as an occluder: a
+  // hollow or concave shape's coarse levels can cover what shows through it,
+  // and an imported mesh's may stick out by their error.
+  bool convex;
+
+  // The triangles of the coarsest level, which stand in for the geometry in
+  // the occlusion buffer, or none if it is not convex
+  vector<Cvec3f> occluderVertices;
+  vector<int> occluderIndices;
+
+  // GL_TRIANGLES, or GL_TRIANGLE_STRIP for strips separated by the largest
+  // value of the index type (see CS150_RESTART_INDEX)
+  GLenum primitive;
+
+  // An empty geometry to add levels to
+  explicit Geometry(GLenum primitive = GL_TRIANGLES)
+    : radius(0), boxMin(numeric_limits<double>::max()), boxMax(-numeric_limits<double>::max()), convex(false),
+      primitive(primitive) {}
+
+  Geometry(VertexPNX *vtx, unsigned short *idx, int vboLen, int iboLen, GLenum primitive = GL_TRIANGLES)
+    : radius(0), boxMin(numeric_limits<double>::max()), boxMax(-numeric_limits<double>::max()), convex(false),
+      primitive(primitive) {
+    Level& l = newLevel(vtx, vboLen, 0, 0);
+    addChunk(l, vtx, vboLen, idx, iboLen, GL_UNSIGNED_SHORT, 0);
+  }
 
-  Geometry(VertexPNX *vtx, unsigned short *idx, int vboLen, int iboLen) {
-    this->vboLen = vboLen;
-    this->iboLen = iboLen;
+  Geometry(VertexPNX *vtx, unsigned int *idx, int vboLen, int iboLen, GLenum primitive = GL_TRIANGLES)
+    : radius(0), boxMin(numeric_limits<double>::max()), boxMax(-numeric_limits<double>::max()), convex(false),
+      primitive(primitive) {
+    addLevel(vtx, idx, vboLen, iboLen, 0);
+  }
 
-    // Now create the VBO and IBO
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(VertexPNX) * vboLen, vtx, GL_STATIC_DRAW);
+  // Appends a coarser version of the mesh whose distance from the true
+  // surface is at most error. Picks the index size per level: 16-bit if all
+  // vertices can be addressed with it and fit in g_geometryChunkLimit, else
+  // 16-bit chunks if g_geometryChunkLimit allows, else 32-bit. If cache is
+  // given, it receives everything uploaded so the level can be reloaded with
+  // the other addLevel.
+  void addLevel(VertexPNX *vtx, unsigned int *idx, int vboLen, int iboLen, double error,
+                MeshCacheWriter *cache = 0) {
+    assert(levels.empty() || error >= levels.back().error);
+    Level& l = newLevel(vtx, vboLen, error, cache);
+
+    // with strips, the index 0xFFFF is taken by the restart index
+    const bool strips = primitive == GL_TRIANGLE_STRIP;
+    const int maxShortIndexed = CS150_MAX_SHORT_INDEXED_VERTICES - strips;
+    const int limit = g_geometryChunkLimit > 0 ? min(g_geometryChunkLimit, maxShortIndexed) : maxShortIndexed;
+    if (vboLen <= limit) {
+      // narrowing keeps CS150_RESTART_INDEX all ones
+      vector<unsigned short> shortIdx(idx, idx + iboLen);
+      addChunk(l, vtx, vboLen, &shortIdx[0], iboLen, GL_UNSIGNED_SHORT, cache);
+      return;
+    }
+
+    vector<MeshChunk<VertexPNX> > pieces;
+    if (g_geometryChunkLimit > 0) {
+      if (strips)
+        splitStripsIntoChunks(vtx, vboLen, idx, iboLen, CS150_RESTART_INDEX, limit, pieces);
+      else
+        splitIntoChunks(vtx, vboLen, idx, iboLen, limit, pieces);
+    }
+    for (size_t i = 0; i < pieces.size(); ++i) {
+      addChunk(l, &pieces[i].vtx[0], pieces[i].vtx.size(), &pieces[i].idx[0], pieces[i].idx.size(), GL_UNSIGNED_SHORT, cache);
+    }
+    if (pieces.empty())
+      addChunk(l, vtx, vboLen, idx, iboLen, GL_UNSIGNED_INT, cache);
+  }
+
+  // Appends a level from a mapped cache file written through the other
+  // addLevel. The buffers are uploaded straight from the mapping.
+  void addLevel(const MeshCacheFile& f) {
+    const MeshCacheHeader& h = f.header();
+    assert(h.primitive == primitive);
+    assert(levels.empty() || h.error >= levels.back().error);
+
+    levels.push_back(Level());
+    Level& l = levels.back();
+    l.vboLen = l.iboLen = 0;
+    l.posQuant.scale = Cvec3f(h.posScale[0], h.posScale[1], h.posScale[2]);
+    l.posQuant.bias = Cvec3f(h.posBias[0], h.posBias[1], h.posBias[2]);
+    l.error = h.error;
+    radius = max(radius, double(h.radius));
+    growBox(Cvec3(h.boundsMin[0], h.boundsMin[1], h.boundsMin[2]), Cvec3(h.boundsMax[0], h.boundsMax[1], h.boundsMax[2]));
+
+    for (uint32_t i = 0; i < h.numChunks; ++i) {
+      const MeshCacheChunk& c = f.chunk(i);
+      uploadChunk(l, f.vertices(i), h.format.vertexSize, c.vboLen, f.indices(i), c.iboLen, c.indexType);
+    }
+  }
+
+  int numLevels() const {
+    return levels.size();
+  }
+
+  // Sets what all draws of a level share, the uniforms decoding compact
+  // positions and the restart index. draw and drawInstanced expect it.
+  void bindLevel(const ShaderState& curSS, const int level) {
+    const Level& l = levels[level];
+    if (g_compactVertices) {
+      safe_glUniform3f(curSS.h_uPosScale, l.posQuant.scale[0], l.posQuant.scale[1], l.posQuant.scale[2]);
+      safe_glUniform3f(curSS.h_uPosBias, l.posQuant.bias[0], l.posQuant.bias[1], l.posQuant.bias[2]);
+    }
+
+    if (primitive == GL_TRIANGLE_STRIP) {
+      // all chunks of a level have the same index type
+      glEnable(GL_PRIMITIVE_RESTART);
+      glPrimitiveRestartIndex(l.chunks[0].indexType == GL_UNSIGNED_INT ? 0xFFFFFFFFu : 0xFFFFu);
+    }
+  }
 
+  void unbindLevel() {
+    if (primitive == GL_TRIANGLE_STRIP)
+      glDisable(GL_PRIMITIVE_RESTART);
+  }
+
+  // Draws a level bound with bindLevel. The VAO is left bound, so drawing a
+  // single-chunk level again binds nothing.
+  void draw(const ShaderState& curSS, const int level = 0) {
+    Level& l = levels[level];
+
+    if (!g_useVertexArrays) {
+      // Enable the attributes used by our shader
+      safe_glEnableVertexAttribArray(curSS.h_aPosition);
+      safe_glEnableVertexAttribArray(curSS.h_aNormal);
+    }
+
+    for (size_t i = 0; i < l.chunks.size(); ++i) {
+      Chunk& c = l.chunks[i];
+      if (g_useVertexArrays)
+        g_glState.bindVertexArray(vertexArray(c, curSS));
+      else
+        bindAttributes(c, curSS);
+
+      // draw!
+      if (g_useGeometryPool)
+        glDrawElementsBaseVertex(primitive, c.iboLen, c.indexType, indexOffset(c), c.baseVertex());
+      else
+        glDrawElements(primitive, c.iboLen, c.indexType, 0);
+      ++g_glState.stats.draws;
+    }
+
+    if (!g_useVertexArrays) {
+      // Disable the attributes used by our shader
+      safe_glDisableVertexAttribArray(curSS.h_aPosition);
+      safe_glDisableVertexAttribArray(curSS.h_aNormal);
+    }
+  }
+
+  // Draws count copies of a level bound with bindLevel, one per entry of
+  // instances, with one of the instanced shaders. Only needs one draw call
+  // per chunk.
+  void drawInstanced(const ShaderState& curSS, const InstanceData *instances, const int count, const int level = 0) {
+    assert(g_useInstancing && curSS.kind == ShaderState::SHADER_INSTANCED);
+    if (count == 0)
+      return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, *g_instanceVbo);
+    // orphan the old contents so the upload need not wait for draws using them
+    glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceData) * count, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(InstanceData) * count, instances);
+
+    Level& l = levels[level];
+    for (size_t i = 0; i < l.chunks.size(); ++i) {
+      Chunk& c = l.chunks[i];
+      g_glState.bindVertexArray(vertexArray(c, curSS));
+      if (g_useGeometryPool)
+        glDrawElementsInstancedBaseVertex(primitive, c.iboLen, c.indexType, indexOffset(c), count, c.baseVertex());
+      else
+        glDrawElementsInstanced(primitive, c.iboLen, c.indexType, 0, count);
+      ++g_glState.stats.draws;
+    }
+  }
+
+private:
+
+  // Appends a chunk in the uploaded format to the occluder, as positions and
+  // a triangle list
+  void addOccluderChunk(const Level& l, const void *vtx, int vertexSize, int vboLen, const void *idx, int iboLen,
+                        GLenum indexType) {
+    const int base = occluderVertices.size();
+    for (int i = 0; i < vboLen; ++i) {
+      const char *v = static_cast<const char *>(vtx) + size_t(i) * vertexSize;
+      if (vertexSize == sizeof(VertexPNXc))
+        occluderVertices.push_back(dequantizePosition(reinterpret_cast<const VertexPNXc *>(v)->p, l.posQuant));
+      else
+        occluderVertices.push_back(reinterpret_cast<const VertexPNX *>(v)->p);
+    }
+
+    const bool wide = indexType == GL_UNSIGNED_INT;
+    const unsigned int restart = wide ? 0xFFFFFFFFu : 0xFFFFu;
+    int strip = 0, prev[2] = {0, 0}; // strip length since the last restart, its last two vertices
+    for (int i = 0; i < iboLen; ++i) {
+      const unsigned int k = wide ? static_cast<const GLuint *>(idx)[i] : static_cast<const GLushort *>(idx)[i];
+      if (primitive != GL_TRIANGLE_STRIP)
+        occluderIndices.push_back(base + k);
+      else if (k == restart)
+        strip = 0;
+      else {
+        // the winding does not matter to the occlusion buffer
+        if (++strip >= 3) {
+          occluderIndices.push_back(prev[0]);
+          occluderIndices.push_back(prev[1]);
+          occluderIndices.push_back(base + k);
+        }
+        prev[0] = prev[1];
+        prev[1] = base + k;
+      }
+    }
+  }
+
+  void growBox(const Cvec3& lo, const Cvec3& hi) {
+    for (int i = 0; i < 3; ++i) {
+      boxMin[i] = min(boxMin[i], lo[i]);
+      boxMax[i] = max(boxMax[i], hi[i]);
+    }
+  }
+
+  Level& newLevel(const VertexPNX *vtx, const int vboLen, const double error, MeshCacheWriter *cache) {
+    levels.push_back(Level());
+    Level& l = levels.back();
+    l.vboLen = l.iboLen = 0;
+    l.posQuant = makePositionQuantization(vtx, vboLen);
+    l.error = error;
+    double levelRadius = 0;
+    for (int i = 0; i < vboLen; ++i) {
+      levelRadius = max(levelRadius, double(norm(vtx[i].p)));
+    }
+    radius = max(radius, levelRadius);
+
+    // the box the quantization spans, which is also what the cache stores
+    Cvec3 lo, hi;
+    for (int i = 0; i < 3; ++i) {
+      lo[i] = l.posQuant.bias[i] - l.posQuant.scale[i] * CS150_SNORM16_MAX;
+      hi[i] = l.posQuant.bias[i] + l.posQuant.scale[i] * CS150_SNORM16_MAX;
+    }
+    growBox(lo, hi);
+
+    if (cache) {
+      MeshCacheHeader& h = cache->header;
+      h.format = geometryVertexFormat();
+      h.primitive = primitive;
+      h.radius = levelRadius;
+      h.error = error;
+      for (int i = 0; i < 3; ++i) {
+        h.posScale[i] = l.posQuant.scale[i];
+        h.posBias[i] = l.posQuant.bias[i];
+        h.boundsMin[i] = lo[i];
+        h.boundsMax[i] = hi[i];
+      }
+    }
+    return l;
+  }
+
+  // Converts vertices to the uploaded format and uploads them
+  void addChunk(Level& l, const VertexPNX *vtx, int vboLen, const void *idx, int iboLen, GLenum indexType,
+                MeshCacheWriter *cache) {
+    const int indexSize = indexType == GL_UNSIGNED_INT ? sizeof(unsigned int) : sizeof(unsigned short);
+    vector<VertexPNXc> packed;
+    const void *data = vtx;
+    if (g_compactVertices) {
+      packed.reserve(vboLen);
+      for (int i = 0; i < vboLen; ++i) {
+        packed.push_back(VertexPNXc(vtx[i], l.posQuant));
+      }
+      data = &packed[0];
+    }
+
+    const int vertexSize = g_compactVertices ? sizeof(VertexPNXc) : sizeof(VertexPNX);
+    uploadChunk(l, data, vertexSize, vboLen, idx, iboLen, indexType);
+    if (cache)
+      cache->addChunk(data, vboLen, idx, iboLen, indexType, indexSize);
+  }
+
+  // The first index of c as the pointer argument of the draw calls
+  static const GLvoid *indexOffset(const Chunk& c) {
+    return (const GLvoid *)(size_t(c.firstIndex()) * (c.indexType == GL_UNSIGNED_INT ? sizeof(GLuint) : sizeof(GLushort)));
+  }
+
+  // Points the shader's attributes into the VBO of c and binds its IBO
+  static void bindAttributes(const Chunk& c, const ShaderState& curSS) {
+    if (g_useGeometryPool)
+      bindAttributes(g_geometryPool->vbo(), g_geometryPool->ibo(), curSS);
+    else
+      bindAttributes(*c.vbo, *c.ibo, curSS);
+  }
+
+  static void bindAttributes(const GLuint vbo, const GLuint ibo, const ShaderState& curSS) {
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    if (g_compactVertices) {
+      // unnormalized: the shader applies the scale itself
+      safe_glVertexAttribPointer(curSS.h_aPosition, 3, GL_SHORT, GL_FALSE, sizeof(VertexPNXc), FIELD_OFFSET(VertexPNXc, p));
+      safe_glVertexAttribPointer(curSS.h_aNormal, 2, GL_SHORT, GL_FALSE, sizeof(VertexPNXc), FIELD_OFFSET(VertexPNXc, n));
+    }
+    else {
+      safe_glVertexAttribPointer(curSS.h_aPosition, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPNX), FIELD_OFFSET(VertexPNX, p));
+      safe_glVertexAttribPointer(curSS.h_aNormal, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPNX), FIELD_OFFSET(VertexPNX, n));
+    }
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short) * iboLen, idx, GL_STATIC_DRAW);
   }
 
-  void draw(const ShaderState& curSS) {
-    // Enable the attributes used by our shader
+  // The VAO of c for the attribute layout of curSS, recorded on first use.
+  // Leaves it bound.
+  static GLuint vertexArray(Chunk& c, const ShaderState& curSS) {
+    return g_useGeometryPool ? poolVertexArray(curSS) : vertexArray(c.vaos, c, curSS);
+  }
+
+public:
+  // The VAO of g_geometryPool for the attribute layout of curSS, shared by
+  // every pooled chunk. Leaves it bound.
+  static GLuint poolVertexArray(const ShaderState& curSS) {
+    static VertexArrays vaos;
+    static int generation = -1;
+    if (generation != g_geometryPool->generation()) {
+      // the pool's buffers were replaced
+      vaos.clear();
+      g_glState.forget();
+      generation = g_geometryPool->generation();
+    }
+    return vertexArray(vaos, Chunk(), curSS);
+  }
+
+private:
+  // The VAO in vaos for the layout of curSS, recorded with the buffers of c
+  // if there is none yet
+  static GLuint vertexArray(VertexArrays& vaos, const Chunk& c, const ShaderState& curSS) {
+    const AttribLayout layout(curSS);
+    for (size_t i = 0; i < vaos.size(); ++i) {
+      if (vaos[i].first == layout)
+        return *vaos[i].second;
+    }
+
+    shared_ptr<GlVertexArrayObject> vao(new GlVertexArrayObject);
+    g_glState.bindVertexArray(*vao);
     safe_glEnableVertexAttribArray(curSS.h_aPosition);
     safe_glEnableVertexAttribArray(curSS.h_aNormal);
+    bindInstanceAttributes(layout);
+    bindAttributes(c, curSS);
+    vaos.push_back(make_pair(layout, vao));
+    return *vao;
+  }
 
-    // bind vertex buffer object
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    safe_glVertexAttribPointer(curSS.h_aPosition, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPNX), FIELD_OFFSET(VertexPNX, p));
-    safe_glVertexAttribPointer(curSS.h_aNormal, 3, GL_FLOAT, GL_FALSE, sizeof(VertexPNX), FIELD_OFFSET(VertexPNX, n));
+  // Points the per-instance attributes of layout, if any, into g_instanceVbo
+  // or g_objectIndexVbo, advancing once per instance. A matrix attribute
+  // takes one location per column.
+  static void bindInstanceAttributes(const AttribLayout& layout) {
+    if (layout.objectIndex >= 0) {
+      glBindBuffer(GL_ARRAY_BUFFER, *g_objectIndexVbo);
+      glEnableVertexAttribArray(layout.objectIndex);
+      glVertexAttribIPointer(layout.objectIndex, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
+      glVertexAttribDivisor(layout.objectIndex, 1);
+    }
+    if (layout.modelView < 0)
+      return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, *g_instanceVbo);
+    const int stride = sizeof(InstanceData);
+    for (int j = 0; j < 4; ++j) {
+      const GLuint h = layout.modelView + j;
+      glEnableVertexAttribArray(h);
+      glVertexAttribPointer(h, 4, GL_FLOAT, GL_FALSE, stride, (const GLvoid *)(offsetof(InstanceData, modelView) + 4 * j * sizeof(GLfloat)));
+      glVertexAttribDivisor(h, 1);
+    }
+    for (int j = 0; j < 3 && layout.normalMatrix >= 0; ++j) {
+      const GLuint h = layout.normalMatrix + j;
+      glEnableVertexAttribArray(h);
+      glVertexAttribPointer(h, 3, GL_FLOAT, GL_FALSE, stride, (const GLvoid *)(offsetof(InstanceData, normalMatrix) + 3 * j * sizeof(GLfloat)));
+      glVertexAttribDivisor(h, 1);
+    }
+    if (layout.color >= 0) {
+      glEnableVertexAttribArray(layout.color);
+      glVertexAttribPointer(layout.color, 3, GL_FLOAT, GL_FALSE, stride, (const GLvoid *)offsetof(InstanceData, color));
+      glVertexAttribDivisor(layout.color, 1);
+    }
+  }
 
-    // bind index buffer object
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+  void uploadChunk(Level& l, const void *vtx, int vertexSize, int vboLen, const void *idx, int iboLen, GLenum indexType) {
+    if (convex) {
+      if (l.chunks.empty()) {
+        // a coarser level than the occluder so far
+        occluderVertices.clear();
+        occluderIndices.clear();
+      }
+      addOccluderChunk(l, vtx, vertexSize, vboLen, idx, iboLen, indexType);
+    }
+
+    Chunk c;
+    c.vboLen = vboLen;
+    c.iboLen = iboLen;
+    c.indexType = indexType;
+    l.vboLen += vboLen;
+    l.iboLen += iboLen;
+
+    if (g_useGeometryPool) {
+      g_geometryPool->add(vtx, vboLen, idx, iboLen, indexType, primitive == GL_TRIANGLE_STRIP, c.vertices, c.indices);
+      c.indexType = g_geometryPool->indexType();
+      l.chunks.push_back(c);
+      return;
+    }
+
+    c.vbo.reset(new GlBufferObject);
+    c.ibo.reset(new GlBufferObject);
+
+    // the IBO binding would otherwise go into the last VAO drawn
+    if (g_useVertexArrays)
+      g_glState.bindVertexArray(0);
+
+    // Now create the VBO and IBO
+    glBindBuffer(GL_ARRAY_BUFFER, *c.vbo);
+    glBufferData(GL_ARRAY_BUFFER, size_t(vertexSize) * vboLen, vtx, GL_STATIC_DRAW);
 
-    // draw!
-    glDrawElements(GL_TRIANGLES, iboLen, GL_UNSIGNED_SHORT, 0);
+    const size_t indexSize = indexType == GL_UNSIGNED_INT ? sizeof(unsigned int) : sizeof(unsigned short);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *c.ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexSize * iboLen, idx, GL_STATIC_DRAW);
 
-    // Disable the attributes used by our shader
-    safe_glDisableVertexAttribArray(curSS.h_aPosition);
-    safe_glDisableVertexAttribArray(curSS.h_aNormal);
+    l.chunks.push_back(c);
   }
 };
 
@@ -210,63 +912,371 @@ static shared_ptr<Geometry> g_cube, g_sphere, g_octa, g_tube;
 
 // --------- Scene
 
-static const Cvec3 g_light1(2.0, 3.0, 14.0), g_light2(-2, -3.0, -5.0);  // define two light positions in world space
-static Matrix4 g_eyeRbt = Matrix4::makeTranslation(Cvec3(0.0, 3.25, 10.0));
+static constexpr Cvec3 g_light1(2.0, 3.0, 14.0), g_light2(-2, -3.0, -5.0);  // define two light positions in world space
+static RigTForm g_eyeRbt = RigTForm(Cvec3(0.0, 3.25, 10.0));
 static const int g_numObjects = 3;
-static Matrix4 g_objectRbt[g_numObjects] = {Matrix4::makeTranslation(Cvec3(0,4,0)), Matrix4::makeTranslation(Cvec3(-4,3,0)), Matrix4::makeTranslation(Cvec3(4,3,0))}; // each object gets its own RBT  
+static RigTForm g_objectRbt[g_numObjects] = {RigTForm(Cvec3(0,4,0)), RigTForm(Cvec3(-4,3,0)), RigTForm(Cvec3(4,3,0))}; // each object gets its own RBT  
+static const double g_octaScale = 0.4; // the octahedron is drawn scaled down in its own frame
+
+// Levels of detail are picked so that their error covers at most
+// g_lodPixelError pixels on screen. Switching to a coarser level needs the
+// error to be g_lodHysteresis times smaller than that, so an object sitting
+// near a threshold does not pop back and forth.
+static double g_lodPixelError = 1.0;
+static const double g_lodHysteresis = 1.5;
+
+// A crowd of extra tubes, spheres, and octahedra standing on a grid behind
+// the chasing objects, to see how the renderer copes with many objects. 'c'
+// cycles through the sizes. The crowd follows the chasing objects in the
+// scene's object list, and object i is always a copy of geometry i %
+// g_numObjects.
+static const int g_numCrowdSizes = 3;
+static const int g_crowdSizes[g_numCrowdSizes] = {0, 1000, 100000};
+static int g_crowdSize = 0; // index into g_crowdSizes
+
+// per object of the scene, the chasing objects first
+static vector<Matrix4> g_objectModels; // the chasing objects' are set every frame
+static vector<Cvec3f> g_objectColors;
+static vector<int> g_objectLod; // level each object was last drawn with
+
+// Only draw the objects whose bounding boxes reach into the view frustum,
+// found by walking g_sceneBvh, which holds every object's box in world space
+static bool g_useFrustumCulling = true;
+static Bvh g_sceneBvh;
+
+// Then leave out the objects hidden behind the g_numOccluders objects that
+// look biggest, drawn into g_occlusionBuffer on the CPU
+static bool g_useOcclusionCulling = true;
+static const int g_numOccluders = 8;
+static OcclusionBuffer g_occlusionBuffer(256, 128);
+
+static RenderQueue g_renderQueue;
+static shared_ptr<GlRingBuffer> g_uniformRing; // the uniform blocks of the frames in flight
+static RenderStats g_lastFrameStats; // of the frame drawn last, for the FPS report
 
 ///////////////// END OF G L O B A L S //////////////////////////////////////////////////
 
-static void initObjects() {
-  // each kind of geometry needs to be initialized here
-  int ibLen, vbLen;
-  getCubeVbIbLen(vbLen, ibLen);
+// Reorder generated meshes for the post-transform vertex cache before upload
+static bool g_optimizeMeshes = true;
 
-  // Temporary storage for vertex and index buffers
-  vector<VertexPNX> vtx(vbLen);
-  vector<unsigned short> idx(ibLen);
+// Runs the vertex cache and vertex fetch passes of meshtools.h on a mesh,
+// reporting the simulated ACMR/ATVR before and after
+static void optimizeMesh(const char *name, vector<VertexPNX>& vtx, vector<unsigned int>& idx) {
+  if (!g_optimizeMeshes)
+    return;
 
-  makeCube(2, vtx.begin(), idx.begin());
-  g_cube.reset(new Geometry(&vtx[0], &idx[0], vbLen, ibLen));
+  const int ibLen = idx.size();
+  const VertexCacheStats before = measureVertexCache(&idx[0], ibLen, vtx.size());
+  optimizeVertexCache(&idx[0], ibLen, vtx.size());
+  vtx.resize(optimizeVertexFetch(&vtx[0], vtx.size(), &idx[0], ibLen));
+  const VertexCacheStats after = measureVertexCache(&idx[0], ibLen, vtx.size());
 
-  getSphereVbIbLen(30, 20, vbLen, ibLen);
-  vtx.resize(vbLen);
-  idx.resize(ibLen);
-  makeSphere(1.0, 30, 20, vtx.begin(), idx.begin());
-  g_sphere.reset(new Geometry(&vtx[0], &idx[0], vbLen, ibLen));
+  cout << name << ": ACMR " << before.acmr << " -> " << after.acmr
+       << ", ATVR " << before.atvr << " -> " << after.atvr << endl;
+}
 
-  // TODO: add octahedron, tube
+// Number of levels of detail built for the sphere and the tube, each with
+// half the tessellation of the one before
+static const int g_numLods = 4;
+
+// Build the sphere and tube as triangle strips with primitive restart, which
+// needs OpenGL 3.1
+static bool g_useStrips = !g_Gl2Compatible;
+
+// Build the sphere by subdividing an icosahedron, which spreads its vertices
+// evenly, instead of as a UV sphere
+static const bool g_useIcosphere = true;
+
+// Generated meshes are stored in g_meshCacheDir the first time and mapped
+// from there on later runs instead of being generated again
+static bool g_useMeshCache = true;
+static const char * const g_meshCacheDir = "./meshcache";
+
+// Part of every mesh cache key. The key only covers parameters, not the
+// code that turns them into a mesh, so bump this whenever the output of the
+// make* generators, the importer, optimizeMesh, simplifyMesh or anything
+// else on the way to Geometry changes, or ./meshcache keeps serving the old
+// meshes.
+static const int g_meshPipelineVersion = 2;
+
+// Adds a level to g, from the mesh cache if it has one for description or
+// else by calling build and caching its output. description must name every
+// parameter build depends on; settings that change what Geometry uploads are
+// added here. build may replace error when it is only known after building.
+static void addCachedLevel(Geometry& g, const string& description, double error,
+                           const function<void (vector<VertexPNX>&, vector<unsigned int>&, double&)>& build) {
+  ostringstream key;
+  key << "pipeline " << g_meshPipelineVersion << " " << description << " error " << error << " primitive " << g.primitive << " optimize " << g_optimizeMeshes
+      << " chunk " << g_geometryChunkLimit << " compact " << g_compactVertices;
+  const uint64_t k = meshCacheKey(key.str());
+  const string path = meshCachePath(g_meshCacheDir, k);
+
+  MeshCacheFile f;
+  if (g_useMeshCache && f.open(path, k, geometryVertexFormat())) {
+    g.addLevel(f);
+    return;
+  }
 
-  getOctahedronVbIbLen(vbLen, ibLen);
-  vtx.resize(vbLen);
-  idx.resize(ibLen);
-  makeOctahedron(2, vtx.begin(), idx.begin());
-  g_octa.reset(new Geometry(&vtx[0], &idx[0], vbLen, ibLen));
+  vector<VertexPNX> vtx;
+  vector<unsigned int> idx;
+  build(vtx, idx, error);
 
+  MeshCacheWriter w;
+  w.header.key = k;
+  g.addLevel(&vtx[0], &idx[0], vtx.size(), idx.size(), error, g_useMeshCache ? &w : 0);
+  if (g_useMeshCache) {
+    try {
+      w.write(path);
+    }
+    catch (const runtime_error& e) {
+      cerr << "WARN: " << e.what() << endl; // still works, only slower next time
+    }
+  }
+}
+
+// Builds the sphere's LOD chain, starting at slices x stacks
+static shared_ptr<Geometry> makeSphereGeometry(float radius, int slices, int stacks) {
+  shared_ptr<Geometry> g(new Geometry(g_useStrips ? GL_TRIANGLE_STRIP : GL_TRIANGLES));
+  g->convex = true;
+  for (int k = 0; k < g_numLods; ++k) {
+    ostringstream desc;
+    desc << "sphere " << radius << " " << slices << " " << stacks;
+    addCachedLevel(*g, desc.str(), k ? getSphereError(radius, slices, stacks) : 0,
+                   [=](vector<VertexPNX>& vtx, vector<unsigned int>& idx, double&) {
+      int ibLen, vbLen;
+      if (g_useStrips) {
+        // the strips already walk the grid in cache-friendly order
+        getSphereStripVbIbLen(slices, stacks, vbLen, ibLen);
+        vtx.resize(vbLen);
+        idx.resize(ibLen);
+        makeSphereStrip(radius, slices, stacks, &vtx[0], &idx[0]);
+      }
+      else {
+        getSphereVbIbLen(slices, stacks, vbLen, ibLen);
+        vtx.resize(vbLen);
+        idx.resize(ibLen);
+        makeSphereParallel(radius, slices, stacks, &vtx[0], &idx[0]);
+        optimizeMesh(("sphere lod " + to_string(k)).c_str(), vtx, idx);
+      }
+    });
+    slices = max(3, slices / 2);
+    stacks = max(2, stacks / 2);
+  }
+  return g;
+}
 
-  getTubeVbIbLen(36, vbLen, ibLen);
-  vtx.resize(vbLen);
-  idx.resize(ibLen);
-  makeTube(1, 4, 36, vtx.begin(), idx.begin());
-  g_tube.reset(new Geometry(&vtx[0], &idx[0], vbLen, ibLen));
-  
+// Builds the icosphere's LOD chain, starting at the given subdivision level
+static shared_ptr<Geometry> makeIcosphereGeometry(float radius, int subdivisions) {
+  shared_ptr<Geometry> g(new Geometry());
+  g->convex = true;
+  for (int k = 0; k < g_numLods && subdivisions >= 0; ++k, --subdivisions) {
+    ostringstream desc;
+    desc << "icosphere " << radius << " " << subdivisions;
+    addCachedLevel(*g, desc.str(), k ? getIcosphereError(radius, subdivisions) : 0,
+                   [=](vector<VertexPNX>& vtx, vector<unsigned int>& idx, double&) {
+      int ibLen, vbLen;
+      getIcosphereVbIbLen(subdivisions, vbLen, ibLen);
+      vtx.resize(vbLen);
+      idx.resize(ibLen);
+      makeIcosphere(radius, subdivisions, vtx.begin(), idx.begin());
+      optimizeMesh(("icosphere lod " + to_string(k)).c_str(), vtx, idx);
+    });
+  }
+  return g;
+}
+
+// Builds the tube's LOD chain, starting at the given number of slices
+static shared_ptr<Geometry> makeTubeGeometry(float radius, float height, int slices) {
+  shared_ptr<Geometry> g(new Geometry(g_useStrips ? GL_TRIANGLE_STRIP : GL_TRIANGLES));
+  for (int k = 0; k < g_numLods; ++k) {
+    ostringstream desc;
+    desc << "tube " << radius << " " << height << " " << slices;
+    addCachedLevel(*g, desc.str(), k ? getTubeError(radius, slices) : 0,
+                   [=](vector<VertexPNX>& vtx, vector<unsigned int>& idx, double&) {
+      int ibLen, vbLen;
+      if (g_useStrips) {
+        getTubeStripVbIbLen(slices, vbLen, ibLen);
+        vtx.resize(vbLen);
+        idx.resize(ibLen);
+        makeTubeStrip(radius, height, slices, &vtx[0], &idx[0]);
+      }
+      else {
+        getTubeVbIbLen(slices, vbLen, ibLen);
+        vtx.resize(vbLen);
+        idx.resize(ibLen);
+        makeTubeParallel(radius, height, slices, &vtx[0], &idx[0]);
+        optimizeMesh(("tube lod " + to_string(k)).c_str(), vtx, idx);
+      }
+    });
+    slices = max(3, slices / 2);
+  }
+  return g;
+}
+
+// OBJ or PLY file named on the command line, shown in place of the sphere
+static string g_importFile;
+
+// Loads filename scaled and centered to fit the unit sphere, with g_numLods
+// levels of detail that each keep about half the triangles of the one before,
+// made by simplifyMesh since files cannot be regenerated at a lower
+// resolution. The cache keys include the file's size and modification time,
+// so editing the file reimports it.
+static shared_ptr<Geometry> makeImportedGeometry(const string& filename) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0)
+    throw runtime_error("cannot open " + filename);
+
+  // the file is only read if some level is not in the cache
+  vector<VertexPNX> fullVtx;
+  vector<unsigned int> fullIdx;
+  vector<Cvec3f> fullPos;
+  auto load = [&]() {
+    if (!fullIdx.empty())
+      return;
+    ImportedMesh mesh;
+    importMesh(filename.c_str(), mesh);
+    if (mesh.indices.empty())
+      throw runtime_error("no triangles in " + filename);
+    getImportedVertices(mesh, fullVtx);
+    fullIdx.swap(mesh.indices);
+
+    Cvec3f lo = fullVtx[0].p, hi = fullVtx[0].p;
+    for (size_t i = 1; i < fullVtx.size(); ++i) {
+      for (int j = 0; j < 3; ++j) {
+        lo[j] = min(lo[j], fullVtx[i].p[j]);
+        hi[j] = max(hi[j], fullVtx[i].p[j]);
+      }
+    }
+    const Cvec3f center = (lo + hi) * 0.5f;
+    float r = 0;
+    for (size_t i = 0; i < fullVtx.size(); ++i) {
+      r = max(r, norm(fullVtx[i].p - center));
+    }
+    fullPos.resize(fullVtx.size());
+    for (size_t i = 0; i < fullVtx.size(); ++i) {
+      fullPos[i] = fullVtx[i].p = (fullVtx[i].p - center) * (r > 0 ? 1 / r : 1);
+    }
+  };
+
+  shared_ptr<Geometry> g(new Geometry());
+  for (int k = 0; k < g_numLods; ++k) {
+    ostringstream desc;
+    desc << "import " << filename << " " << st.st_size << " " << st.st_mtime << " lod " << k;
+    addCachedLevel(*g, desc.str(), 0, [&](vector<VertexPNX>& vtx, vector<unsigned int>& idx, double& error) {
+      load();
+      vtx = fullVtx;
+      if (k == 0)
+        idx = fullIdx;
+      else {
+        error = simplifyMesh(&fullPos[0], fullPos.size(), &fullIdx[0], fullIdx.size(), fullIdx.size() >> k,
+                             numeric_limits<double>::infinity(), idx);
+      }
+      // a coarser level may not claim to be closer than a finer one
+      if (!g->levels.empty())
+        error = max(error, g->levels.back().error);
+      // keep only the vertices this level uses, even when meshes are not
+      // optimized, or every level would upload the full mesh's
+      vtx.resize(optimizeVertexFetch(&vtx[0], vtx.size(), &idx[0], idx.size()));
+      optimizeMesh((filename + " lod " + to_string(k)).c_str(), vtx, idx);
+    });
+  }
+  return g;
+}
+
+static void initObjects() {
+  // each kind of geometry needs to be initialized here
+  if (g_useMeshCache && !makeMeshCacheDir(g_meshCacheDir)) {
+    cerr << "WARN: cannot create " << g_meshCacheDir << ", meshes will not be cached" << endl;
+    g_useMeshCache = false;
+  }
+
+  g_cube.reset(new Geometry());
+  g_cube->convex = true;
+  addCachedLevel(*g_cube, "cube 2", 0, [](vector<VertexPNX>& vtx, vector<unsigned int>& idx, double&) {
+    int ibLen, vbLen;
+    getCubeVbIbLen(vbLen, ibLen);
+    vtx.resize(vbLen);
+    idx.resize(ibLen);
+    makeCube(2, vtx.begin(), idx.begin());
+    optimizeMesh("cube", vtx, idx);
+  });
+
+  if (!g_importFile.empty())
+    g_sphere = makeImportedGeometry(g_importFile);
+  else if (g_useIcosphere) {
+    // the coarsest icosphere at least as close to the sphere as a 30 x 20 UV sphere
+    int subdivisions = 0;
+    while (getIcosphereError(1.0, subdivisions) > getSphereError(1.0, 30, 20))
+      ++subdivisions;
+    g_sphere = makeIcosphereGeometry(1.0, subdivisions);
+  }
+  else
+    g_sphere = makeSphereGeometry(1.0, 30, 20);
+
+  g_octa.reset(new Geometry());
+  g_octa->convex = true;
+  addCachedLevel(*g_octa, "octahedron 2", 0, [](vector<VertexPNX>& vtx, vector<unsigned int>& idx, double&) {
+    int ibLen, vbLen;
+    getOctahedronVbIbLen(vbLen, ibLen);
+    vtx.resize(vbLen);
+    idx.resize(ibLen);
+    makeOctahedron(2, vtx.begin(), idx.begin());
+    optimizeMesh("octahedron", vtx, idx);
+  });
+
+  g_tube = makeTubeGeometry(1, 4, 36);
 }
 
 // takes a projection matrix and send to the the shaders
-static void sendProjectionMatrix(const ShaderState& SS, const Matrix4& projMatrix) {
+static void sendProjectionMatrix(const ShaderState& SS, const Matrix4f& projMatrix) {
   GLfloat glmatrix[16];
   projMatrix.writeToColumnMajorMatrix(glmatrix); // send projection matrix
   safe_glUniformMatrix4fv(SS.h_uProjMatrix, glmatrix);
 }
 
-// takes MVM and its normal matrix to the shaders
-static void sendModelViewNormalMatrix(const ShaderState& SS, const Matrix4& MVM, const Matrix4& NMVM) {
-  GLfloat glmatrix[16];
-  MVM.writeToColumnMajorMatrix(glmatrix); // send MVM
-  safe_glUniformMatrix4fv(SS.h_uModelViewMatrix, glmatrix);
+// takes MVM and its normal matrix, already in column-major order, to the shaders
+static void sendModelViewNormalMatrix(const ShaderState& SS, const GLfloat MVM[], const GLfloat NMVM[]) {
+  safe_glUniformMatrix4fv(SS.h_uModelViewMatrix, MVM); // send MVM
+  safe_glUniformMatrix4fv(SS.h_uNormalMatrix, NMVM); // send NMVM
+}
 
-  NMVM.writeToColumnMajorMatrix(glmatrix); // send NMVM
-  safe_glUniformMatrix4fv(SS.h_uNormalMatrix, glmatrix);
+// The geometry object i of the scene is drawn with
+static Geometry *objectGeometry(const int i) {
+  Geometry* const geometries[g_numObjects] = {g_tube.get(), g_sphere.get(), g_octa.get()};
+  return geometries[i % g_numObjects];
+}
+
+// The world space bounding box of object i of the scene
+static BoundingBox objectBox(const int i) {
+  const Geometry& g = *objectGeometry(i);
+  return transformBox(g_objectModels[i], g.boxMin, g.boxMax);
+}
+
+// Lays out g_crowdSizes[g_crowdSize] objects on a square grid, and builds
+// g_sceneBvh over them and the chasing objects
+static void makeCrowd() {
+  const int n = g_crowdSizes[g_crowdSize];
+  const int side = int(ceil(sqrt(double(n))));
+  const double spacing = 3;
+  g_objectModels.resize(g_numObjects + n);
+  g_objectColors.resize(g_numObjects + n);
+  for (int i = 0; i < n; ++i) {
+    const int row = i / side, col = i % side;
+    const Cvec3 t((col - 0.5 * (side - 1)) * spacing, 0, -spacing * (row + 2));
+    Matrix4& m = g_objectModels[g_numObjects + i];
+    m = Matrix4::makeTranslation(t);
+    if (i % g_numObjects == 2)
+      m *= Matrix4::makeScale(Cvec3(g_octaScale));
+    const float u = side > 1 ? float(col) / (side - 1) : 0, v = side > 1 ? float(row) / (side - 1) : 0;
+    g_objectColors[g_numObjects + i] = Cvec3f(0.2 + 0.8 * u, 0.6, 0.2 + 0.8 * v);
+  }
+  g_objectLod.resize(g_numObjects + n, 0);
+
+  vector<BoundingBox> boxes(g_numObjects + n);
+  for (int i = 0; i < g_numObjects + n; ++i) {
+    boxes[i] = objectBox(i);
+  }
+  g_sceneBvh.build(&boxes[0], boxes.size());
 }
 
 // update g_frustFovY from g_frustMinFov, g_windowWidth, and g_windowHeight
@@ -285,85 +1295,401 @@ static Matrix4 makeProjectionMatrix() {
            g_frustNear, g_frustFar);
 }
 
-static void drawScene() {
-  const Matrix4 projmat = makeProjectionMatrix(); // build projection matrix
-  const Matrix4 invEyeRbt = inv(g_eyeRbt); // store inverse so we don't have to recompute it
-  const Cvec3 eyeLight1 = Cvec3(invEyeRbt * Cvec4(g_light1, 1)); // g_light1 position in eye coordinates
-  const Cvec3 eyeLight2 = Cvec3(invEyeRbt * Cvec4(g_light2, 1)); // g_light2 position in eye coordinates
+// Picks the coarsest level of g whose error, at the distance of the nearest
+// point of its bounding sphere, projects to at most g_lodPixelError pixels.
+// MVM is column major; current is the level used in the previous frame.
+static int selectLod(const Geometry& g, const GLfloat MVM[], const Matrix4& projMatrix, const int current) {
+  // scale of the MVM, from the length of its first column
+  const double scale = sqrt(MVM[0] * MVM[0] + MVM[1] * MVM[1] + MVM[2] * MVM[2]);
+  const double dist = -MVM[14] - g.radius * scale;
+  if (dist <= -g_frustNear)
+    return 0; // reaches the near plane
+
+  const double pixelsPerUnit = projMatrix(1,1) * 0.5 * g_windowHeight / dist;
+  int level = 0;
+  for (int k = 1; k < g.numLevels(); ++k) {
+    const double maxPixels = k > current ? g_lodPixelError / g_lodHysteresis : g_lodPixelError;
+    if (g.levels[k].error * scale * pixelsPerUnit <= maxPixels)
+      level = k;
+  }
+  return level;
+}
 
-  // g_animIncrement is a small amount that is scaled to the framerate; the
-  // following matrix will rotate through a small angle so that a total of 
-  // 360 degrees is covered for every cycle of the clock parameter g_animClock
-  // from 0 to 1.
-  const Matrix4 rotatorY = Matrix4::makeYRotation(g_animIncrement*360); // rotate 360 per parameter cycle 0..1
-  const Matrix4 rotatorX = Matrix4::makeXRotation(g_animIncrement*360);
-  const Matrix4 rotatorZ = Matrix4::makeZRotation(g_animIncrement*360);
+// What drawRenderQueue needs besides the queue. Per-object arrays are
+// indexed by the objects of the RenderItems, and the geometry of a render key
+// indexes geometries.
+struct RenderFrame {
+  Matrix4f projMatrix;
+  Cvec3 eyeLight1, eyeLight2;
+  Geometry* const *geometries;
+  const GLfloat *MVMs, *NMVMs; // 16 floats per object each
+  const Cvec3f *colors;
+};
 
-  const ShaderState& curSS = *g_shaderStates[g_activeShader]; // alias for currently selected shader
+// The program of the shader numbers in render keys: the g_shaderStates, then
+// the g_instancedShaderStates, then the g_indirectShaderStates
+static const ShaderState& renderShader(const int shader) {
+  if (shader < g_numShaders)
+    return *g_shaderStates[shader];
+  if (shader < 2 * g_numShaders)
+    return *g_instancedShaderStates[shader - g_numShaders];
+  return *g_indirectShaderStates[shader - 2 * g_numShaders];
+}
 
-  glUseProgram(curSS.program); // select shader we want to use
-  sendProjectionMatrix(curSS, projmat); // send projection matrix to shader
-  safe_glUniform3f(curSS.h_uLight, eyeLight1[0], eyeLight1[1], eyeLight1[2]); // shaders need light positions
-  safe_glUniform3f(curSS.h_uLight2, eyeLight2[0], eyeLight2[1], eyeLight2[2]);
+// Writes the frame's FrameUniforms into the current region of ring
+static GLintptr writeFrameUniforms(GlRingBuffer& ring, const RenderFrame& frame) {
+  // the mapping may be write-combined, so fill structs here and copy them
+  FrameUniforms f;
+  memset(&f, 0, sizeof(f));
+  frame.projMatrix.writeToColumnMajorMatrix(f.projMatrix);
+  for (int k = 0; k < 3; ++k) {
+    f.light[k] = frame.eyeLight1[k];
+    f.light2[k] = frame.eyeLight2[k];
+  }
+  GLintptr offset;
+  memcpy(ring.allocate(sizeof(f), offset), &f, sizeof(f));
+  return offset;
+}
 
-  g_objectRbt[0] = g_objectRbt[0] * rotatorZ * rotatorX; // object 0 rotates around its x-axis
+// Draws a sorted queue run by run, a run being the items with the same
+// program, geometry and level. Instanced programs draw a whole run at once.
+// Program and VAO changes go through g_glState, which skips the repeats.
+static void drawRenderQueue(const RenderQueue& queue, const RenderFrame& frame) {
+  // With uniform blocks, the frame's uniforms and those of every draw that
+  // is not instanced are written first, since without persistent mapping
+  // the ring is only mapped while it is written
+  GLintptr objectOffset = 0;
+  GLsizeiptr objectStride = 0;
+  if (g_useUniformBuffers) {
+    GlRingBuffer& ring = *g_uniformRing;
+    objectStride = ring.alignUp(sizeof(ObjectUniforms));
+    int numObjectDraws = 0;
+    for (int i = 0; i < queue.size(); ++i) {
+      numObjectDraws += renderShader(renderKeyShader(queue[i].key)).kind == ShaderState::SHADER_BLOCKS;
+    }
+    ring.beginFrame(ring.alignUp(sizeof(FrameUniforms)) + objectStride * numObjectDraws);
+    const GLintptr frameOffset = writeFrameUniforms(ring, frame);
+
+    if (numObjectDraws > 0) {
+      char *p = static_cast<char *>(ring.allocate(objectStride * numObjectDraws, objectOffset));
+      ObjectUniforms u;
+      memset(&u, 0, sizeof(u));
+      for (int i = 0; i < queue.size(); ++i) {
+        if (renderShader(renderKeyShader(queue[i].key)).kind != ShaderState::SHADER_BLOCKS)
+          continue;
+        const int o = queue[i].object;
+        memcpy(u.modelView, frame.MVMs + 16 * o, sizeof(u.modelView));
+        memcpy(u.normalMatrix, frame.NMVMs + 16 * o, sizeof(u.normalMatrix));
+        for (int k = 0; k < 3; ++k) {
+          u.color[k] = frame.colors[o][k];
+        }
+        memcpy(p, &u, sizeof(u));
+        p += objectStride;
+      }
+    }
+    ring.endWrites();
+    glBindBufferRange(GL_UNIFORM_BUFFER, g_frameUniformBinding, ring, frameOffset, sizeof(FrameUniforms));
+  }
 
-  Matrix4 MVM = invEyeRbt * g_objectRbt[0];
-  Matrix4 NMVM = normalMatrix(MVM);
-  sendModelViewNormalMatrix(curSS, MVM, NMVM);
-  safe_glUniform3f(curSS.h_uColor, 1.0-g_animClock, 0.0, g_animClock); // use clock parameter to color object
+  static vector<InstanceData> instances;
+  int lastShader = -1;
+  for (int begin = 0, end; begin < queue.size(); begin = end) {
+    const uint64_t key = queue[begin].key;
+    for (end = begin + 1; end < queue.size() && sameRenderState(queue[end].key, key); ++end) {}
+
+    const int shader = renderKeyShader(key), level = renderKeyLevel(key);
+    const ShaderState& curSS = renderShader(shader);
+    Geometry& g = *frame.geometries[renderKeyGeometry(key)];
+    g_glState.useProgram(curSS.program);
+    if (shader != lastShader && !g_useUniformBuffers) {
+      // a program keeps its uniforms, but the frame's are new
+      sendProjectionMatrix(curSS, frame.projMatrix);
+      safe_glUniform3f(curSS.h_uLight, frame.eyeLight1[0], frame.eyeLight1[1], frame.eyeLight1[2]);
+      safe_glUniform3f(curSS.h_uLight2, frame.eyeLight2[0], frame.eyeLight2[1], frame.eyeLight2[2]);
+    }
+    lastShader = shader;
+
+    g.bindLevel(curSS, level);
+    if (curSS.kind == ShaderState::SHADER_INSTANCED) {
+      instances.clear();
+      for (int i = begin; i < end; ++i) {
+        const int o = queue[i].object;
+        instances.push_back(InstanceData(frame.MVMs + 16 * o, frame.NMVMs + 16 * o, frame.colors[o]));
+      }
+      g.drawInstanced(curSS, &instances[0], instances.size(), level);
+    }
+    else {
+      for (int i = begin; i < end; ++i) {
+        const int o = queue[i].object;
+        if (g_useUniformBuffers) {
+          glBindBufferRange(GL_UNIFORM_BUFFER, g_objectUniformBinding, *g_uniformRing, objectOffset, sizeof(ObjectUniforms));
+          objectOffset += objectStride;
+        }
+        else {
+          sendModelViewNormalMatrix(curSS, frame.MVMs + 16 * o, frame.NMVMs + 16 * o);
+          safe_glUniform3f(curSS.h_uColor, frame.colors[o][0], frame.colors[o][1], frame.colors[o][2]);
+        }
+        g.draw(curSS, level);
+      }
+    }
+    g.unbindLevel();
+  }
 
-  g_tube->draw(curSS);
-  						     // color will cycle once as g_animClock goes from 0 to 1
+  if (g_useVertexArrays) {
+    // so later buffer uploads do not change the last VAO
+    g_glState.bindVertexArray(0);
+  }
+  if (g_useUniformBuffers)
+    g_uniformRing->endFrame();
+  g_glState.stats.items += queue.size();
+}
 
-  g_objectRbt[1] = g_objectRbt[0] * rotatorY * inv(g_objectRbt[0]) * g_objectRbt[1]; // object 0 rotates around its y-axis
+// Draws a sorted queue with one glMultiDrawElementsIndirect per program and
+// primitive type. Each run of items with the same geometry and level becomes
+// one command per chunk, drawing an instance per item, and its baseInstance
+// is the run's first item: ObjectStorage holds the objects in queue order, so
+// aObjectIndex finds each instance's data.
+static void drawRenderQueueIndirect(const RenderQueue& queue, const RenderFrame& frame) {
+  struct CommandGroup {
+    int shader;
+    GLenum primitive;
+    int first, count; // in commands
+  };
+  static vector<DrawElementsIndirectCommand> commands;
+  static vector<CommandGroup> groups;
+  commands.clear();
+  groups.clear();
+
+  const int n = queue.size();
+  assert(n <= g_objectIndexCount);
+  for (int shaderBegin = 0, shaderEnd; shaderBegin < n; shaderBegin = shaderEnd) {
+    const int shader = renderKeyShader(queue[shaderBegin].key);
+    for (shaderEnd = shaderBegin + 1; shaderEnd < n && int(renderKeyShader(queue[shaderEnd].key)) == shader; ++shaderEnd) {}
+
+    for (int strips = 0; strips < 2; ++strips) {
+      CommandGroup group = {shader, GLenum(strips ? GL_TRIANGLE_STRIP : GL_TRIANGLES), int(commands.size()), 0};
+      for (int begin = shaderBegin, end; begin < shaderEnd; begin = end) {
+        const uint64_t key = queue[begin].key;
+        for (end = begin + 1; end < shaderEnd && sameRenderState(queue[end].key, key); ++end) {}
+
+        const Geometry& g = *frame.geometries[renderKeyGeometry(key)];
+        if (g.primitive != group.primitive)
+          continue;
+        const Geometry::Level& l = g.levels[renderKeyLevel(key)];
+        for (size_t i = 0; i < l.chunks.size(); ++i) {
+          const Geometry::Chunk& c = l.chunks[i];
+          const DrawElementsIndirectCommand cmd = {GLuint(c.iboLen), GLuint(end - begin), GLuint(c.firstIndex()),
+                                                   c.baseVertex(), GLuint(begin)};
+          commands.push_back(cmd);
+        }
+      }
+      group.count = commands.size() - group.first;
+      if (group.count > 0)
+        groups.push_back(group);
+    }
+  }
+
+  GlRingBuffer& ring = *g_uniformRing;
+  ring.beginFrame(ring.alignUp(sizeof(FrameUniforms)) + ring.alignUp(sizeof(ObjectStorageData) * n)
+                  + sizeof(DrawElementsIndirectCommand) * commands.size());
+  const GLintptr frameOffset = writeFrameUniforms(ring, frame);
+  GLintptr objectOffset = 0, commandOffset = 0;
+  if (n > 0) {
+    char *p = static_cast<char *>(ring.allocate(sizeof(ObjectStorageData) * n, objectOffset));
+    ObjectStorageData d;
+    memset(&d, 0, sizeof(d));
+    for (int i = 0; i < n; ++i) {
+      const int o = queue[i].object;
+      const PositionQuantization& q = frame.geometries[renderKeyGeometry(queue[i].key)]->levels[renderKeyLevel(queue[i].key)].posQuant;
+      memcpy(d.modelView, frame.MVMs + 16 * o, sizeof(d.modelView));
+      memcpy(d.normalMatrix, frame.NMVMs + 16 * o, sizeof(d.normalMatrix));
+      for (int k = 0; k < 3; ++k) {
+        d.color[k] = frame.colors[o][k];
+        d.posScale[k] = q.scale[k];
+        d.posBias[k] = q.bias[k];
+      }
+      memcpy(p, &d, sizeof(d));
+      p += sizeof(d);
+    }
+    memcpy(ring.allocate(sizeof(DrawElementsIndirectCommand) * commands.size(), commandOffset),
+           &commands[0], sizeof(DrawElementsIndirectCommand) * commands.size());
+  }
+  ring.endWrites();
+
+  glBindBufferRange(GL_UNIFORM_BUFFER, g_frameUniformBinding, ring, frameOffset, sizeof(FrameUniforms));
+  if (n > 0)
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, g_objectStorageBinding, ring, objectOffset, sizeof(ObjectStorageData) * n);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ring);
+  const GLenum indexType = g_geometryPool->indexType();
+  for (size_t i = 0; i < groups.size(); ++i) {
+    const CommandGroup& group = groups[i];
+    const ShaderState& curSS = renderShader(group.shader);
+    g_glState.useProgram(curSS.program);
+    g_glState.bindVertexArray(Geometry::poolVertexArray(curSS));
+    if (group.primitive == GL_TRIANGLE_STRIP) {
+      glEnable(GL_PRIMITIVE_RESTART);
+      glPrimitiveRestartIndex(indexType == GL_UNSIGNED_INT ? 0xFFFFFFFFu : 0xFFFFu);
+    }
+    glMultiDrawElementsIndirect(group.primitive, indexType,
+                                (const GLvoid *)(commandOffset + group.first * sizeof(DrawElementsIndirectCommand)),
+                                group.count, 0);
+    ++g_glState.stats.draws;
+    if (group.primitive == GL_TRIANGLE_STRIP)
+      glDisable(GL_PRIMITIVE_RESTART);
+  }
 
+  g_glState.bindVertexArray(0);
+  ring.endFrame();
+  g_glState.stats.items += n;
+}
 
-  MVM = invEyeRbt * g_objectRbt[1];
-  NMVM = normalMatrix(MVM);
-  sendModelViewNormalMatrix(curSS, MVM, NMVM);
-  safe_glUniform3f(curSS.h_uColor, 1.0-g_animClock, 0.0, g_animClock); // use clock parameter to color object
+// Draws the objects of visible that look biggest from eye into
+// g_occlusionBuffer, and drops the others that are behind them
+static void cullOccluded(const Matrix4& viewProj, const Cvec3& eye, vector<int>& visible) {
+  const int n = visible.size();
+  static vector<BoundingBox> boxes;
+  static vector<pair<double, int> > sizes; // bounding radius over distance, and place in visible
+  boxes.resize(n);
+  sizes.clear();
+  for (int i = 0; i < n; ++i) {
+    boxes[i] = objectBox(visible[i]);
+    if (objectGeometry(visible[i])->occluderIndices.empty())
+      continue;
+    const Cvec3 center(boxes[i].center[0], boxes[i].center[1], boxes[i].center[2]);
+    sizes.push_back(make_pair(norm(boxes[i].extent) / max(norm(center - eye), CS150_EPS), i));
+  }
+  const int numOccluders = min(g_numOccluders, int(sizes.size()));
+  partial_sort(sizes.begin(), sizes.begin() + numOccluders, sizes.end(), greater<pair<double, int> >());
+
+  static vector<char> isOccluder;
+  isOccluder.assign(n, 0);
+  g_occlusionBuffer.clear();
+  for (int k = 0; k < numOccluders; ++k) {
+    const int i = sizes[k].second;
+    const Geometry& g = *objectGeometry(visible[i]);
+    g_occlusionBuffer.addOccluder(viewProj * g_objectModels[visible[i]], &g.occluderVertices[0], g.occluderVertices.size(),
+                                  &g.occluderIndices[0], g.occluderIndices.size());
+    isOccluder[i] = 1;
+  }
+  g_occlusionBuffer.rasterize();
 
+  int kept = 0;
+  for (int i = 0; i < n; ++i) {
+    if (isOccluder[i] || g_occlusionBuffer.isVisible(viewProj, boxes[i]))
+      visible[kept++] = visible[i];
+  }
+  visible.resize(kept);
+  g_glState.stats.occluded += n - kept;
+}
 
-  g_sphere->draw(curSS);
+static void drawScene() {
+  const Matrix4 projMatrix = makeProjectionMatrix(); // build projection matrix
+  const Matrix4f projmat(projMatrix);
+  const RigTForm invEyeRbt = inv(g_eyeRbt); // store inverse so we don't have to recompute it
+  const Cvec3 eyeLight1 = Cvec3(invEyeRbt * Cvec4(g_light1, 1)); // g_light1 position in eye coordinates
+  const Cvec3 eyeLight2 = Cvec3(invEyeRbt * Cvec4(g_light2, 1)); // g_light2 position in eye coordinates
 
-  Cvec3 sphereCoords = Cvec3(g_objectRbt[1](0, 3), g_objectRbt[1](1, 3), g_objectRbt[1](2, 3));
-  Cvec3 octaCoords = Cvec3(g_objectRbt[2](0, 3), g_objectRbt[2](1, 3), g_objectRbt[2](2, 3));
+  // g_animIncrement is a small amount that is scaled to the framerate; the
+  // following transform will rotate through a small angle so that a total of 
+  // 360 degrees is covered for every cycle of the clock parameter g_animClock
+  // from 0 to 1.
+  const RigTForm rotatorY = RigTForm(Quat::makeYRotation(g_animIncrement*360)); // rotate 360 per parameter cycle 0..1
+  const RigTForm rotatorX = RigTForm(Quat::makeXRotation(g_animIncrement*360));
+  const RigTForm rotatorZ = RigTForm(Quat::makeZRotation(g_animIncrement*360));
 
-  Cvec3 toSphere = sphereCoords - octaCoords;
+  g_objectRbt[0] = normalize(g_objectRbt[0] * rotatorZ * rotatorX); // object 0 rotates around its x-axis
 
-  Matrix4 newMatrix = Matrix4();
-  newMatrix(0, 3) = toSphere[0];
-  newMatrix(1, 3) = toSphere[1];
-  newMatrix(2, 3) = toSphere[2];
-  newMatrix(3, 3) = 1;
-  
-  Matrix4 translation = g_objectRbt[2].makeTranslation(toSphere);
+  g_objectRbt[1] = normalize(g_objectRbt[0] * rotatorY * inv(g_objectRbt[0]) * g_objectRbt[1]); // object 0 rotates around its y-axis
 
-  Matrix4 scale = Matrix4(1);
+  Cvec3 sphereCoords = g_objectRbt[1].getTranslation();
+  Cvec3 octaCoords = g_objectRbt[2].getTranslation();
 
-  Matrix4 scaledMatrix = Matrix4(g_objectRbt[2]);
-  scaledMatrix(0, 3) *= 0.25;
-  scaledMatrix(1, 3) *= 0.25;
-  scaledMatrix(2, 3) *= 0.25;
+  Cvec3 toSphere = sphereCoords - octaCoords;
 
+  // The octahedron should move towards the sphere. Its scale used to be
+  // folded into the RBT, which scaled the translation along with it.
+  g_objectRbt[2] = transFact(transFact(g_objectRbt[2]) * RigTForm(toSphere) * inv(g_objectRbt[1]));
+  g_objectRbt[2].setTranslation(g_objectRbt[2].getTranslation() * g_octaScale);
 
+  for (int i = 0; i < g_numObjects; ++i) {
+    g_objectModels[i] = rigTFormToMatrix(g_objectRbt[i]);
+  }
+  g_objectModels[2] *= Matrix4::makeScale(Cvec3(g_octaScale));
+  for (int i = 0; i < g_numObjects; ++i) {
+    g_sceneBvh.update(i, objectBox(i));
+    g_objectColors[i] = Cvec3f(1.0-g_animClock, 0.0, g_animClock); // use clock parameter to color object
+  }
 
-  g_objectRbt[2] = g_objectRbt[2].makeScale(Cvec3(0.4, 0.4, 0.4)) * transFact(transFact(g_objectRbt[2]) * newMatrix * inv(g_objectRbt[1])); // The octahedron should move towards the sphere
+  // the objects to draw, and from here on a drawn object's number is its
+  // place in this list
+  const Matrix4 invEyeMatrix = rigTFormToMatrix(invEyeRbt);
+  const Matrix4 viewProj = projMatrix * invEyeMatrix;
+  static vector<int> visible;
+  if (g_useFrustumCulling)
+    g_sceneBvh.cull(Frustum(viewProj), visible);
+  else {
+    visible.resize(g_objectModels.size());
+    for (int i = 0; i < int(visible.size()); ++i) {
+      visible[i] = i;
+    }
+  }
+  g_glState.stats.culled += g_objectModels.size() - visible.size();
+  if (g_useOcclusionCulling)
+    cullOccluded(viewProj, g_eyeRbt.getTranslation(), visible);
+  const int numDrawn = visible.size();
+
+  // Build every MVM and normal matrix in one pass, then draw. A big crowd is
+  // worth spreading across threads.
+  static vector<GLfloat> MVMs, NMVMs;
+  static vector<Cvec3f> colors;
+  MVMs.resize(16 * max(numDrawn, 1));
+  NMVMs.resize(16 * max(numDrawn, 1));
+  colors.resize(max(numDrawn, 1));
+  if (numDrawn > 0)
+    computeModelViewNormalMatrices(invEyeMatrix, &g_objectModels[0], numDrawn, &MVMs[0], &NMVMs[0], 0, 0, &visible[0]);
+  for (int i = 0; i < numDrawn; ++i) {
+    colors[i] = g_objectColors[visible[i]];
+  }
 
-  MVM = invEyeRbt * g_objectRbt[2];
-  NMVM = normalMatrix(MVM);
-  sendModelViewNormalMatrix(curSS, MVM, NMVM);
-  safe_glUniform3f(curSS.h_uColor, 1.0-g_animClock, 0.0, g_animClock); // use clock parameter to color object
+  // queue every object, with its level of detail and depth, and draw them in
+  // state order
+  Geometry* const geometries[g_numObjects] = {objectGeometry(0), objectGeometry(1), objectGeometry(2)};
+  const int shader = g_useMultiDrawIndirect ? 2 * g_numShaders + g_activeShader
+                     : g_useInstancing ? g_numShaders + g_activeShader : g_activeShader;
+  g_renderQueue.clear();
+  for (int i = 0; i < numDrawn; ++i) {
+    const int o = visible[i], g = o % g_numObjects;
+    g_objectLod[o] = selectLod(*geometries[g], &MVMs[16 * i], projMatrix, g_objectLod[o]);
+    g_renderQueue.push(makeRenderKey(shader, g, g_objectLod[o], -MVMs[16 * i + 14]), i);
+  }
+  g_renderQueue.sort();
 
-  g_octa->draw(curSS);
+  const RenderFrame frame = {projmat, eyeLight1, eyeLight2, geometries, &MVMs[0], &NMVMs[0], &colors[0]};
+  if (g_useMultiDrawIndirect)
+    drawRenderQueueIndirect(g_renderQueue, frame);
+  else
+    drawRenderQueue(g_renderQueue, frame);
 
   // TODO: Remove cube. Add octahedron, tube, and sphere to scene and make them chase each other.
 }
 
+// Occupancy and fragmentation of the two buffers of g_geometryPool
+static void printGeometryPoolStats() {
+  const GlBufferArena *arenas[2] = {&g_geometryPool->vertexArena(), &g_geometryPool->indexArena()};
+  for (int i = 0; i < 2; ++i) {
+    const BufferArenaStats st = arenas[i]->stats();
+    cout << (i ? "Index" : "Vertex") << " pool: " << st.used << " of " << st.capacity << " used ("
+         << int(100 * st.occupancy()) << "%) by " << st.ranges << " ranges, " << st.holes << " holes, "
+         << int(100 * st.fragmentation()) << "% fragmented" << endl;
+  }
+}
+
 static void display() {
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);   // clear framebuffer color&depth
+  if (g_useGeometryPool)
+    g_geometryPool->compact(g_geometryCompactBytes);
   drawScene();
+  g_lastFrameStats = g_glState.endFrame();
   glutSwapBuffers();                                    // show the back buffer (where we rendered stuff)
   checkGlErrors();
 
@@ -386,6 +1712,12 @@ static void display() {
                 cout << "Frames per second: "
                         << float(frames)*1000.0/(currentTime - oldTime) << endl;
                 cout << "Elapsed ms since last frame: " << g_elapsedTime << endl;
+                const RenderStats& st = g_lastFrameStats;
+                cout << "Last frame: " << st.items << " objects (" << st.culled << " culled, " << st.occluded << " occluded), " << st.draws << " draw calls, "
+                     << st.programs << " of " << st.programRequests << " program changes, "
+                     << st.vertexArrays << " of " << st.vertexArrayRequests << " VAO binds" << endl;
+                if (g_useGeometryPool)
+                  printGeometryPoolStats();
                 oldTime = currentTime;
                 frames = 0;
         }
@@ -403,20 +1735,20 @@ static void motion(const int x, const int y) {
   const double dx = x - g_mouseClickX;
   const double dy = g_windowHeight - y - 1 - g_mouseClickY;
 
-  Matrix4 m, a;
+  RigTForm m, a;
   if (g_mouseLClickButton && !g_mouseRClickButton) { // left button down?
-    m = Matrix4::makeXRotation(-dy) * Matrix4::makeYRotation(dx);
+    m = RigTForm(Quat::makeXRotation(-dy) * Quat::makeYRotation(dx));
   }
   else if (g_mouseRClickButton && !g_mouseLClickButton) { // right button down?
-    m = Matrix4::makeTranslation(Cvec3(dx, dy, 0) * 0.01);
+    m = RigTForm(Cvec3(dx, dy, 0) * 0.01);
   }
   else if (g_mouseMClickButton || (g_mouseLClickButton && g_mouseRClickButton)) {  // middle or (left and right) button down?
-    m = Matrix4::makeTranslation(Cvec3(0, 0, -dy) * 0.01);
+    m = RigTForm(Cvec3(0, 0, -dy) * 0.01);
   }
 
   if (g_mouseClickDown) {
 	  a =  transFact(g_objectRbt[g_objToManip])*linFact(g_eyeRbt);
-	  g_objectRbt[g_objToManip] = a * m * inv(a) * g_objectRbt[g_objToManip];
+	  g_objectRbt[g_objToManip] = normalize(a * m * inv(a) * g_objectRbt[g_objToManip]);
 	  glutPostRedisplay(); // we always redraw if we changed the scene
   }
 
@@ -460,6 +1792,8 @@ static void keyboard(const unsigned char key, const int x, const int y) {
     << "f\t\tCycle fragment shader\n"
     << "+\t\tIncrease animation speed\n"
     << "-\t\tDecrease animation speed\n"
+    << "c\t\tCycle crowd size\n"
+    << "r\t\tRebuild geometry\n"
     << "drag left mouse to rotate\n" 
     << "drag middle mouse to translate in/out \n" 
     << "drag right mouse to translate up/down/left/right\n" 
@@ -479,6 +1813,18 @@ static void keyboard(const unsigned char key, const int x, const int y) {
   case '-':
     g_animSpeed *= 0.95;
     break;
+  case 'c':
+    g_crowdSize = (g_crowdSize + 1) % g_numCrowdSizes;
+    makeCrowd();
+    cout << "Crowd of " << g_objectModels.size() - g_numObjects << " objects." << endl;
+    break;
+  case 'r':
+    // the old geometry leaves holes in g_geometryPool for display to close
+    initObjects();
+    cout << "Geometry rebuilt." << endl;
+    if (g_useGeometryPool)
+      printGeometryPoolStats();
+    break;
   case 'f':
     g_activeShader = (g_activeShader + 1) % g_numShaders;
     switch (g_activeShader) {
@@ -494,7 +1840,7 @@ static void keyboard(const unsigned char key, const int x, const int y) {
   glutPostRedisplay();
 }
 
-static void initGlutState(int argc, char * argv[]) {
+static void initGlutState(int& argc, char * argv[]) {
   glutInit(&argc, argv);                                  // initialize Glut based on cmd-line args
   glutInitDisplayMode(GLUT_RGBA|GLUT_DOUBLE|GLUT_DEPTH);  //  RGBA pixel channels and double buffering
   glutInitWindowSize(g_windowWidth, g_windowHeight);      // create a window
@@ -523,25 +1869,73 @@ static void initGLState() {
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   if (!g_Gl2Compatible)
     glEnable(GL_FRAMEBUFFER_SRGB);
+
+  if (g_useUniformBuffers) {
+    // both alignments are powers of two
+    GLint alignment, storageAlignment = 1;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (g_useMultiDrawIndirect)
+      glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+    g_uniformRing.reset(new GlRingBuffer(GL_UNIFORM_BUFFER, max(alignment, storageAlignment), g_persistentMapping));
+  }
 }
 
 static void initShaders() {
   g_shaderStates.resize(g_numShaders);
   for (int i = 0; i < g_numShaders; ++i) {
     if (g_Gl2Compatible)
-      g_shaderStates[i].reset(new ShaderState(g_shaderFilesGl2[i][0], g_shaderFilesGl2[i][1]));
+      g_shaderStates[i].reset(new ShaderState(g_compactVertices ? g_compactVertexShaderGl2 : g_shaderFilesGl2[i][0], g_shaderFilesGl2[i][1]));
+    else if (g_useUniformBuffers)
+      g_shaderStates[i].reset(new ShaderState(g_compactVertices ? g_compactUboVertexShader : g_uboShaderFiles[i][0], g_uboShaderFiles[i][1], ShaderState::SHADER_BLOCKS));
     else
-      g_shaderStates[i].reset(new ShaderState(g_shaderFiles[i][0], g_shaderFiles[i][1]));
+      g_shaderStates[i].reset(new ShaderState(g_compactVertices ? g_compactVertexShader : g_shaderFiles[i][0], g_shaderFiles[i][1]));
+  }
+
+  if (g_useInstancing) {
+    g_instancedShaderStates.resize(g_numShaders);
+    for (int i = 0; i < g_numShaders; ++i) {
+      g_instancedShaderStates[i].reset(new ShaderState(g_compactVertices ? g_compactInstancedVertexShader : g_instancedShaderFiles[i][0],
+                                                       g_instancedShaderFiles[i][1], ShaderState::SHADER_INSTANCED));
+    }
+  }
+
+  if (g_useMultiDrawIndirect) {
+    g_indirectShaderStates.resize(g_numShaders);
+    for (int i = 0; i < g_numShaders; ++i) {
+      g_indirectShaderStates[i].reset(new ShaderState(g_compactVertices ? g_compactIndirectVertexShader : g_indirectShaderFiles[i][0],
+                                                      g_indirectShaderFiles[i][1], ShaderState::SHADER_INDIRECT));
+    }
   }
 }
 
 static void initGeometry() {
+  if (g_useGeometryPool) {
+    const int vertexSize = g_compactVertices ? sizeof(VertexPNXc) : sizeof(VertexPNX);
+    // every chunk has 16-bit indices unless big meshes are kept whole
+    g_geometryPool.reset(new GlGeometryPool(vertexSize, g_geometryChunkLimit > 0 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT));
+  }
+  if (g_useInstancing)
+    g_instanceVbo.reset(new GlBufferObject);
+  if (g_useMultiDrawIndirect) {
+    g_objectIndexCount = g_numObjects + *max_element(g_crowdSizes, g_crowdSizes + g_numCrowdSizes);
+    vector<GLuint> numbers(g_objectIndexCount);
+    for (int i = 0; i < g_objectIndexCount; ++i) {
+      numbers[i] = i;
+    }
+    g_objectIndexVbo.reset(new GlBufferObject);
+    glBindBuffer(GL_ARRAY_BUFFER, *g_objectIndexVbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * numbers.size(), &numbers[0], GL_STATIC_DRAW);
+  }
+
   initObjects();
+  makeCrowd();
 }
 
 int main(int argc, char * argv[]) {
   try {
     initGlutState(argc,argv);
+    if (argc > 1)
+      g_importFile = argv[1]; // what glutInit left of the arguments
 
     glewInit(); // load the OpenGL extensions
 
@@ -551,6 +1945,28 @@ int main(int argc, char * argv[]) {
     else if (g_Gl2Compatible && !GLEW_VERSION_2_0)
       throw runtime_error("Error: card/driver does not support OpenGL Shading Language v1.0");
 
+    if (g_useStrips && !GLEW_VERSION_3_1) {
+      cout << "No primitive restart, building triangle lists" << endl;
+      g_useStrips = false;
+    }
+    if (g_useUniformBuffers && !GLEW_VERSION_3_2) {
+      cout << "No fence sync objects, sending uniforms one at a time" << endl;
+      g_useUniformBuffers = false;
+    }
+    g_persistentMapping = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+    if (g_useGeometryPool && !GLEW_VERSION_3_2) {
+      cout << "No base vertex draws, giving every geometry its own buffers" << endl;
+      g_useGeometryPool = false;
+    }
+    if (g_useMultiDrawIndirect && !(GLEW_VERSION_4_3 && g_useGeometryPool && g_useUniformBuffers)) {
+      cout << "No glMultiDrawElementsIndirect, drawing through the render queue" << endl;
+      g_useMultiDrawIndirect = false;
+    }
+    if (g_useInstancing && !(GLEW_VERSION_3_3 && g_useUniformBuffers)) {
+      cout << "No glVertexAttribDivisor, drawing objects one at a time" << endl;
+      g_useInstancing = false;
+    }
+
     initGLState();
     initShaders();
     initGeometry();
@@ -2,12 +2,23 @@
 #define GEOMETRYMAKER_H
 
 #include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 #include "cvec.h"
+#include "parallel.h"
 
 //--------------------------------------------------------------------------------
 // Helpers for creating some special geometries such as plane, cubes, and spheres
 //--------------------------------------------------------------------------------
 
+// Index that the *Strip functions put between two triangle strips. All bits
+// are set, so stored in any unsigned index type it becomes the largest value
+// of that type, which is what primitive restart is enabled for.
+static const unsigned int CS150_RESTART_INDEX = 0xFFFFFFFFu;
+
 
 // A generic vertex structure containing position, normal, and texture information
 // Used by make* functions to pass vertex information to the caller
@@ -25,8 +36,92 @@ struct GenericVertex {
     float bx, float by, float bz)
     : pos(x,y,z), normal(nx,ny,nz), tex(tu, tv), tangent(tx, ty, tz), binormal(bx, by, bz)
   {}
+
+  GenericVertex(const Cvec3f& pos, const Cvec3f& normal, const Cvec2f& tex,
+                const Cvec3f& tangent, const Cvec3f& binormal)
+    : pos(pos), normal(normal), tex(tex), tangent(tangent), binormal(binormal)
+  {}
+};
+
+// Which attributes a vertex type stores and how to write them. The make*
+// functions only compute the attributes whose flag is set, so specializing
+// this for a vertex type without, say, a tangent frame saves that work on
+// every vertex. The default suits any type assignable from GenericVertex and
+// fills everything.
+template<typename Vertex>
+struct VertexTraits {
+  static const bool hasTexCoord = true;
+  static const bool hasTangents = true; // tangent and binormal
+
+  static void write(Vertex& v, const Cvec3f& pos, const Cvec3f& normal, const Cvec2f& tex,
+                    const Cvec3f& tangent, const Cvec3f& binormal) {
+    v = GenericVertex(pos, normal, tex, tangent, binormal);
+  }
+};
+
+// The vertex type written through an iterator: its value type, or for
+// output iterators such as std::back_inserter, which have none, the value
+// type of their container
+template<typename Iter, typename Value = typename std::iterator_traits<Iter>::value_type>
+struct VertexTypeOf {
+  typedef Value type;
+};
+
+template<typename Iter>
+struct VertexTypeOf<Iter, void> {
+  typedef typename Iter::container_type::value_type type;
 };
 
+// Output iterators only take assignment, so the vertex is built first, or
+// for vertex types without a default constructor, assigned from a
+// GenericVertex as the default VertexTraits would
+template<typename Vertex, typename Out>
+inline void assignVertex(Out& out, const Cvec3f& pos, const Cvec3f& normal, const Cvec2f& tex,
+                         const Cvec3f& tangent, const Cvec3f& binormal, std::true_type) {
+  Vertex v;
+  VertexTraits<Vertex>::write(v, pos, normal, tex, tangent, binormal);
+  out = v;
+}
+
+template<typename Vertex, typename Out>
+inline void assignVertex(Out& out, const Cvec3f& pos, const Cvec3f& normal, const Cvec2f& tex,
+                         const Cvec3f& tangent, const Cvec3f& binormal, std::false_type) {
+  out = GenericVertex(pos, normal, tex, tangent, binormal);
+}
+
+// *vtxIter is the vertex itself, or for output iterators something that
+// takes one by assignment
+template<typename Vertex>
+inline void storeVertex(Vertex& out, const Cvec3f& pos, const Cvec3f& normal, const Cvec2f& tex,
+                        const Cvec3f& tangent, const Cvec3f& binormal, std::false_type) {
+  VertexTraits<Vertex>::write(out, pos, normal, tex, tangent, binormal);
+}
+
+template<typename Vertex, typename Out>
+inline void storeVertex(Out& out, const Cvec3f& pos, const Cvec3f& normal, const Cvec2f& tex,
+                        const Cvec3f& tangent, const Cvec3f& binormal, std::true_type) {
+  assignVertex<Vertex>(out, pos, normal, tex, tangent, binormal, std::is_default_constructible<Vertex>());
+}
+
+// Writes one vertex to *vtxIter through the VertexTraits of its vertex type
+template<typename VtxOutIter>
+inline void putVertex(VtxOutIter vtxIter, const Cvec3f& pos, const Cvec3f& normal, const Cvec2f& tex,
+                      const Cvec3f& tangent, const Cvec3f& binormal) {
+  typedef typename VertexTypeOf<VtxOutIter>::type Vertex;
+  storeVertex<Vertex>(*vtxIter, pos, normal, tex, tangent, binormal,
+                      std::is_void<typename std::iterator_traits<VtxOutIter>::value_type>());
+}
+
+template<typename VtxOutIter>
+inline void putVertex(VtxOutIter vtxIter,
+                      float x, float y, float z,
+                      float nx, float ny, float nz,
+                      float tu, float tv,
+                      float tx, float ty, float tz,
+                      float bx, float by, float bz) {
+  putVertex(vtxIter, Cvec3f(x, y, z), Cvec3f(nx, ny, nz), Cvec2f(tu, tv), Cvec3f(tx, ty, tz), Cvec3f(bx, by, bz));
+}
+
 inline void getPlaneVbIbLen(int& vbLen, int& ibLen) {
   vbLen = 4;
   ibLen = 6;
@@ -35,10 +130,10 @@ inline void getPlaneVbIbLen(int& vbLen, int& ibLen) {
 template<typename VtxOutIter, typename IdxOutIter>
 void makePlane(float size, VtxOutIter vtxIter, IdxOutIter idxIter) {
   float h = size / 2.0;
-  *vtxIter = GenericVertex(    -h, 0, -h, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, -1);
-  *(++vtxIter) = GenericVertex(-h, 0,  h, 0, 1, 0, 0, 1, 1, 0, 0, 0, 0, -1);
-  *(++vtxIter) = GenericVertex( h, 0,  h, 0, 1, 0, 1, 1, 1, 0, 0, 0, 0, -1);
-  *(++vtxIter) = GenericVertex( h, 0, -h, 0, 1, 0, 1, 0, 1, 0, 0, 0, 0, -1);
+  putVertex(vtxIter,     -h, 0, -h, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, -1);
+  putVertex(++vtxIter, -h, 0,  h, 0, 1, 0, 0, 1, 1, 0, 0, 0, 0, -1);
+  putVertex(++vtxIter,  h, 0,  h, 0, 1, 0, 1, 1, 1, 0, 0, 0, 0, -1);
+  putVertex(++vtxIter,  h, 0, -h, 0, 1, 0, 1, 0, 1, 0, 0, 0, 0, -1);
   *idxIter = 0;
   *(++idxIter) = 1;
   *(++idxIter) = 2;
@@ -56,45 +151,45 @@ template<typename VtxOutIter, typename IdxOutIter>
 void makeCube(float size, VtxOutIter vtxIter, IdxOutIter idxIter) {
   float h = size / 2.0;
   Cvec3f tan(0, 1, 0), bin(0, 0, 1);
-  { *vtxIter = GenericVertex(+ h, - h, - h, 1, 0, 0, 0, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(+ h, + h, - h, 1, 0, 0, 1, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(+ h, + h, + h, 1, 0, 0, 1, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(+ h, - h, + h, 1, 0, 0, 0, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, + h, - h, - h, 1, 0, 0, 0, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, + h, + h, - h, 1, 0, 0, 1, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, + h, + h, + h, 1, 0, 0, 1, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, + h, - h, + h, 1, 0, 0, 0, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
 
   tan = Cvec3f(0, 0, 1);
   bin = Cvec3f(0, 1, 0);
-  { *vtxIter = GenericVertex(- h, - h, - h, -1, 0, 0, 0, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(- h, - h, + h, -1, 0, 0, 1, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(- h, + h, + h, -1, 0, 0, 1, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(- h, + h, - h, -1, 0, 0, 0, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, - h, - h, - h, -1, 0, 0, 0, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, - h, - h, + h, -1, 0, 0, 1, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, - h, + h, + h, -1, 0, 0, 1, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, - h, + h, - h, -1, 0, 0, 0, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
 
   tan = Cvec3f(0, 0, 1);
   bin = Cvec3f(1, 0, 0);
-  { *vtxIter = GenericVertex(- h, + h, - h, 0, 1, 0, 0, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(- h, + h, + h, 0, 1, 0, 1, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(+ h, + h, + h, 0, 1, 0, 1, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(+ h, + h, - h, 0, 1, 0, 0, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, - h, + h, - h, 0, 1, 0, 0, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, - h, + h, + h, 0, 1, 0, 1, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, + h, + h, + h, 0, 1, 0, 1, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, + h, + h, - h, 0, 1, 0, 0, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
 
   tan = Cvec3f(1, 0, 0);
   bin = Cvec3f(0, 0, 1);
-  { *vtxIter = GenericVertex(- h, - h, - h, 0, -1, 0, 0, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(+ h, - h, - h, 0, -1, 0, 1, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(+ h, - h, + h, 0, -1, 0, 1, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(- h, - h, + h, 0, -1, 0, 0, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, - h, - h, - h, 0, -1, 0, 0, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, + h, - h, - h, 0, -1, 0, 1, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, + h, - h, + h, 0, -1, 0, 1, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, - h, - h, + h, 0, -1, 0, 0, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
 
   tan = Cvec3f(1, 0, 0);
   bin = Cvec3f(0, 1, 0);
-  { *vtxIter = GenericVertex(- h, - h, + h, 0, 0, 1, 0, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(+ h, - h, + h, 0, 0, 1, 1, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(+ h, + h, + h, 0, 0, 1, 1, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(- h, + h, + h, 0, 0, 1, 0, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, - h, - h, + h, 0, 0, 1, 0, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, + h, - h, + h, 0, 0, 1, 1, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, + h, + h, + h, 0, 0, 1, 1, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, - h, + h, + h, 0, 0, 1, 0, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
 
   tan = Cvec3f(0, 1, 0);
   bin = Cvec3f(1, 0, 0);
-  { *vtxIter = GenericVertex(- h, - h, - h, 0, 0, -1, 0, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(- h, + h, - h, 0, 0, -1, 1, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(+ h, + h, - h, 0, 0, -1, 1, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
-  { *vtxIter = GenericVertex(+ h, - h, - h, 0, 0, -1, 0, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, - h, - h, - h, 0, 0, -1, 0, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, - h, + h, - h, 0, 0, -1, 1, 0, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, + h, + h, - h, 0, 0, -1, 1, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
+  { putVertex(vtxIter, + h, - h, - h, 0, 0, -1, 0, 1, tan[0], tan[1], tan[2], bin[0], bin[1], bin[2]); ++vtxIter; };
 
   for (int v = 0; v < 24; v +=4) {
     *idxIter = v;
@@ -122,39 +217,39 @@ void makeOctahedron(float h, VtxOutIter vtxIter, IdxOutIter idxIter) {
   
   // Top side
 
-  { *vtxIter = GenericVertex(h, 0, 0, h, h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(0, 0, -h, h, h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(0, h, 0, h, h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, h, 0, 0, h, h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, 0, -h, h, h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, h, 0, h, h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
 
-  { *vtxIter = GenericVertex(0, 0, h, h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(h, 0, 0, h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(0, h, 0, h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, 0, h, h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, h, 0, 0, h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, h, 0, h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
 
-  { *vtxIter = GenericVertex(0, h, 0, -h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(-h, 0, 0, -h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(0, 0, h, -h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, h, 0, -h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, -h, 0, 0, -h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, 0, h, -h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
 
-  { *vtxIter = GenericVertex(-h, 0, 0, -h, h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(0, h, 0, -h, h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(0, 0, -h, -h, h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, -h, 0, 0, -h, h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, h, 0, -h, h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, 0, -h, -h, h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
 
 
   // Bottom Side
-  { *vtxIter = GenericVertex(0, 0, -h, h, -h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(h, 0, 0, h, -h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(0, -h, 0, h, -h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, 0, -h, h, -h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, h, 0, 0, h, -h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, -h, 0, h, -h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
 
-  { *vtxIter = GenericVertex(0, 0, h, h, -h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(0, -h, 0, h, -h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(h, 0, 0, h, -h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, 0, h, h, -h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, -h, 0, h, -h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, h, 0, 0, h, -h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
 
-  { *vtxIter = GenericVertex(0, -h, 0, -h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(0, 0, h, -h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(-h, 0, 0, -h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, -h, 0, -h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, 0, h, -h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, -h, 0, 0, -h, h, h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
 
-  { *vtxIter = GenericVertex(-h, 0, 0, -h, -h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(0, 0, -h, -h, -h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
-  { *vtxIter = GenericVertex(0, -h, 0, -h, -h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, -h, 0, 0, -h, -h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, 0, -h, -h, -h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
+  { putVertex(vtxIter, 0, -h, 0, -h, -h, -h, 1, 1, 1, 1, 1, 1, 1, 1); ++vtxIter; };
 
 
   for (int v = 0; v < 24; v++) {
@@ -170,6 +265,13 @@ inline void getTubeVbIbLen(int slices, int& vbLen, int& ibLen) {
   ibLen = 6 * slices;
 }
 
+// Largest distance between makeTube's output and the true cylinder, which is
+// the sagitta of one slice. Used to pick levels of detail.
+inline float getTubeError(float radius, int slices) {
+  assert(slices > 1);
+  return radius * (1 - std::cos(CS150_PI / slices));
+}
+
 template<typename VtxOutIter, typename IdxOutIter>
 void makeTube(float radius, float height, int slices, VtxOutIter vtxIter, IdxOutIter idxIter) {
   // TODO
@@ -187,7 +289,7 @@ void makeTube(float radius, float height, int slices, VtxOutIter vtxIter, IdxOut
       float y = j % 2 == 0 ? -1 * height / 2 : height / 2;
       float z = sin(radPerSlice * i);
       
-      *vtxIter = GenericVertex(x * radius, y, z * radius, x, 0, z, 1, 1, 1, 1, 1, 1, 1, 1);
+      putVertex(vtxIter, x * radius, y, z * radius, x, 0, z, 1, 1, 1, 1, 1, 1, 1, 1);
       vtxIter++;
     }
   }
@@ -204,6 +306,71 @@ void makeTube(float radius, float height, int slices, VtxOutIter vtxIter, IdxOut
   }
 }
 
+inline void getTubeStripVbIbLen(int slices, int& vbLen, int& ibLen) {
+  vbLen = 2 * slices + 2;
+  ibLen = 2 * slices + 2;
+}
+
+// Same tube as makeTube, but as a single GL_TRIANGLE_STRIP. Each rectangle
+// is split along its other diagonal; the surface and winding are the same.
+template<typename VtxOutIter, typename IdxOutIter>
+void makeTubeStrip(float radius, float height, int slices, VtxOutIter vtxIter, IdxOutIter idxIter) {
+  assert(slices > 1);
+  using namespace std;
+
+  const double radPerSlice = 2 * CS150_PI / slices;
+
+  for (int i = 0; i < slices + 1; i++) {
+    for (int j = 0; j < 2; j++) {
+      float x = cos(radPerSlice * i);
+      float y = j % 2 == 0 ? -1 * height / 2 : height / 2;
+      float z = sin(radPerSlice * i);
+
+      putVertex(vtxIter, x * radius, y, z * radius, x, 0, z, 1, 1, 1, 1, 1, 1, 1, 1);
+      vtxIter++;
+
+      // bottom and top vertex of each slice alternate
+      *idxIter = 2 * i + j;
+      ++idxIter;
+    }
+  }
+}
+
+// Same tube as makeTube, written straight into preallocated arrays of the
+// sizes given by getTubeVbIbLen. Slices are split across numThreads threads
+// (0 means one per core) and the output is bit-identical to makeTube.
+template<typename Vertex, typename Index>
+void makeTubeParallel(float radius, float height, int slices, Vertex *vtx, Index *idx, int numThreads = 0) {
+  assert(slices > 1);
+  using namespace std;
+
+  const double radPerSlice = 2 * CS150_PI / slices;
+
+  parallelForRange(slices + 1, numThreads, [=](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      Vertex *v = vtx + 2 * i;
+      for (int j = 0; j < 2; j++) {
+        float x = cos(radPerSlice * i);
+        float y = j % 2 == 0 ? -1 * height / 2 : height / 2;
+        float z = sin(radPerSlice * i);
+
+        putVertex(v + j, x * radius, y, z * radius, x, 0, z, 1, 1, 1, 1, 1, 1, 1, 1);
+      }
+
+      if (i < slices) {
+        Index *ix = idx + 6 * i;
+        ix[0] = 2 * i;
+        ix[1] = 2 * i + 1;
+        ix[2] = 2 * i + 3;
+
+        ix[3] = 2 * i;
+        ix[4] = 2 * i + 3;
+        ix[5] = 2 * i + 2;
+      }
+    }
+  }, CS150_BATCH_MIN_PER_THREAD / 2);
+}
+
 inline void getSphereVbIbLen(int slices, int stacks, int& vbLen, int& ibLen) {
   assert(slices > 1);
   assert(stacks >= 2);
@@ -211,9 +378,19 @@ inline void getSphereVbIbLen(int slices, int stacks, int& vbLen, int& ibLen) {
   ibLen = slices * stacks * 6;
 }
 
+// Largest distance between makeSphere's output and the true sphere, which is
+// in the middle of the widest grid cells, next to the equator: one slice
+// (2pi/slices) by one stack (pi/stacks) across
+inline float getSphereError(float radius, int slices, int stacks) {
+  assert(slices > 1);
+  assert(stacks >= 2);
+  return radius * (1 - std::cos(CS150_PI / slices) * std::cos(CS150_PI / (2 * stacks)));
+}
+
 template<typename VtxOutIter, typename IdxOutIter>
 void makeSphere(float radius, int slices, int stacks, VtxOutIter vtxIter, IdxOutIter idxIter) {
   using namespace std;
+  typedef VertexTraits<typename VertexTypeOf<VtxOutIter>::type> Traits;
   assert(slices > 1);
   assert(stacks >= 2);
 
@@ -238,15 +415,16 @@ void makeSphere(float radius, int slices, int stacks, VtxOutIter vtxIter, IdxOut
       float z = latCos[j];
 
       Cvec3f n(x, y, z);
-      Cvec3f b(-longSin[i], longCos[i], 0);
-      Cvec3f t = cross(n, b);
-
-      *vtxIter = GenericVertex(
-        x * radius, y * radius, z * radius,
-        x, y, z,
-        1.0/slices*i, 1.0/stacks*j,
-        t[0], t[1], t[2],
-        b[0], b[1], b[2]);
+      Cvec2f tex;
+      if (Traits::hasTexCoord)
+        tex = Cvec2f(1.0/slices*i, 1.0/stacks*j);
+      Cvec3f t, b;
+      if (Traits::hasTangents) {
+        b = Cvec3f(-longSin[i], longCos[i], 0);
+        t = cross(n, b);
+      }
+
+      putVertex(vtxIter, n * radius, n, tex, t, b);
       ++vtxIter;
 
       if (i < slices && j < stacks ) {
@@ -263,4 +441,256 @@ void makeSphere(float radius, int slices, int stacks, VtxOutIter vtxIter, IdxOut
   }
 }
 
+inline void getSphereStripVbIbLen(int slices, int stacks, int& vbLen, int& ibLen) {
+  assert(slices > 1);
+  assert(stacks >= 2);
+  vbLen = (slices + 1) * (stacks + 1);
+  ibLen = slices * (2 * stacks + 3) - 1;
+}
+
+// Same sphere as makeSphere, but as one GL_TRIANGLE_STRIP per slice,
+// separated by CS150_RESTART_INDEX. The triangles and their winding are the
+// same; the index buffer has about 2 instead of 6 indices per grid quad.
+template<typename VtxOutIter, typename IdxOutIter>
+void makeSphereStrip(float radius, int slices, int stacks, VtxOutIter vtxIter, IdxOutIter idxIter) {
+  using namespace std;
+  typedef VertexTraits<typename VertexTypeOf<VtxOutIter>::type> Traits;
+  assert(slices > 1);
+  assert(stacks >= 2);
+
+  const double radPerSlice = 2 * CS150_PI / slices;
+  const double radPerStack = CS150_PI / stacks;
+
+  vector<double> longSin(slices+1), longCos(slices+1);
+  vector<double> latSin(stacks+1), latCos(stacks+1);
+  for (int i = 0; i < slices + 1; ++i) {
+    longSin[i] = sin(radPerSlice * i);
+    longCos[i] = cos(radPerSlice * i);
+  }
+  for (int i = 0; i < stacks + 1; ++i) {
+    latSin[i] = sin(radPerStack * i);
+    latCos[i] = cos(radPerStack * i);
+  }
+
+  for (int i = 0; i < slices + 1; ++i) {
+    for (int j = 0; j < stacks + 1; ++j) {
+      float x = longCos[i] * latSin[j];
+      float y = longSin[i] * latSin[j];
+      float z = latCos[j];
+
+      Cvec3f n(x, y, z);
+      Cvec2f tex;
+      if (Traits::hasTexCoord)
+        tex = Cvec2f(1.0/slices*i, 1.0/stacks*j);
+      Cvec3f t, b;
+      if (Traits::hasTangents) {
+        b = Cvec3f(-longSin[i], longCos[i], 0);
+        t = cross(n, b);
+      }
+
+      putVertex(vtxIter, n * radius, n, tex, t, b);
+      ++vtxIter;
+    }
+  }
+
+  for (int i = 0; i < slices; ++i) {
+    if (i > 0) {
+      *idxIter = CS150_RESTART_INDEX;
+      ++idxIter;
+    }
+    for (int j = 0; j < stacks + 1; ++j) {
+      *idxIter = (stacks+1) * (i + 1) + j;
+      *++idxIter = (stacks+1) * i + j;
+      ++idxIter;
+    }
+  }
+}
+
+// Same sphere as makeSphere, written straight into preallocated arrays of the
+// sizes given by getSphereVbIbLen. The sin/cos tables are computed once as in
+// makeSphere (they are only slices + stacks entries), then the grid is split
+// by slices across numThreads threads (0 means one per core). Each thread
+// writes its own disjoint rows of the vertex and index arrays, so the output
+// is bit-identical to makeSphere.
+template<typename Vertex, typename Index>
+void makeSphereParallel(float radius, int slices, int stacks, Vertex *vtx, Index *idx, int numThreads = 0) {
+  using namespace std;
+  typedef VertexTraits<Vertex> Traits;
+  assert(slices > 1);
+  assert(stacks >= 2);
+
+  const double radPerSlice = 2 * CS150_PI / slices;
+  const double radPerStack = CS150_PI / stacks;
+
+  vector<double> longSin(slices+1), longCos(slices+1);
+  vector<double> latSin(stacks+1), latCos(stacks+1);
+  for (int i = 0; i < slices + 1; ++i) {
+    longSin[i] = sin(radPerSlice * i);
+    longCos[i] = cos(radPerSlice * i);
+  }
+  for (int i = 0; i < stacks + 1; ++i) {
+    latSin[i] = sin(radPerStack * i);
+    latCos[i] = cos(radPerStack * i);
+  }
+
+  parallelForRange(slices + 1, numThreads, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      Vertex *v = vtx + (stacks + 1) * i;
+      Index *ix = idx + 6 * stacks * i;
+      for (int j = 0; j < stacks + 1; ++j) {
+        float x = longCos[i] * latSin[j];
+        float y = longSin[i] * latSin[j];
+        float z = latCos[j];
+
+        Cvec3f n(x, y, z);
+        Cvec2f tex;
+        if (Traits::hasTexCoord)
+          tex = Cvec2f(1.0/slices*i, 1.0/stacks*j);
+        Cvec3f t, b;
+        if (Traits::hasTangents) {
+          b = Cvec3f(-longSin[i], longCos[i], 0);
+          t = cross(n, b);
+        }
+
+        putVertex(v + j, n * radius, n, tex, t, b);
+
+        if (i < slices && j < stacks ) {
+          ix[0] = (stacks+1) * i + j;
+          ix[1] = (stacks+1) * i + j + 1;
+          ix[2] = (stacks+1) * (i + 1) + j + 1;
+
+          ix[3] = (stacks+1) * i + j;
+          ix[4] = (stacks+1) * (i + 1) + j + 1;
+          ix[5] = (stacks+1) * (i + 1) + j;
+          ix += 6;
+        }
+      }
+    }
+  }, max(1, CS150_BATCH_MIN_PER_THREAD / (stacks + 1)));
+}
+
+inline void getIcosphereVbIbLen(int subdivisions, int& vbLen, int& ibLen) {
+  assert(subdivisions >= 0);
+  vbLen = 10 * (1 << 2 * subdivisions) + 2;
+  ibLen = 60 * (1 << 2 * subdivisions);
+}
+
+// The unit icosahedron with a vertex at each pole: (0, 0, 1), a ring of five
+// at z = 1/sqrt(5), a ring of five turned by 36 degrees at z = -1/sqrt(5),
+// and (0, 0, -1). Faces are counterclockwise seen from outside.
+inline void getIcosahedron(std::vector<Cvec3>& pos, std::vector<int>& tri) {
+  const double z = 1 / std::sqrt(5.0), r = 2 * z;
+  pos.assign(1, Cvec3(0, 0, 1));
+  for (int k = 0; k < 10; ++k) {
+    const double a = 2 * CS150_PI / 5 * (k % 5) + (k < 5 ? 0 : CS150_PI / 5);
+    pos.push_back(Cvec3(r * std::cos(a), r * std::sin(a), k < 5 ? z : -z));
+  }
+  pos.push_back(Cvec3(0, 0, -1));
+
+  tri.clear();
+  for (int k = 0; k < 5; ++k) {
+    const int u0 = 1 + k, u1 = 1 + (k + 1) % 5, l0 = 6 + k, l1 = 6 + (k + 1) % 5;
+    const int t[] = {0, u0, u1,  u0, l0, u1,  u1, l0, l1,  11, l1, l0};
+    tri.insert(tri.end(), t, t + 12);
+  }
+}
+
+// Largest distance between makeIcosphere's output and the true sphere, which
+// is at the middle of the triangle whose plane passes closest to the center.
+// The faces of the icosahedron are all alike, so only one is subdivided.
+inline float getIcosphereError(float radius, int subdivisions) {
+  using namespace std;
+  assert(subdivisions >= 0);
+  vector<Cvec3> pos, next;
+  vector<int> tri;
+  getIcosahedron(pos, tri);
+  pos = vector<Cvec3>{pos[tri[0]], pos[tri[1]], pos[tri[2]]};
+  for (int s = 0; s < subdivisions; ++s) {
+    next.clear();
+    for (size_t i = 0; i < pos.size(); i += 3) {
+      const Cvec3 &a = pos[i], &b = pos[i + 1], &c = pos[i + 2];
+      const Cvec3 ab = normalize(a + b), bc = normalize(b + c), ca = normalize(c + a);
+      const Cvec3 t[] = {a, ab, ca,  ab, b, bc,  ca, bc, c,  ab, bc, ca};
+      next.insert(next.end(), t, t + 12);
+    }
+    pos.swap(next);
+  }
+
+  double closest = 1;
+  for (size_t i = 0; i < pos.size(); i += 3) {
+    const Cvec3 n = normalize(cross(pos[i + 1] - pos[i], pos[i + 2] - pos[i]));
+    closest = min(closest, dot(n, pos[i]));
+  }
+  return radius * (1 - closest);
+}
+
+// A sphere made by splitting every triangle of an icosahedron into four
+// subdivisions times, pushing the new vertices out onto the sphere. Unlike
+// makeSphere it has no seam column and no crowding at the poles: vertices are
+// spread almost evenly and each is shared by all its triangles, with the edge
+// midpoints of a level merged through a hash map on the edge's end points.
+// Texture coordinates are longitude and latitude as in makeSphere, but with
+// no duplicated seam the triangles across longitude 0 wrap through the whole
+// texture, so prefer makeSphere for textured spheres.
+template<typename VtxOutIter, typename IdxOutIter>
+void makeIcosphere(float radius, int subdivisions, VtxOutIter vtxIter, IdxOutIter idxIter) {
+  using namespace std;
+  typedef VertexTraits<typename VertexTypeOf<VtxOutIter>::type> Traits;
+  assert(subdivisions >= 0);
+
+  int vbLen, ibLen;
+  getIcosphereVbIbLen(subdivisions, vbLen, ibLen);
+  vector<Cvec3> pos;
+  vector<int> tri, next;
+  getIcosahedron(pos, tri);
+  pos.reserve(vbLen);
+
+  unordered_map<uint64_t, int> midpoints;
+  auto midpoint = [&](const int a, const int b) {
+    const uint64_t key = uint64_t(min(a, b)) << 32 | uint64_t(max(a, b));
+    const auto r = midpoints.insert(make_pair(key, int(pos.size())));
+    if (r.second)
+      pos.push_back(normalize(pos[a] + pos[b]));
+    return r.first->second;
+  };
+
+  for (int s = 0; s < subdivisions; ++s) {
+    midpoints.clear();
+    midpoints.reserve(tri.size() / 2); // every edge is shared by two triangles
+    next.clear();
+    for (size_t i = 0; i < tri.size(); i += 3) {
+      const int a = tri[i], b = tri[i + 1], c = tri[i + 2];
+      const int ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+      const int t[] = {a, ab, ca,  ab, b, bc,  ca, bc, c,  ab, bc, ca};
+      next.insert(next.end(), t, t + 12);
+    }
+    tri.swap(next);
+  }
+  assert(int(pos.size()) == vbLen && int(tri.size()) == ibLen);
+
+  for (size_t i = 0; i < pos.size(); ++i) {
+    const Cvec3f n(pos[i][0], pos[i][1], pos[i][2]);
+    Cvec2f tex;
+    if (Traits::hasTexCoord) {
+      const double u = atan2(pos[i][1], pos[i][0]) / (2 * CS150_PI);
+      tex = Cvec2f(u < 0 ? u + 1 : u, acos(max(-1.0, min(1.0, pos[i][2]))) / CS150_PI);
+    }
+    Cvec3f t, b;
+    if (Traits::hasTangents) {
+      // along the parallel as in makeSphere, which at the poles means along y
+      const double l = sqrt(pos[i][0] * pos[i][0] + pos[i][1] * pos[i][1]);
+      b = l > CS150_EPS ? Cvec3f(-pos[i][1] / l, pos[i][0] / l, 0) : Cvec3f(0, 1, 0);
+      t = cross(n, b);
+    }
+
+    putVertex(vtxIter, n * radius, n, tex, t, b);
+    ++vtxIter;
+  }
+
+  for (size_t i = 0; i < tri.size(); ++i) {
+    *idxIter = tri[i];
+    ++idxIter;
+  }
+}
+
 #endif
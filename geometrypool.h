@@ -0,0 +1,107 @@
+#ifndef GEOMETRYPOOL_H
+#define GEOMETRYPOOL_H
+
+#include <cassert>
+#include <memory>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "bufferarena.h"
+#include "glsupport.h"
+
+//--------------------------------------------------------------------------------
+// One vertex buffer and one index buffer shared by many meshes
+//--------------------------------------------------------------------------------
+//
+// Every mesh added gets a range of each of two GlBufferArenas, and is drawn
+// with its indices relative to its own first vertex: glDrawElementsBaseVertex
+// (OpenGL 3.2) with the first elements of the two ranges, or the same fields
+// of a DrawElementsIndirectCommand. Switching meshes then needs no buffer
+// binds, and all meshes can go into a single glMultiDrawElementsIndirect.
+//
+// All meshes must have the same vertex size. A mesh's ranges go back to the
+// pool when they are destroyed, and compact closes the holes that leaves.
+// The buffers get new names when they grow or shrink, so anything pointing
+// at them, such as a VAO, must be set up again when generation changes.
+
+// The layout glMultiDrawElementsIndirect reads
+struct DrawElementsIndirectCommand {
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+};
+
+class GlGeometryPool : Noncopyable {
+public:
+  // indexType is GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+  GlGeometryPool(const int vertexSize, const GLenum indexType)
+    : indexType_(indexType), vertices_(vertexSize),
+      indices_(indexType == GL_UNSIGNED_INT ? sizeof(GLuint) : sizeof(GLushort)) {}
+
+  // Copies vboLen vertices and iboLen indices of type idxType, which may be
+  // narrower than the pool's, into new ranges. When widening, restart turns
+  // the largest 16-bit index into the largest 32-bit one.
+  void add(const void *vtx, const int vboLen, const void *idx, const int iboLen, const GLenum idxType,
+           const bool restart, std::shared_ptr<GlArenaRange>& vertices, std::shared_ptr<GlArenaRange>& indices) {
+    assert(idxType == indexType_ || idxType == GL_UNSIGNED_SHORT);
+    std::vector<GLuint> wide;
+    if (idxType != indexType_) {
+      const GLushort *s = static_cast<const GLushort *>(idx);
+      wide.resize(iboLen);
+      for (int i = 0; i < iboLen; ++i) {
+        wide[i] = restart && s[i] == 0xFFFF ? 0xFFFFFFFFu : s[i];
+      }
+      idx = iboLen ? &wide[0] : 0;
+    }
+
+    vertices.reset(new GlArenaRange(vertices_, vboLen));
+    vertices->upload(vtx);
+    indices.reset(new GlArenaRange(indices_, iboLen));
+    indices->upload(idx);
+  }
+
+  // Moves ranges into the holes below them, copying about maxBytes. Returns
+  // how many bytes were copied.
+  int compact(const int maxBytes) {
+    const int v = vertices_.compact(maxBytes / vertices_.elementSize()) * vertices_.elementSize();
+    return v + indices_.compact((maxBytes - v) / indices_.elementSize()) * indices_.elementSize();
+  }
+
+  GLuint vbo() const {
+    return vertices_.buffer();
+  }
+
+  GLuint ibo() const {
+    return indices_.buffer();
+  }
+
+  GLenum indexType() const {
+    return indexType_;
+  }
+
+  int indexSize() const {
+    return indices_.elementSize();
+  }
+
+  const GlBufferArena& vertexArena() const {
+    return vertices_;
+  }
+
+  const GlBufferArena& indexArena() const {
+    return indices_;
+  }
+
+  // Changes whenever a buffer is replaced
+  int generation() const {
+    return vertices_.generation() + indices_.generation();
+  }
+
+private:
+  const GLenum indexType_;
+  GlBufferArena vertices_, indices_;
+};
+
+#endif
@@ -131,6 +131,28 @@ public:
   }
 };
 
+// Light wrapper around a GL vertex array object handle that automatically
+// allocates and deallocates. Can be casted to a GLuint. Needs OpenGL 3.0.
+class GlVertexArrayObject : Noncopyable {
+protected:
+  GLuint handle_;
+
+public:
+  GlVertexArrayObject() {
+    glGenVertexArrays(1, &handle_);
+    checkGlErrors();
+  }
+
+  ~GlVertexArrayObject() {
+    glDeleteVertexArrays(1, &handle_);
+  }
+
+  // Casts to GLuint so can be used directly by glBindVertexArray
+  operator GLuint() const {
+    return handle_;
+  }
+};
+
 
 // Safe versions of various functions that handle GLSL shader attributes
 // and variables: These mainly issue a warning when specified attributes
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+
+#include "halfedge.h"
+
+using namespace std;
+
+HalfEdgeMesh::HalfEdgeMesh(const unsigned int *idx, const int ibLen, const int numVertices)
+  : vert_(idx, idx + ibLen / 3 * 3), twin_(vert_.size(), -1), vertexEdge_(numVertices, -1),
+    removed_(vert_.size() / 3, 0) {
+  // sort the half-edges by the vertices they join, so twins end up next to
+  // each other
+  vector<pair<uint64_t, int> > edges;
+  edges.reserve(vert_.size());
+  for (int f = 0; f < numFaces(); ++f) {
+    const int a = vert_[3 * f], b = vert_[3 * f + 1], c = vert_[3 * f + 2];
+    assert(a < numVertices && b < numVertices && c < numVertices);
+    if (a == b || b == c || c == a) {
+      removed_[f] = 1;
+      continue;
+    }
+    for (int h = 3 * f; h < 3 * f + 3; ++h) {
+      const uint64_t lo = min(origin(h), dest(h)), hi = max(origin(h), dest(h));
+      edges.push_back(make_pair(lo << 32 | hi, h));
+    }
+  }
+  sort(edges.begin(), edges.end());
+
+  for (size_t i = 0, j; i < edges.size(); i = j) {
+    for (j = i + 1; j < edges.size() && edges[j].first == edges[i].first; ++j) {}
+    const int h0 = edges[i].second, h1 = edges[i + 1 < j ? i + 1 : i].second;
+    if (j - i == 2 && origin(h0) == dest(h1)) {
+      twin_[h0] = h1;
+      twin_[h1] = h0;
+    }
+  }
+
+  for (int h = 0; h < int(vert_.size()); ++h) {
+    if (!removed_[face(h)])
+      vertexEdge_[vert_[h]] = h;
+  }
+}
+
+bool HalfEdgeMesh::outgoingEdges(const int v, vector<int>& out) const {
+  out.clear();
+  const int h0 = vertexEdge_[v];
+  if (h0 < 0)
+    return false;
+
+  int h = h0;
+  do {
+    out.push_back(h);
+    h = twin_[prev(h)];
+  } while (h >= 0 && h != h0);
+  if (h == h0)
+    return false;
+
+  // the fan is open: walk the other way from h0 as well
+  for (h = h0; twin_[h] >= 0;) {
+    h = next(twin_[h]);
+    out.push_back(h);
+  }
+  return true;
+}
+
+int HalfEdgeMesh::findEdge(const int a, const int b) const {
+  const int h0 = vertexEdge_[a];
+  if (h0 < 0)
+    return -1;
+
+  int h = h0;
+  do {
+    if (dest(h) == b)
+      return h;
+    h = twin_[prev(h)];
+  } while (h >= 0 && h != h0);
+  if (h == h0)
+    return -1;
+
+  for (h = h0; twin_[h] >= 0;) {
+    h = next(twin_[h]);
+    if (dest(h) == b)
+      return h;
+  }
+  return -1;
+}
+
+// Sorted neighbours of v. Returns true if v is on a boundary.
+bool HalfEdgeMesh::ringVertices(const int v, vector<int>& out) const {
+  const bool boundary = outgoingEdges(v, out);
+  const int n = out.size();
+  out.resize(2 * n);
+  for (int i = n - 1; i >= 0; --i) {
+    const int h = out[i];
+    out[2 * i] = dest(h);
+    out[2 * i + 1] = dest(next(h));
+  }
+  sort(out.begin(), out.end());
+  out.erase(unique(out.begin(), out.end()), out.end());
+  return boundary;
+}
+
+bool HalfEdgeMesh::canCollapse(const int h) const {
+  const int t = twin_[h];
+  const int c = dest(next(h)), d = t >= 0 ? dest(next(t)) : -1;
+  vector<int>& ra = ring_[0];
+  vector<int>& rb = ring_[1];
+  const bool boundaryA = ringVertices(origin(h), ra);
+  const bool boundaryB = ringVertices(dest(h), rb);
+
+  if (t >= 0 && boundaryA && boundaryB)
+    return false;
+  // a tetrahedron would fold into two triangles back to back
+  if (t >= 0 && ra.size() <= 3 && rb.size() <= 3)
+    return false;
+
+  for (size_t i = 0, j = 0; i < ra.size() && j < rb.size();) {
+    if (ra[i] < rb[j])
+      ++i;
+    else if (rb[j] < ra[i])
+      ++j;
+    else {
+      if (ra[i] != c && ra[i] != d)
+        return false;
+      ++i, ++j;
+    }
+  }
+  return true;
+}
+
+int HalfEdgeMesh::collapse(const int h, const int u) {
+  assert(u == origin(h) || u == dest(h));
+  const int v = u == origin(h) ? dest(h) : origin(h);
+  vector<int>& outU = ring_[0];
+  vector<int>& outV = ring_[1];
+  outgoingEdges(u, outU);
+  outgoingEdges(v, outV);
+
+  // drop the triangles on the edge, joining the twins of their other edges
+  const int edges[2] = {h, twin_[h]};
+  int removed = 0;
+  for (int k = 0; k < 2; ++k) {
+    const int e = edges[k];
+    if (e < 0)
+      continue;
+    const int a = twin_[next(e)], b = twin_[prev(e)], w = origin(prev(e));
+    if (a >= 0)
+      twin_[a] = b;
+    if (b >= 0)
+      twin_[b] = a;
+    removed_[face(e)] = 1;
+    ++removed;
+    // a leaves w, b arrives at w
+    vertexEdge_[w] = a >= 0 ? a : b >= 0 ? next(b) : -1;
+  }
+
+  vertexEdge_[u] = vertexEdge_[v] = -1;
+  for (size_t i = 0; i < outU.size(); ++i) {
+    if (!removed_[face(outU[i])]) {
+      vert_[outU[i]] = v;
+      vertexEdge_[v] = outU[i];
+    }
+  }
+  for (size_t i = 0; i < outV.size() && vertexEdge_[v] < 0; ++i) {
+    if (!removed_[face(outV[i])])
+      vertexEdge_[v] = outV[i];
+  }
+  return removed;
+}
+
+void HalfEdgeMesh::getIndices(vector<unsigned int>& idx) const {
+  idx.clear();
+  for (int f = 0; f < numFaces(); ++f) {
+    if (!removed_[f])
+      idx.insert(idx.end(), vert_.begin() + 3 * f, vert_.begin() + 3 * f + 3);
+  }
+}
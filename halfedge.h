@@ -0,0 +1,95 @@
+#ifndef HALFEDGE_H
+#define HALFEDGE_H
+
+#include <vector>
+
+//--------------------------------------------------------------------------------
+// Half-edge adjacency for indexed triangle lists
+//--------------------------------------------------------------------------------
+//
+// Half-edge h is the edge of triangle h / 3 that starts at its corner h, so
+// the half-edges are simply the index buffer entries and next, prev and face
+// are arithmetic. Only the twin of each half-edge (the opposite half-edge of
+// the neighbouring triangle, -1 on a boundary) and one outgoing half-edge per
+// vertex are stored, which keeps meshes of millions of triangles cheap.
+//
+// Edges shared by more than two triangles, or by two triangles using them in
+// the same direction, get no twins, so the mesh looks open along them.
+// Degenerate triangles are dropped when the mesh is built.
+
+class HalfEdgeMesh {
+public:
+  // Builds the adjacency of the triangle list idx[0..ibLen) over vertices
+  // 0..numVertices-1
+  HalfEdgeMesh(const unsigned int *idx, const int ibLen, const int numVertices);
+
+  static int next(const int h) {
+    return h % 3 == 2 ? h - 2 : h + 1;
+  }
+
+  static int prev(const int h) {
+    return h % 3 == 0 ? h + 2 : h - 1;
+  }
+
+  static int face(const int h) {
+    return h / 3;
+  }
+
+  int numFaces() const {
+    return removed_.size();
+  }
+
+  int numVertices() const {
+    return vertexEdge_.size();
+  }
+
+  int twin(const int h) const {
+    return twin_[h];
+  }
+
+  int origin(const int h) const {
+    return vert_[h];
+  }
+
+  int dest(const int h) const {
+    return vert_[next(h)];
+  }
+
+  bool faceRemoved(const int f) const {
+    return removed_[f] != 0;
+  }
+
+  // An outgoing half-edge of v, -1 if v is in no triangle
+  int vertexEdge(const int v) const {
+    return vertexEdge_[v];
+  }
+
+  // Stores the outgoing half-edges of v in out. Returns true if v is on a
+  // boundary. Only sees one fan of a vertex where several fans meet.
+  bool outgoingEdges(const int v, std::vector<int>& out) const;
+
+  // A half-edge from a to b, or -1
+  int findEdge(const int a, const int b) const;
+
+  // Whether collapsing the edge of half-edge h keeps the mesh a manifold:
+  // the only common neighbours of its two ends are the third corners of the
+  // triangles on the edge, and an interior edge does not join two boundaries
+  bool canCollapse(const int h) const;
+
+  // Removes the triangles on the edge of half-edge h and moves every corner
+  // at vertex u, one end of the edge, to the other end. Returns the number of
+  // triangles removed.
+  int collapse(const int h, const int u);
+
+  // The triangles that are left, as a triangle list
+  void getIndices(std::vector<unsigned int>& idx) const;
+
+private:
+  std::vector<int> vert_, twin_, vertexEdge_;
+  std::vector<char> removed_; // per triangle
+  mutable std::vector<int> ring_[2]; // scratch for canCollapse
+
+  bool ringVertices(const int v, std::vector<int>& out) const;
+};
+
+#endif
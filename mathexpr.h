@@ -0,0 +1,303 @@
+#ifndef MATHEXPR_H
+#define MATHEXPR_H
+
+#include "cvec.h"
+#include "matrix4.h"
+
+//--------------------------------------------------------------------------------
+// Opt-in expression templates for Cvec and Matrix4 arithmetic
+//--------------------------------------------------------------------------------
+//
+// The operators of Cvec and Matrix4 return a fresh object for every
+// intermediate result. Wrapping the first operand of a chain in lazy() makes
+// the rest of the chain build a small expression object instead, and the
+// whole chain is evaluated in one pass when it is assigned to a Cvec or
+// Matrix4:
+//
+//   Cvec3 p = lazy(a) + b * 2 - c;               // one loop, no temporaries
+//   Matrix4 m = lazy(a) * r * inv(a) * obj;      // evaluated a row at a time
+//
+// Code that does not call lazy() is unaffected. Expression objects refer to
+// their operands, so they must be consumed within the statement that creates
+// them; do not store one in an auto variable.
+
+// ---- Cvec expressions
+
+// Base class of every Cvec expression E with n elements of type T
+template<typename E, typename T, int n>
+struct CvecExpr {
+  typedef T Scalar;
+
+  const E& self() const {
+    return static_cast<const E&>(*this);
+  }
+
+  T operator [] (const int i) const {
+    return self().at(i);
+  }
+
+  operator Cvec<T, n> () const {
+    Cvec<T, n> r;
+    for (int i = 0; i < n; ++i) {
+      r[i] = self().at(i);
+    }
+    return r;
+  }
+};
+
+template<typename T, int n>
+struct CvecRef : CvecExpr<CvecRef<T, n>, T, n> {
+  const Cvec<T, n>& v;
+  explicit CvecRef(const Cvec<T, n>& v) : v(v) {}
+  T at(const int i) const { return v[i]; }
+};
+
+template<typename L, typename R, typename T, int n>
+struct CvecSum : CvecExpr<CvecSum<L, R, T, n>, T, n> {
+  const L l;
+  const R r;
+  CvecSum(const L& l, const R& r) : l(l), r(r) {}
+  T at(const int i) const { return l.at(i) + r.at(i); }
+};
+
+template<typename L, typename R, typename T, int n>
+struct CvecDiff : CvecExpr<CvecDiff<L, R, T, n>, T, n> {
+  const L l;
+  const R r;
+  CvecDiff(const L& l, const R& r) : l(l), r(r) {}
+  T at(const int i) const { return l.at(i) - r.at(i); }
+};
+
+template<typename E, typename T, int n>
+struct CvecScaled : CvecExpr<CvecScaled<E, T, n>, T, n> {
+  const E e;
+  const T a;
+  CvecScaled(const E& e, const T a) : e(e), a(a) {}
+  T at(const int i) const { return e.at(i) * a; }
+};
+
+template<typename T, int n>
+CvecRef<T, n> lazy(const Cvec<T, n>& v) {
+  return CvecRef<T, n>(v);
+}
+
+template<typename L, typename R, typename T, int n>
+CvecSum<L, R, T, n> operator + (const CvecExpr<L, T, n>& l, const CvecExpr<R, T, n>& r) {
+  return CvecSum<L, R, T, n>(l.self(), r.self());
+}
+
+template<typename L, typename T, int n>
+CvecSum<L, CvecRef<T, n>, T, n> operator + (const CvecExpr<L, T, n>& l, const Cvec<T, n>& r) {
+  return CvecSum<L, CvecRef<T, n>, T, n>(l.self(), CvecRef<T, n>(r));
+}
+
+template<typename R, typename T, int n>
+CvecSum<CvecRef<T, n>, R, T, n> operator + (const Cvec<T, n>& l, const CvecExpr<R, T, n>& r) {
+  return CvecSum<CvecRef<T, n>, R, T, n>(CvecRef<T, n>(l), r.self());
+}
+
+template<typename L, typename R, typename T, int n>
+CvecDiff<L, R, T, n> operator - (const CvecExpr<L, T, n>& l, const CvecExpr<R, T, n>& r) {
+  return CvecDiff<L, R, T, n>(l.self(), r.self());
+}
+
+template<typename L, typename T, int n>
+CvecDiff<L, CvecRef<T, n>, T, n> operator - (const CvecExpr<L, T, n>& l, const Cvec<T, n>& r) {
+  return CvecDiff<L, CvecRef<T, n>, T, n>(l.self(), CvecRef<T, n>(r));
+}
+
+template<typename R, typename T, int n>
+CvecDiff<CvecRef<T, n>, R, T, n> operator - (const Cvec<T, n>& l, const CvecExpr<R, T, n>& r) {
+  return CvecDiff<CvecRef<T, n>, R, T, n>(CvecRef<T, n>(l), r.self());
+}
+
+template<typename E, typename T, int n>
+CvecScaled<E, T, n> operator * (const CvecExpr<E, T, n>& e, const typename CvecExpr<E, T, n>::Scalar a) {
+  return CvecScaled<E, T, n>(e.self(), a);
+}
+
+template<typename E, typename T, int n>
+CvecScaled<E, T, n> operator * (const typename CvecExpr<E, T, n>::Scalar a, const CvecExpr<E, T, n>& e) {
+  return CvecScaled<E, T, n>(e.self(), a);
+}
+
+// like Cvec::operator/=, multiplies by the reciprocal
+template<typename E, typename T, int n>
+CvecScaled<E, T, n> operator / (const CvecExpr<E, T, n>& e, const typename CvecExpr<E, T, n>::Scalar a) {
+  return CvecScaled<E, T, n>(e.self(), 1/a);
+}
+
+template<typename E, typename T, int n>
+CvecScaled<E, T, n> operator - (const CvecExpr<E, T, n>& e) {
+  return CvecScaled<E, T, n>(e.self(), T(-1));
+}
+
+// ---- Matrix4 expressions
+//
+// A matrix expression is evaluated one row at a time. Products are formed
+// left to right, so row i of a * b * c * d is ((row i of a) * b) * c) * d
+// and the only intermediate storage is a 4-element row on the stack.
+
+// Base class of every Matrix4 expression E
+template<typename E>
+struct Matrix4Expr {
+  const E& self() const {
+    return static_cast<const E&>(*this);
+  }
+
+  // writes row i of the expression into r[0..3]
+  void evalRow(const int i, double r[4]) const {
+    self().row(i, r);
+  }
+
+  operator Matrix4 () const {
+    Matrix4 m;
+    for (int i = 0; i < 4; ++i) {
+      self().row(i, &m(i, 0));
+    }
+    return m;
+  }
+};
+
+struct Matrix4Ref : Matrix4Expr<Matrix4Ref> {
+  const Matrix4& m;
+  explicit Matrix4Ref(const Matrix4& m) : m(m) {}
+  double at(const int i, const int j) const { return m(i, j); }
+  void row(const int i, double r[4]) const {
+    for (int j = 0; j < 4; ++j) {
+      r[j] = m(i, j);
+    }
+  }
+};
+
+// Right hand factors of a product need random access. A plain matrix is used
+// in place; any other expression is evaluated once when the product is built.
+template<typename E>
+struct Matrix4Factor {
+  const Matrix4 m;
+  explicit Matrix4Factor(const E& e) : m(e) {}
+  double at(const int i, const int j) const { return m(i, j); }
+};
+
+template<>
+struct Matrix4Factor<Matrix4Ref> {
+  const Matrix4& m;
+  explicit Matrix4Factor(const Matrix4Ref& e) : m(e.m) {}
+  double at(const int i, const int j) const { return m(i, j); }
+};
+
+template<typename L, typename R>
+struct Matrix4Product : Matrix4Expr<Matrix4Product<L, R> > {
+  const L l;
+  const Matrix4Factor<R> r;
+  Matrix4Product(const L& l, const R& r) : l(l), r(r) {}
+  void row(const int i, double out[4]) const {
+    double a[4];
+    l.row(i, a);
+    for (int k = 0; k < 4; ++k) {
+      out[k] = a[0] * r.at(0, k) + a[1] * r.at(1, k) + a[2] * r.at(2, k) + a[3] * r.at(3, k);
+    }
+  }
+};
+
+template<typename L, typename R>
+struct Matrix4Sum : Matrix4Expr<Matrix4Sum<L, R> > {
+  const L l;
+  const R r;
+  const double sign;
+  Matrix4Sum(const L& l, const R& r, const double sign) : l(l), r(r), sign(sign) {}
+  void row(const int i, double out[4]) const {
+    double b[4];
+    l.row(i, out);
+    r.row(i, b);
+    for (int k = 0; k < 4; ++k) {
+      out[k] += sign * b[k];
+    }
+  }
+};
+
+template<typename E>
+struct Matrix4Scaled : Matrix4Expr<Matrix4Scaled<E> > {
+  const E e;
+  const double a;
+  Matrix4Scaled(const E& e, const double a) : e(e), a(a) {}
+  void row(const int i, double out[4]) const {
+    e.row(i, out);
+    for (int k = 0; k < 4; ++k) {
+      out[k] *= a;
+    }
+  }
+};
+
+inline Matrix4Ref lazy(const Matrix4& m) {
+  return Matrix4Ref(m);
+}
+
+template<typename L, typename R>
+Matrix4Product<L, R> operator * (const Matrix4Expr<L>& l, const Matrix4Expr<R>& r) {
+  return Matrix4Product<L, R>(l.self(), r.self());
+}
+
+template<typename L>
+Matrix4Product<L, Matrix4Ref> operator * (const Matrix4Expr<L>& l, const Matrix4& r) {
+  return Matrix4Product<L, Matrix4Ref>(l.self(), Matrix4Ref(r));
+}
+
+template<typename R>
+Matrix4Product<Matrix4Ref, R> operator * (const Matrix4& l, const Matrix4Expr<R>& r) {
+  return Matrix4Product<Matrix4Ref, R>(Matrix4Ref(l), r.self());
+}
+
+template<typename L, typename R>
+Matrix4Sum<L, R> operator + (const Matrix4Expr<L>& l, const Matrix4Expr<R>& r) {
+  return Matrix4Sum<L, R>(l.self(), r.self(), 1);
+}
+
+template<typename L>
+Matrix4Sum<L, Matrix4Ref> operator + (const Matrix4Expr<L>& l, const Matrix4& r) {
+  return Matrix4Sum<L, Matrix4Ref>(l.self(), Matrix4Ref(r), 1);
+}
+
+template<typename R>
+Matrix4Sum<Matrix4Ref, R> operator + (const Matrix4& l, const Matrix4Expr<R>& r) {
+  return Matrix4Sum<Matrix4Ref, R>(Matrix4Ref(l), r.self(), 1);
+}
+
+template<typename L, typename R>
+Matrix4Sum<L, R> operator - (const Matrix4Expr<L>& l, const Matrix4Expr<R>& r) {
+  return Matrix4Sum<L, R>(l.self(), r.self(), -1);
+}
+
+template<typename L>
+Matrix4Sum<L, Matrix4Ref> operator - (const Matrix4Expr<L>& l, const Matrix4& r) {
+  return Matrix4Sum<L, Matrix4Ref>(l.self(), Matrix4Ref(r), -1);
+}
+
+template<typename R>
+Matrix4Sum<Matrix4Ref, R> operator - (const Matrix4& l, const Matrix4Expr<R>& r) {
+  return Matrix4Sum<Matrix4Ref, R>(Matrix4Ref(l), r.self(), -1);
+}
+
+template<typename E>
+Matrix4Scaled<E> operator * (const Matrix4Expr<E>& e, const double a) {
+  return Matrix4Scaled<E>(e.self(), a);
+}
+
+template<typename E>
+Matrix4Scaled<E> operator * (const double a, const Matrix4Expr<E>& e) {
+  return Matrix4Scaled<E>(e.self(), a);
+}
+
+// a matrix expression applied to a vector is evaluated right away
+template<typename E>
+Cvec4 operator * (const Matrix4Expr<E>& e, const Cvec4& v) {
+  Cvec4 r;
+  double a[4];
+  for (int i = 0; i < 4; ++i) {
+    e.evalRow(i, a);
+    r[i] = a[0] * v[0] + a[1] * v[1] + a[2] * v[2] + a[3] * v[3];
+  }
+  return r;
+}
+
+#endif
@@ -8,7 +8,7 @@
 
 // Forward declaration of Matrix4 and transpose since those are used below
 class Matrix4;
-Matrix4 transpose(const Matrix4& m);
+constexpr Matrix4 transpose(const Matrix4& m);
 
 // A 4x4 Matrix.
 // To get the element at ith row and jth column, use a(i,j)
@@ -16,32 +16,30 @@ class Matrix4 {
   double d_[16]; // layout is row-major
 
 public:
-  double &operator () (const int row, const int col) {
+  constexpr double &operator () (const int row, const int col) {
     return d_[(row << 2) + col];
   }
 
-  const double &operator () (const int row, const int col) const {
+  constexpr const double &operator () (const int row, const int col) const {
     return d_[(row << 2) + col];
   }
 
-  double& operator [] (const int i) {
+  constexpr double& operator [] (const int i) {
     return d_[i];
   }
 
-  const double& operator [] (const int i) const {
+  constexpr const double& operator [] (const int i) const {
     return d_[i];
   }
 
-  Matrix4() {
-    for (int i = 0; i < 16; ++i) {
-      d_[i] = 0;
-    }
+  // constexpr so that constant transforms fold at compile time
+  constexpr Matrix4() : d_() {
     for (int i = 0; i < 4; ++i) {
       (*this)(i,i) = 1;
     }
   }
 
-  Matrix4(const double a) {
+  constexpr Matrix4(const double a) : d_() {
     for (int i = 0; i < 16; ++i) {
       d_[i] = a;
     }
@@ -63,44 +61,44 @@ public:
     }
   }
 
-  Matrix4& operator += (const Matrix4& m) {
+  constexpr Matrix4& operator += (const Matrix4& m) {
     for (int i = 0; i < 16; ++i) {
       d_[i] += m.d_[i];
     }
     return *this;
   }
 
-  Matrix4& operator -= (const Matrix4& m) {
+  constexpr Matrix4& operator -= (const Matrix4& m) {
     for (int i = 0; i < 16; ++i) {
       d_[i] -= m.d_[i];
     }
     return *this;
   }
 
-  Matrix4& operator *= (const double a) {
+  constexpr Matrix4& operator *= (const double a) {
     for (int i = 0; i < 16; ++i) {
       d_[i] *= a;
     }
     return *this;
   }
 
-  Matrix4& operator *= (const Matrix4& a) {
+  constexpr Matrix4& operator *= (const Matrix4& a) {
     return *this = *this * a;
   }
 
-  Matrix4 operator + (const Matrix4& a) const {
+  constexpr Matrix4 operator + (const Matrix4& a) const {
     return Matrix4(*this) += a;
   }
 
-  Matrix4 operator - (const Matrix4& a) const {
+  constexpr Matrix4 operator - (const Matrix4& a) const {
     return Matrix4(*this) -= a;
   }
 
-  Matrix4 operator * (const double a) const {
+  constexpr Matrix4 operator * (const double a) const {
     return Matrix4(*this) *= a;
   }
 
-  Cvec4 operator * (const Cvec4& v) const {
+  constexpr Cvec4 operator * (const Cvec4& v) const {
     Cvec4 r(0);
     for (int i = 0; i < 4; ++i) {
       for (int j = 0; j < 4; ++j) {
@@ -110,7 +108,7 @@ public:
     return r;
   }
 
-  Matrix4 operator * (const Matrix4& m) const {
+  constexpr Matrix4 operator * (const Matrix4& m) const {
     Matrix4 r(0);
     for (int i = 0; i < 4; ++i) {
       for (int j = 0; j < 4; ++j) {
@@ -135,7 +133,7 @@ public:
     return makeZRotation(std::cos(ang * CS150_PI/180), std::sin(ang * CS150_PI/180));
   }
 
-  static Matrix4 makeXRotation(const double c, const double s) {
+  constexpr static Matrix4 makeXRotation(const double c, const double s) {
     Matrix4 r;
     r(1,1) = r(2,2) = c;
     r(1,2) = -s;
@@ -143,7 +141,7 @@ public:
     return r;
   }
 
-  static Matrix4 makeYRotation(const double c, const double s) {
+  constexpr static Matrix4 makeYRotation(const double c, const double s) {
     Matrix4 r;
     r(0,0) = r(2,2) = c;
     r(0,2) = s;
@@ -151,7 +149,7 @@ public:
     return r;
   }
 
-  static Matrix4 makeZRotation(const double c, const double s) {
+  constexpr static Matrix4 makeZRotation(const double c, const double s) {
     Matrix4 r;
     r(0,0) = r(1,1) = c;
     r(0,1) = -s;
@@ -159,7 +157,7 @@ public:
     return r;
   }
 
-  static Matrix4 makeTranslation(const Cvec3& t) {
+  constexpr static Matrix4 makeTranslation(const Cvec3& t) {
     Matrix4 r;
     for (int i = 0; i < 3; ++i) {
       r(i,3) = t[i];
@@ -167,7 +165,7 @@ public:
     return r;
   }
 
-  static Matrix4 makeScale(const Cvec3& s) {
+  constexpr static Matrix4 makeScale(const Cvec3& s) {
     Matrix4 r;
     for (int i = 0; i < 3; ++i) {
       r(i,i) = s[i];
@@ -261,7 +259,7 @@ inline Matrix4 inv(const Matrix4& m) {
   return r;
 }
 
-inline Matrix4 transpose(const Matrix4& m) {
+constexpr Matrix4 transpose(const Matrix4& m) {
   Matrix4 r(0);
   for (int i = 0; i < 4; ++i) {
     for (int j = 0; j < 4; ++j) {
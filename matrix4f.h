@@ -0,0 +1,362 @@
+#ifndef MATRIX4F_H
+#define MATRIX4F_H
+
+#include <cassert>
+#include <cmath>
+
+// Define CS150_NO_SIMD to force the plain loops everywhere
+#if !defined(CS150_NO_SIMD) && (defined(__SSE__) || defined(_M_X64))
+#   include <xmmintrin.h>
+#   define CS150_SSE 1
+#   ifdef __AVX__
+#     include <immintrin.h>
+#     define CS150_AVX 1
+#   endif
+#endif
+
+#include "cvec.h"
+#include "matrix4.h"
+
+// Forward declaration of Matrix4f and transpose since those are used below
+class Matrix4f;
+Matrix4f transpose(const Matrix4f& m);
+
+// A single precision 4x4 Matrix with 16-byte aligned storage.
+//
+// Same interface and layout conventions as Matrix4, which remains the double
+// precision reference implementation. Products, vector transforms, transpose
+// and the affine inverse use SSE (and AVX for the matrix product) when the
+// compiler targets it, and fall back to the plain loops otherwise.
+//
+// To get the element at ith row and jth column, use a(i,j)
+class Matrix4f {
+  alignas(16) float d_[16]; // layout is row-major
+
+public:
+  float &operator () (const int row, const int col) {
+    return d_[(row << 2) + col];
+  }
+
+  const float &operator () (const int row, const int col) const {
+    return d_[(row << 2) + col];
+  }
+
+  float& operator [] (const int i) {
+    return d_[i];
+  }
+
+  const float& operator [] (const int i) const {
+    return d_[i];
+  }
+
+  // pointer to the (aligned) first element of row i
+  float* row(const int i) {
+    return d_ + (i << 2);
+  }
+
+  const float* row(const int i) const {
+    return d_ + (i << 2);
+  }
+
+  Matrix4f() {
+    for (int i = 0; i < 16; ++i) {
+      d_[i] = 0;
+    }
+    for (int i = 0; i < 4; ++i) {
+      (*this)(i,i) = 1;
+    }
+  }
+
+  Matrix4f(const float a) {
+    for (int i = 0; i < 16; ++i) {
+      d_[i] = a;
+    }
+  }
+
+  // narrow a double precision matrix
+  explicit Matrix4f(const Matrix4& m) {
+    for (int i = 0; i < 16; ++i) {
+      d_[i] = float(m[i]);
+    }
+  }
+
+  template <class T>
+  Matrix4f& readFromColumnMajorMatrix(const T m[]) {
+    for (int i = 0; i < 16; ++i) {
+      d_[i] = m[i];
+    }
+    return *this = transpose(*this);
+  }
+
+  // writing floats is a single transpose into the destination
+  void writeToColumnMajorMatrix(float m[]) const {
+#ifdef CS150_SSE
+    __m128 r0 = _mm_load_ps(d_), r1 = _mm_load_ps(d_ + 4);
+    __m128 r2 = _mm_load_ps(d_ + 8), r3 = _mm_load_ps(d_ + 12);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(m, r0);
+    _mm_storeu_ps(m + 4, r1);
+    _mm_storeu_ps(m + 8, r2);
+    _mm_storeu_ps(m + 12, r3);
+#else
+    for (int i = 0; i < 4; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        m[(j << 2) + i] = (*this)(i,j);
+      }
+    }
+#endif
+  }
+
+  template <class T>
+  void writeToColumnMajorMatrix(T m[]) const {
+    for (int i = 0; i < 4; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        m[(j << 2) + i] = T((*this)(i,j));
+      }
+    }
+  }
+
+  Matrix4f& operator += (const Matrix4f& m) {
+    for (int i = 0; i < 16; ++i) {
+      d_[i] += m.d_[i];
+    }
+    return *this;
+  }
+
+  Matrix4f& operator -= (const Matrix4f& m) {
+    for (int i = 0; i < 16; ++i) {
+      d_[i] -= m.d_[i];
+    }
+    return *this;
+  }
+
+  Matrix4f& operator *= (const float a) {
+    for (int i = 0; i < 16; ++i) {
+      d_[i] *= a;
+    }
+    return *this;
+  }
+
+  Matrix4f& operator *= (const Matrix4f& a) {
+    return *this = *this * a;
+  }
+
+  Matrix4f operator + (const Matrix4f& a) const {
+    return Matrix4f(*this) += a;
+  }
+
+  Matrix4f operator - (const Matrix4f& a) const {
+    return Matrix4f(*this) -= a;
+  }
+
+  Matrix4f operator * (const float a) const {
+    return Matrix4f(*this) *= a;
+  }
+
+  Cvec4f operator * (const Cvec4f& v) const {
+    Cvec4f r;
+#ifdef CS150_SSE
+    // multiply each row by v, then transpose so the four horizontal sums
+    // become three vertical adds
+    const __m128 x = _mm_setr_ps(v[0], v[1], v[2], v[3]);
+    __m128 r0 = _mm_mul_ps(_mm_load_ps(d_), x);
+    __m128 r1 = _mm_mul_ps(_mm_load_ps(d_ + 4), x);
+    __m128 r2 = _mm_mul_ps(_mm_load_ps(d_ + 8), x);
+    __m128 r3 = _mm_mul_ps(_mm_load_ps(d_ + 12), x);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    alignas(16) float out[4];
+    _mm_store_ps(out, _mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3)));
+    r = Cvec4f(out[0], out[1], out[2], out[3]);
+#else
+    for (int i = 0; i < 4; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        r[i] += (*this)(i,j) * v(j);
+      }
+    }
+#endif
+    return r;
+  }
+
+  Matrix4f operator * (const Matrix4f& m) const {
+    Matrix4f r(0);
+#if defined(CS150_AVX)
+    // two rows of the result per iteration: each 128 bit lane broadcasts
+    // one element of its own row of *this against the rows of m
+    const __m256 b0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(m.d_));
+    const __m256 b1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(m.d_ + 4));
+    const __m256 b2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(m.d_ + 8));
+    const __m256 b3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(m.d_ + 12));
+    for (int i = 0; i < 16; i += 8) {
+      const __m256 a = _mm256_loadu_ps(d_ + i);
+      __m256 s = _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0x00), b0);
+      s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0x55), b1));
+      s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0xaa), b2));
+      s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0xff), b3));
+      _mm256_storeu_ps(r.d_ + i, s);
+    }
+#elif defined(CS150_SSE)
+    // row i of the result is sum_j a(i,j) * (row j of m)
+    const __m128 b0 = _mm_load_ps(m.d_), b1 = _mm_load_ps(m.d_ + 4);
+    const __m128 b2 = _mm_load_ps(m.d_ + 8), b3 = _mm_load_ps(m.d_ + 12);
+    for (int i = 0; i < 16; i += 4) {
+      __m128 s = _mm_mul_ps(_mm_set1_ps(d_[i]), b0);
+      s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(d_[i + 1]), b1));
+      s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(d_[i + 2]), b2));
+      s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(d_[i + 3]), b3));
+      _mm_store_ps(r.d_ + i, s);
+    }
+#else
+    for (int i = 0; i < 4; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        for (int k = 0; k < 4; ++k) {
+          r(i,k) += (*this)(i,j) * m(j,k);
+        }
+      }
+    }
+#endif
+    return r;
+  }
+
+  static Matrix4f makeTranslation(const Cvec3f& t) {
+    Matrix4f r;
+    for (int i = 0; i < 3; ++i) {
+      r(i,3) = t[i];
+    }
+    return r;
+  }
+
+  static Matrix4f makeScale(const Cvec3f& s) {
+    Matrix4f r;
+    for (int i = 0; i < 3; ++i) {
+      r(i,i) = s[i];
+    }
+    return r;
+  }
+};
+
+// widen back to the double precision reference type
+inline Matrix4 toMatrix4(const Matrix4f& m) {
+  Matrix4 r;
+  for (int i = 0; i < 16; ++i) {
+    r[i] = m[i];
+  }
+  return r;
+}
+
+inline bool isAffine(const Matrix4f& m) {
+  return std::abs(m[15]-1) + std::abs(m[14]) + std::abs(m[13]) + std::abs(m[12]) < 1e-6f;
+}
+
+inline float norm2(const Matrix4f& m) {
+  float r = 0;
+  for (int i = 0; i < 16; ++i) {
+    r += m[i]*m[i];
+  }
+  return r;
+}
+
+inline Matrix4f transpose(const Matrix4f& m) {
+  Matrix4f r(0);
+#ifdef CS150_SSE
+  __m128 r0 = _mm_load_ps(m.row(0)), r1 = _mm_load_ps(m.row(1));
+  __m128 r2 = _mm_load_ps(m.row(2)), r3 = _mm_load_ps(m.row(3));
+  _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+  _mm_store_ps(r.row(0), r0);
+  _mm_store_ps(r.row(1), r1);
+  _mm_store_ps(r.row(2), r2);
+  _mm_store_ps(r.row(3), r3);
+#else
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      r(i,j) = m(j,i);
+    }
+  }
+#endif
+  return r;
+}
+
+#ifdef CS150_SSE
+// cross product of the xyz lanes; the w lane comes out as a.w*b.w - a.w*b.w = 0
+inline __m128 cs150_cross3_ps(const __m128 a, const __m128 b) {
+  const __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+  const __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+  const __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+  return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+#endif
+
+// computes inverse of affine matrix. assumes last row is [0,0,0,1]
+inline Matrix4f inv(const Matrix4f& m) {
+  assert(isAffine(m));
+#ifdef CS150_SSE
+  // With a0, a1, a2 the rows of the linear part, the columns of its inverse
+  // are (a1 x a2, a2 x a0, a0 x a1) / det. The translation lanes of the rows
+  // do not leak into the cross products (see cs150_cross3_ps).
+  const __m128 a0 = _mm_load_ps(m.row(0));
+  const __m128 a1 = _mm_load_ps(m.row(1));
+  const __m128 a2 = _mm_load_ps(m.row(2));
+  __m128 c0 = cs150_cross3_ps(a1, a2);
+  __m128 c1 = cs150_cross3_ps(a2, a0);
+  __m128 c2 = cs150_cross3_ps(a0, a1);
+
+  alignas(16) float d[4];
+  _mm_store_ps(d, _mm_mul_ps(a0, c0)); // c0.w is zero
+  const float det = d[0] + d[1] + d[2];
+
+  // check non-singular matrix
+  assert(std::abs(det) > CS150_EPS3);
+
+  const __m128 invDet = _mm_set1_ps(1 / det);
+  c0 = _mm_mul_ps(c0, invDet);
+  c1 = _mm_mul_ps(c1, invDet);
+  c2 = _mm_mul_ps(c2, invDet);
+
+  // "translation part" - multiply the translation (on the left) by the inverse linear part
+  __m128 t = _mm_mul_ps(c0, _mm_shuffle_ps(a0, a0, 0xff));
+  t = _mm_add_ps(t, _mm_mul_ps(c1, _mm_shuffle_ps(a1, a1, 0xff)));
+  t = _mm_add_ps(t, _mm_mul_ps(c2, _mm_shuffle_ps(a2, a2, 0xff)));
+  t = _mm_sub_ps(_mm_setzero_ps(), t);
+
+  // rows of the result are (c0[i], c1[i], c2[i], t[i])
+  _MM_TRANSPOSE4_PS(c0, c1, c2, t);
+  Matrix4f r;
+  _mm_store_ps(r.row(0), c0);
+  _mm_store_ps(r.row(1), c1);
+  _mm_store_ps(r.row(2), c2);
+#else
+  Matrix4f r;       // default constructor initializes it to identity
+  float det = m(0,0)*(m(1,1)*m(2,2) - m(1,2)*m(2,1)) +
+              m(0,1)*(m(1,2)*m(2,0) - m(1,0)*m(2,2)) +
+              m(0,2)*(m(1,0)*m(2,1) - m(1,1)*m(2,0));
+
+  // check non-singular matrix
+  assert(std::abs(det) > CS150_EPS3);
+  const float invDet = 1 / det;
+
+  // "rotation part"
+  r(0,0) =  (m(1,1) * m(2,2) - m(1,2) * m(2,1)) * invDet;
+  r(1,0) = -(m(1,0) * m(2,2) - m(1,2) * m(2,0)) * invDet;
+  r(2,0) =  (m(1,0) * m(2,1) - m(1,1) * m(2,0)) * invDet;
+  r(0,1) = -(m(0,1) * m(2,2) - m(0,2) * m(2,1)) * invDet;
+  r(1,1) =  (m(0,0) * m(2,2) - m(0,2) * m(2,0)) * invDet;
+  r(2,1) = -(m(0,0) * m(2,1) - m(0,1) * m(2,0)) * invDet;
+  r(0,2) =  (m(0,1) * m(1,2) - m(0,2) * m(1,1)) * invDet;
+  r(1,2) = -(m(0,0) * m(1,2) - m(0,2) * m(1,0)) * invDet;
+  r(2,2) =  (m(0,0) * m(1,1) - m(0,1) * m(1,0)) * invDet;
+
+  // "translation part" - multiply the translation (on the left) by the inverse linear part
+  r(0,3) = -(m(0,3) * r(0,0) + m(1,3) * r(0,1) + m(2,3) * r(0,2));
+  r(1,3) = -(m(0,3) * r(1,0) + m(1,3) * r(1,1) + m(2,3) * r(1,2));
+  r(2,3) = -(m(0,3) * r(2,0) + m(1,3) * r(2,1) + m(2,3) * r(2,2));
+#endif
+  assert(isAffine(r));
+  return r;
+}
+
+inline Matrix4f normalMatrix(const Matrix4f& m) {
+  Matrix4f invm = inv(m);
+  invm(0, 3) = invm(1, 3) = invm(2, 3) = 0;
+  return transpose(invm);
+}
+
+#endif
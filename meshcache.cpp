@@ -0,0 +1,151 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "meshcache.h"
+
+using namespace std;
+
+static const char MESH_CACHE_MAGIC[4] = {'M', 'S', 'H', 'C'};
+
+static uint64_t alignUp(const uint64_t x) {
+  return (x + CS150_MESH_CACHE_ALIGN - 1) / CS150_MESH_CACHE_ALIGN * CS150_MESH_CACHE_ALIGN;
+}
+
+uint64_t meshCacheKey(const string& description) {
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < description.size(); ++i) {
+    h ^= (unsigned char)description[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+string meshCachePath(const string& dir, const uint64_t key) {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.mesh", (unsigned long long)key);
+  return dir + "/" + name;
+}
+
+bool makeMeshCacheDir(const string& dir) {
+  struct stat st;
+  if (stat(dir.c_str(), &st) == 0)
+    return S_ISDIR(st.st_mode);
+  return mkdir(dir.c_str(), 0755) == 0;
+}
+
+MeshCacheWriter::MeshCacheWriter() {
+  memset(&header, 0, sizeof(header));
+}
+
+void MeshCacheWriter::addChunk(const void *vtx, const int vboLen,
+                               const void *idx, const int iboLen, const uint32_t indexType, const int indexSize) {
+  MeshCacheChunk c;
+  c.vboLen = vboLen;
+  c.iboLen = iboLen;
+  c.indexType = indexType;
+  c.indexSize = indexSize;
+
+  const size_t vtxBytes = size_t(vboLen) * header.format.vertexSize;
+  const size_t idxBytes = size_t(iboLen) * indexSize;
+
+  c.vertexOffset = alignUp(blobs_.size());
+  blobs_.resize(c.vertexOffset + vtxBytes);
+  memcpy(&blobs_[0] + c.vertexOffset, vtx, vtxBytes);
+
+  c.indexOffset = alignUp(blobs_.size());
+  blobs_.resize(c.indexOffset + idxBytes);
+  memcpy(&blobs_[0] + c.indexOffset, idx, idxBytes);
+
+  chunks_.push_back(c);
+}
+
+void MeshCacheWriter::write(const string& filename) const {
+  MeshCacheHeader h = header;
+  memcpy(h.magic, MESH_CACHE_MAGIC, sizeof(h.magic));
+  h.version = CS150_MESH_CACHE_VERSION;
+  h.numChunks = chunks_.size();
+
+  // blob offsets become file offsets
+  const uint64_t blobStart = alignUp(sizeof(MeshCacheHeader) + chunks_.size() * sizeof(MeshCacheChunk));
+  vector<MeshCacheChunk> table(chunks_);
+  for (size_t i = 0; i < table.size(); ++i) {
+    table[i].vertexOffset += blobStart;
+    table[i].indexOffset += blobStart;
+  }
+
+  const string tmp = filename + ".tmp";
+  {
+    ofstream f(tmp.c_str(), ios::binary);
+    if (!f)
+      throw runtime_error("MeshCacheWriter: cannot create " + tmp);
+    f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    if (!table.empty())
+      f.write(reinterpret_cast<const char*>(&table[0]), table.size() * sizeof(MeshCacheChunk));
+    const vector<char> pad(blobStart - sizeof(h) - table.size() * sizeof(MeshCacheChunk), 0);
+    if (!pad.empty())
+      f.write(&pad[0], pad.size());
+    if (!blobs_.empty())
+      f.write(&blobs_[0], blobs_.size());
+    if (!f)
+      throw runtime_error("MeshCacheWriter: cannot write " + tmp);
+  }
+  if (rename(tmp.c_str(), filename.c_str()) != 0) {
+    remove(tmp.c_str());
+    throw runtime_error("MeshCacheWriter: cannot rename " + tmp + " to " + filename);
+  }
+}
+
+MeshCacheFile::MeshCacheFile() : data_(0), size_(0) {}
+
+MeshCacheFile::~MeshCacheFile() {
+  close();
+}
+
+void MeshCacheFile::close() {
+  if (data_)
+    munmap(const_cast<char*>(data_), size_);
+  data_ = 0;
+  size_ = 0;
+}
+
+bool MeshCacheFile::open(const string& filename, const uint64_t key, const MeshCacheFormat& format) {
+  close();
+
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(MeshCacheHeader))
+    p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd); // the mapping stays valid
+  if (p == MAP_FAILED)
+    return false;
+
+  data_ = static_cast<const char*>(p);
+  size_ = st.st_size;
+
+  const MeshCacheHeader& h = header();
+  bool ok = !memcmp(h.magic, MESH_CACHE_MAGIC, sizeof(h.magic)) &&
+            h.version == CS150_MESH_CACHE_VERSION &&
+            h.key == key &&
+            !memcmp(&h.format, &format, sizeof(format)) &&
+            sizeof(MeshCacheHeader) + uint64_t(h.numChunks) * sizeof(MeshCacheChunk) <= size_;
+  for (uint32_t i = 0; ok && i < h.numChunks; ++i) {
+    const MeshCacheChunk& c = chunk(i);
+    ok = c.vertexOffset + uint64_t(c.vboLen) * format.vertexSize <= size_ &&
+         c.indexOffset + uint64_t(c.iboLen) * c.indexSize <= size_;
+  }
+  if (!ok)
+    close();
+  return ok;
+}
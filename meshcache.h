@@ -0,0 +1,134 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//--------------------------------------------------------------------------------
+// Binary cache files for meshes that are ready to upload
+//--------------------------------------------------------------------------------
+//
+// A cache file holds one mesh (one level of detail) exactly as it goes to the
+// GPU: a MeshCacheHeader, a table of MeshCacheChunk entries, then the vertex
+// and index blobs of every chunk, each aligned to CS150_MESH_CACHE_ALIGN
+// bytes. Files are written in native byte order; they are caches, not an
+// interchange format.
+//
+// A file is found by the key of the parameters that generated it, so changing
+// any of them simply misses the cache. Changing the code that generates the
+// mesh does not, so callers must put a version of that code in the key.
+// MeshCacheFile maps a file read only, and the blobs can be handed straight to
+// glBufferData.
+
+static const uint32_t CS150_MESH_CACHE_VERSION = 1;
+static const int CS150_MESH_CACHE_MAX_ATTRIBS = 4;
+static const int CS150_MESH_CACHE_ALIGN = 16;
+
+// One vertex attribute as it would be passed to glVertexAttribPointer
+struct MeshCacheAttrib {
+  uint32_t components;
+  uint32_t type;       // GL_FLOAT, GL_SHORT, ...
+  uint32_t normalized;
+  uint32_t offset;     // in bytes from the start of the vertex
+};
+
+// Describes the vertex layout of a file; a file is only used if its layout
+// is identical to the one asked for
+struct MeshCacheFormat {
+  uint32_t vertexSize;
+  uint32_t numAttribs;
+  MeshCacheAttrib attribs[CS150_MESH_CACHE_MAX_ATTRIBS];
+};
+
+struct MeshCacheHeader {
+  char magic[4];          // "MSHC"
+  uint32_t version;       // CS150_MESH_CACHE_VERSION
+  uint64_t key;           // meshCacheKey of the generator parameters
+  MeshCacheFormat format;
+  uint32_t primitive;     // GL_TRIANGLES, GL_TRIANGLE_STRIP, ...
+  uint32_t numChunks;
+  float boundsMin[3], boundsMax[3];
+  float radius;           // bounding sphere around the origin
+  float error;            // distance from the true surface, for level of detail
+  float posScale[3], posBias[3]; // position quantization of compact formats
+};
+
+// One VBO/IBO pair
+struct MeshCacheChunk {
+  uint64_t vertexOffset, indexOffset; // from the start of the file
+  uint32_t vboLen, iboLen;
+  uint32_t indexType;     // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+  uint32_t indexSize;     // bytes per index
+};
+
+// 64-bit FNV-1a hash of a description of everything the mesh depends on
+uint64_t meshCacheKey(const std::string& description);
+
+// File name of the mesh with the given key in directory dir
+std::string meshCachePath(const std::string& dir, const uint64_t key);
+
+// Creates directory dir if it does not exist. Returns false on failure.
+bool makeMeshCacheDir(const std::string& dir);
+
+// Collects the chunks of a mesh and writes them as a cache file. Fill in
+// header (apart from magic, version and numChunks) before calling write.
+class MeshCacheWriter {
+public:
+  MeshCacheHeader header;
+
+  MeshCacheWriter();
+
+  // Copies vboLen vertices of header.format.vertexSize bytes and iboLen
+  // indices of indexSize bytes
+  void addChunk(const void *vtx, const int vboLen,
+                const void *idx, const int iboLen, const uint32_t indexType, const int indexSize);
+
+  // Writes the file through a temporary and a rename, so readers never see a
+  // partial file. Throws runtime_error on error.
+  void write(const std::string& filename) const;
+
+private:
+  std::vector<MeshCacheChunk> chunks_; // offsets relative to blobs_
+  std::vector<char> blobs_;
+};
+
+// A cache file mapped into memory for reading
+class MeshCacheFile {
+public:
+  MeshCacheFile();
+  ~MeshCacheFile();
+
+  // Maps filename and checks that it is a complete file of the current
+  // version with the given key and vertex format. Returns false otherwise,
+  // e.g. when the file does not exist yet.
+  bool open(const std::string& filename, const uint64_t key, const MeshCacheFormat& format);
+
+  void close();
+
+  const MeshCacheHeader& header() const {
+    return *reinterpret_cast<const MeshCacheHeader*>(data_);
+  }
+
+  const MeshCacheChunk& chunk(const int i) const {
+    return reinterpret_cast<const MeshCacheChunk*>(data_ + sizeof(MeshCacheHeader))[i];
+  }
+
+  const void *vertices(const int i) const {
+    return data_ + chunk(i).vertexOffset;
+  }
+
+  const void *indices(const int i) const {
+    return data_ + chunk(i).indexOffset;
+  }
+
+private:
+  const char *data_;
+  size_t size_;
+
+  MeshCacheFile(const MeshCacheFile&);
+  MeshCacheFile& operator = (const MeshCacheFile&);
+};
+
+#endif
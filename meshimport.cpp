@@ -0,0 +1,851 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "meshimport.h"
+#include "parallel.h"
+
+using namespace std;
+
+// Bytes of an OBJ file each parsing thread should get at least
+static const int IMPORT_MIN_BYTES_PER_THREAD = 1 << 20;
+
+// Lines per block when a section of an ASCII PLY file is parsed in parallel
+static const int PLY_LINES_PER_BLOCK = 1 << 14;
+
+// A whole file mapped read only, unmapped on destruction
+class MappedFile {
+public:
+  explicit MappedFile(const char *filename) : data_(0), size_(0) {
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+      throw runtime_error(string("cannot open ") + filename);
+
+    struct stat st;
+    void *p = 0;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+      p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+    if (!p || p == MAP_FAILED)
+      throw runtime_error(string("cannot map ") + filename);
+    if (st.st_size >= INT_MAX) {
+      munmap(p, st.st_size);
+      throw runtime_error(string("file too large: ") + filename);
+    }
+
+    data_ = static_cast<const char*>(p);
+    size_ = st.st_size;
+  }
+
+  ~MappedFile() {
+    munmap(const_cast<char*>(data_), size_);
+  }
+
+  const char *begin() const {
+    return data_;
+  }
+
+  const char *end() const {
+    return data_ + size_;
+  }
+
+  int size() const {
+    return int(size_);
+  }
+
+private:
+  const char *data_;
+  size_t size_;
+
+  MappedFile(const MappedFile&);
+  MappedFile& operator = (const MappedFile&);
+};
+
+// ---- Text parsing
+
+static inline bool isBlank(const char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool isDigit(const char c) {
+  return unsigned(c - '0') < 10;
+}
+
+static inline const char *skipBlanks(const char *p, const char *end) {
+  while (p < end && isBlank(*p))
+    ++p;
+  return p;
+}
+
+// Start of the line after the one p is in
+static inline const char *nextLine(const char *p, const char *end) {
+  const char *nl = static_cast<const char*>(memchr(p, '\n', end - p));
+  return nl ? nl + 1 : end;
+}
+
+// Parses a decimal number such as -1.25e-3 after optional blanks. Much
+// faster than strtod, which also handles locales, hex and so on; the result
+// may be off by an ulp. Returns the position after the number, or p if there
+// is none.
+static const char *parseFloat(const char *p, const char *end, float& out) {
+  static const double POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  static const uint64_t MAX_MANTISSA = 100000000000000000ull; // 18 digits
+
+  const char *s = skipBlanks(p, end);
+  bool neg = false;
+  if (s < end && (*s == '-' || *s == '+'))
+    neg = *s++ == '-';
+
+  uint64_t m = 0;
+  int exp = 0, digits = 0;
+  for (; s < end && isDigit(*s); ++s, ++digits) {
+    if (m < MAX_MANTISSA)
+      m = m * 10 + (*s - '0');
+    else
+      ++exp;
+  }
+  if (s < end && *s == '.') {
+    for (++s; s < end && isDigit(*s); ++s, ++digits) {
+      if (m < MAX_MANTISSA) {
+        m = m * 10 + (*s - '0');
+        --exp;
+      }
+    }
+  }
+  if (!digits)
+    return p;
+
+  if (s < end && (*s == 'e' || *s == 'E')) {
+    const char *e = s + 1;
+    bool eneg = false;
+    if (e < end && (*e == '-' || *e == '+'))
+      eneg = *e++ == '-';
+    if (e < end && isDigit(*e)) {
+      int x = 0;
+      for (; e < end && isDigit(*e); ++e) {
+        if (x < 10000)
+          x = x * 10 + (*e - '0');
+      }
+      exp += eneg ? -x : x;
+      s = e;
+    }
+  }
+
+  double v = double(m);
+  if (exp < 0)
+    v = exp >= -22 ? v / POW10[-exp] : v * std::pow(10.0, exp);
+  else if (exp > 0)
+    v = exp <= 22 ? v * POW10[exp] : v * std::pow(10.0, exp);
+  out = float(neg ? -v : v);
+  return s;
+}
+
+// Parses an integer after optional blanks. Returns the position after it, or
+// p if there is none.
+static const char *parseInt(const char *p, const char *end, long long& out) {
+  const char *s = skipBlanks(p, end);
+  bool neg = false;
+  if (s < end && (*s == '-' || *s == '+'))
+    neg = *s++ == '-';
+  if (s >= end || !isDigit(*s))
+    return p;
+  long long x = 0;
+  for (; s < end && isDigit(*s); ++s) {
+    x = x * 10 + (*s - '0');
+  }
+  out = neg ? -x : x;
+  return s;
+}
+
+// Calls f(begin, end) on whole-line pieces of [data, data + size) on up to
+// numThreads threads. Pieces are aligned to line starts, and a line crossing
+// a split point goes to the earlier piece.
+template<typename Func>
+static void forEachLinePiece(const char *data, const int size, const int numThreads, Func f) {
+  parallelForRange(size, numThreads, [&](int begin, int end) {
+    const char *b = data + begin, *e = data + end;
+    if (begin > 0 && b[-1] != '\n')
+      b = nextLine(b, data + size);
+    if (end < size && e[-1] != '\n')
+      e = nextLine(e, data + size);
+    if (b < e)
+      f(b, e);
+  }, IMPORT_MIN_BYTES_PER_THREAD);
+}
+
+// Gives vertices without a normal (marked by hasNormal) the normalized sum
+// of the cross products of the triangles around their position index
+static void computeMissingNormals(const vector<Cvec3f>& positions, const vector<int>& positionIndex,
+                                  const vector<unsigned int>& indices, const vector<char>& hasNormal,
+                                  vector<Cvec3f>& normals) {
+  vector<Cvec3f> sum(positions.size(), Cvec3f(0));
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const int a = positionIndex[indices[i]], b = positionIndex[indices[i + 1]], c = positionIndex[indices[i + 2]];
+    const Cvec3f n = cross(positions[b] - positions[a], positions[c] - positions[a]);
+    sum[a] += n;
+    sum[b] += n;
+    sum[c] += n;
+  }
+  for (size_t i = 0; i < normals.size(); ++i) {
+    if (!hasNormal[i]) {
+      const Cvec3f& s = sum[positionIndex[i]];
+      normals[i] = dot(s, s) > CS150_EPS2 ? normalize(s) : Cvec3f(0, 0, 1);
+    }
+  }
+}
+
+// ---- OBJ
+
+// One corner of an OBJ face: 0-based position, texture coordinate and normal
+// indices, -1 if absent. Indices whose bit is set in rel were negative in the
+// file and are relative to the start of their piece.
+struct ObjCorner {
+  int v, t, n;
+  unsigned char rel;
+};
+
+enum {
+  OBJ_REL_V = 1,
+  OBJ_REL_T = 2,
+  OBJ_REL_N = 4
+};
+
+// What one thread read from its piece of the file
+struct ObjPiece {
+  const char *begin;
+  vector<Cvec3f> v, vn;
+  vector<Cvec2f> vt;
+  vector<ObjCorner> corners; // three per triangle
+};
+
+static int objIndex(const long long i, const size_t count, const unsigned char bit, unsigned char& rel) {
+  if (i > 0)
+    return int(i - 1);
+  if (i == 0)
+    throw runtime_error("importObj: index 0 in face");
+  rel |= bit;
+  return int(count + i);
+}
+
+static void parseObjPiece(const char *p, const char *end, ObjPiece& piece) {
+  vector<ObjCorner> face;
+  while (p < end) {
+    const char *line = skipBlanks(p, end);
+    const char *eol = nextLine(line, end);
+    p = eol;
+    if (eol - line < 2)
+      continue;
+
+    if (line[0] == 'v' && isBlank(line[1])) {
+      Cvec3f x;
+      const char *s = line + 1;
+      for (int k = 0; k < 3; ++k) {
+        s = parseFloat(s, eol, x[k]);
+      }
+      piece.v.push_back(x);
+    }
+    else if (line[0] == 'v' && line[1] == 'n' && eol - line > 2 && isBlank(line[2])) {
+      Cvec3f x;
+      const char *s = line + 2;
+      for (int k = 0; k < 3; ++k) {
+        s = parseFloat(s, eol, x[k]);
+      }
+      piece.vn.push_back(x);
+    }
+    else if (line[0] == 'v' && line[1] == 't' && eol - line > 2 && isBlank(line[2])) {
+      Cvec2f x;
+      const char *s = line + 2;
+      for (int k = 0; k < 2; ++k) {
+        s = parseFloat(s, eol, x[k]);
+      }
+      piece.vt.push_back(x);
+    }
+    else if (line[0] == 'f' && isBlank(line[1])) {
+      face.clear();
+      const char *s = line + 1;
+      for (;;) {
+        s = skipBlanks(s, eol);
+        if (s >= eol || *s == '\n' || *s == '#')
+          break;
+
+        ObjCorner c;
+        c.t = c.n = -1;
+        c.rel = 0;
+        long long i;
+        const char *q = parseInt(s, eol, i);
+        if (q == s)
+          throw runtime_error("importObj: bad face");
+        c.v = objIndex(i, piece.v.size(), OBJ_REL_V, c.rel);
+        s = q;
+        if (s < eol && *s == '/') {
+          ++s;
+          if (s < eol && *s != '/') {
+            q = parseInt(s, eol, i);
+            if (q == s)
+              throw runtime_error("importObj: bad face");
+            c.t = objIndex(i, piece.vt.size(), OBJ_REL_T, c.rel);
+            s = q;
+          }
+          if (s < eol && *s == '/') {
+            ++s;
+            q = parseInt(s, eol, i);
+            if (q == s)
+              throw runtime_error("importObj: bad face");
+            c.n = objIndex(i, piece.vn.size(), OBJ_REL_N, c.rel);
+            s = q;
+          }
+        }
+        face.push_back(c);
+      }
+
+      for (size_t k = 2; k < face.size(); ++k) {
+        piece.corners.push_back(face[0]);
+        piece.corners.push_back(face[k - 1]);
+        piece.corners.push_back(face[k]);
+      }
+    }
+  }
+}
+
+static inline uint32_t hashCorner(const ObjCorner& c) {
+  uint32_t h = uint32_t(c.v) * 0x9E3779B1u;
+  h ^= uint32_t(c.t + 1) * 0x85EBCA77u + (h << 6) + (h >> 2);
+  h ^= uint32_t(c.n + 1) * 0xC2B2AE3Du + (h << 6) + (h >> 2);
+  return h ^ (h >> 15);
+}
+
+void importObj(const char *filename, ImportedMesh& mesh, const int numThreads) {
+  MappedFile file(filename);
+
+  vector<ObjPiece*> pieces;
+  mutex piecesMutex;
+  try {
+    forEachLinePiece(file.begin(), file.size(), numThreads, [&](const char *b, const char *e) {
+      ObjPiece *piece = new ObjPiece;
+      piece->begin = b;
+      {
+        lock_guard<mutex> lock(piecesMutex);
+        pieces.push_back(piece);
+      }
+      parseObjPiece(b, e, *piece);
+    });
+  }
+  catch (...) {
+    for (size_t i = 0; i < pieces.size(); ++i) {
+      delete pieces[i];
+    }
+    throw;
+  }
+  sort(pieces.begin(), pieces.end(), [](const ObjPiece *a, const ObjPiece *b) { return a->begin < b->begin; });
+
+  // concatenate the pieces, resolving relative indices
+  vector<Cvec3f> v, vn;
+  vector<Cvec2f> vt;
+  vector<ObjCorner> corners;
+  for (size_t i = 0; i < pieces.size(); ++i) {
+    const ObjPiece& piece = *pieces[i];
+    const int baseV = v.size(), baseT = vt.size(), baseN = vn.size();
+    v.insert(v.end(), piece.v.begin(), piece.v.end());
+    vt.insert(vt.end(), piece.vt.begin(), piece.vt.end());
+    vn.insert(vn.end(), piece.vn.begin(), piece.vn.end());
+    for (size_t j = 0; j < piece.corners.size(); ++j) {
+      ObjCorner c = piece.corners[j];
+      if (c.rel & OBJ_REL_V)
+        c.v += baseV;
+      if (c.rel & OBJ_REL_T)
+        c.t += baseT;
+      if (c.rel & OBJ_REL_N)
+        c.n += baseN;
+      c.rel = 0;
+      corners.push_back(c);
+    }
+    delete pieces[i];
+  }
+
+  // merge equal corners with an open addressing hash table
+  uint32_t cap = 16;
+  while (cap < 2 * corners.size())
+    cap <<= 1;
+  vector<uint32_t> table(cap, UINT32_MAX);
+  vector<ObjCorner> unique;
+  mesh.indices.resize(corners.size());
+  for (size_t i = 0; i < corners.size(); ++i) {
+    const ObjCorner& c = corners[i];
+    if (c.v < 0 || c.v >= int(v.size()) || c.t < -1 || c.t >= int(vt.size()) || c.n < -1 || c.n >= int(vn.size()))
+      throw runtime_error(string("importObj: index out of range in ") + filename);
+
+    uint32_t h = hashCorner(c) & (cap - 1);
+    for (;;) {
+      const uint32_t u = table[h];
+      if (u == UINT32_MAX) {
+        table[h] = unique.size();
+        mesh.indices[i] = unique.size();
+        unique.push_back(c);
+        break;
+      }
+      if (unique[u].v == c.v && unique[u].t == c.t && unique[u].n == c.n) {
+        mesh.indices[i] = u;
+        break;
+      }
+      h = (h + 1) & (cap - 1);
+    }
+  }
+
+  const int n = unique.size();
+  mesh.positions.resize(n);
+  mesh.normals.resize(n);
+  mesh.texCoords.resize(n);
+  vector<int> positionIndex(n);
+  vector<char> hasNormal(n);
+  bool missingNormals = false;
+  for (int i = 0; i < n; ++i) {
+    const ObjCorner& c = unique[i];
+    positionIndex[i] = c.v;
+    mesh.positions[i] = v[c.v];
+    mesh.texCoords[i] = c.t >= 0 ? vt[c.t] : Cvec2f(0);
+    hasNormal[i] = c.n >= 0;
+    if (c.n >= 0)
+      mesh.normals[i] = dot(vn[c.n], vn[c.n]) > CS150_EPS2 ? normalize(vn[c.n]) : Cvec3f(0, 0, 1);
+    else
+      missingNormals = true;
+  }
+  if (missingNormals)
+    computeMissingNormals(v, positionIndex, mesh.indices, hasNormal, mesh.normals);
+}
+
+// ---- PLY
+
+enum PlyType {
+  PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64
+};
+
+enum PlyFormat {
+  PLY_ASCII, PLY_BINARY_LE, PLY_BINARY_BE
+};
+
+struct PlyProperty {
+  string name;
+  PlyType type;
+  bool isList;
+  PlyType countType; // for lists
+};
+
+struct PlyElement {
+  string name;
+  long long count;
+  vector<PlyProperty> props;
+};
+
+static PlyType plyParseType(const string& s) {
+  if (s == "char" || s == "int8") return PLY_INT8;
+  if (s == "uchar" || s == "uint8") return PLY_UINT8;
+  if (s == "short" || s == "int16") return PLY_INT16;
+  if (s == "ushort" || s == "uint16") return PLY_UINT16;
+  if (s == "int" || s == "int32") return PLY_INT32;
+  if (s == "uint" || s == "uint32") return PLY_UINT32;
+  if (s == "float" || s == "float32") return PLY_FLOAT32;
+  if (s == "double" || s == "float64") return PLY_FLOAT64;
+  throw runtime_error("importPly: unknown property type " + s);
+}
+
+static int plyTypeSize(const PlyType t) {
+  static const int sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+  return sizes[t];
+}
+
+// Reads one binary value, swapping its bytes if the file's byte order is not
+// the machine's
+static double plyRead(const char *p, const PlyType t, const bool swap) {
+  char b[8];
+  const int size = plyTypeSize(t);
+  for (int i = 0; i < size; ++i) {
+    b[i] = p[swap ? size - 1 - i : i];
+  }
+  switch (t) {
+  case PLY_INT8: { int8_t x; memcpy(&x, b, 1); return x; }
+  case PLY_UINT8: { uint8_t x; memcpy(&x, b, 1); return x; }
+  case PLY_INT16: { int16_t x; memcpy(&x, b, 2); return x; }
+  case PLY_UINT16: { uint16_t x; memcpy(&x, b, 2); return x; }
+  case PLY_INT32: { int32_t x; memcpy(&x, b, 4); return x; }
+  case PLY_UINT32: { uint32_t x; memcpy(&x, b, 4); return x; }
+  case PLY_FLOAT32: { float x; memcpy(&x, b, 4); return x; }
+  default: { double x; memcpy(&x, b, 8); return x; }
+  }
+}
+
+// Parses the header, leaving p at the first byte of data
+static PlyFormat plyParseHeader(const char *& p, const char *end, vector<PlyElement>& elements) {
+  const char *eol = nextLine(p, end);
+  if (eol - p < 3 || strncmp(p, "ply", 3))
+    throw runtime_error("importPly: not a PLY file");
+
+  PlyFormat format = PLY_ASCII;
+  bool gotFormat = false;
+  for (p = eol; p < end; p = eol) {
+    eol = nextLine(p, end);
+    istringstream line(string(p, eol));
+    string word;
+    line >> word;
+    if (word == "format") {
+      string f;
+      line >> f;
+      if (f == "ascii")
+        format = PLY_ASCII;
+      else if (f == "binary_little_endian")
+        format = PLY_BINARY_LE;
+      else if (f == "binary_big_endian")
+        format = PLY_BINARY_BE;
+      else
+        throw runtime_error("importPly: unknown format " + f);
+      gotFormat = true;
+    }
+    else if (word == "element") {
+      PlyElement e;
+      line >> e.name >> e.count;
+      if (!line || e.count < 0)
+        throw runtime_error("importPly: bad element");
+      elements.push_back(e);
+    }
+    else if (word == "property") {
+      if (elements.empty())
+        throw runtime_error("importPly: property before element");
+      PlyProperty prop;
+      string type;
+      line >> type;
+      prop.isList = type == "list";
+      if (prop.isList) {
+        string countType;
+        line >> countType >> type;
+        prop.countType = plyParseType(countType);
+      }
+      prop.type = plyParseType(type);
+      line >> prop.name;
+      elements.back().props.push_back(prop);
+    }
+    else if (word == "end_header") {
+      p = eol;
+      if (!gotFormat)
+        throw runtime_error("importPly: missing format");
+      return format;
+    }
+  }
+  throw runtime_error("importPly: missing end_header");
+}
+
+// Finds the starts of blocks of PLY_LINES_PER_BLOCK lines among the next
+// count lines after p, followed by the end of the last line, and returns it
+static const char *plySplitLines(const char *p, const char *end, const long long count, vector<const char*>& blocks) {
+  blocks.clear();
+  for (long long i = 0; i < count; ++i) {
+    if (p >= end)
+      throw runtime_error("importPly: file ends early");
+    if (i % PLY_LINES_PER_BLOCK == 0)
+      blocks.push_back(p);
+    p = nextLine(p, end);
+  }
+  blocks.push_back(p);
+  return p;
+}
+
+// Reads the count of the binary list property prop at p, checking that the
+// count and the items after it fit before end
+static int plyListCount(const PlyProperty& prop, const char *p, const char *end, const bool swap) {
+  if (plyTypeSize(prop.countType) > end - p)
+    throw runtime_error("importPly: file ends early");
+  const double n = plyRead(p, prop.countType, swap);
+  if (n < 0)
+    throw runtime_error("importPly: negative list count");
+  if (n * plyTypeSize(prop.type) > end - p - plyTypeSize(prop.countType))
+    throw runtime_error("importPly: list runs past the end of the file");
+  return int(n);
+}
+
+// Size in bytes of the binary element starting at p
+static int plyBinaryElementSize(const PlyElement& e, const char *p, const char *end, const bool swap) {
+  int size = 0;
+  for (size_t k = 0; k < e.props.size(); ++k) {
+    const PlyProperty& prop = e.props[k];
+    if (prop.isList) {
+      const int n = plyListCount(prop, p + size, end, swap);
+      size += plyTypeSize(prop.countType) + n * plyTypeSize(prop.type);
+    }
+    else
+      size += plyTypeSize(prop.type);
+  }
+  if (p + size > end)
+    throw runtime_error("importPly: file ends early");
+  return size;
+}
+
+// Reads the vertex element: which property feeds which attribute
+struct PlyVertexLayout {
+  int pos[3], normal[3], tex[2]; // property indices or -1
+
+  explicit PlyVertexLayout(const PlyElement& e) {
+    static const char *const posNames[] = {"x", "y", "z"};
+    static const char *const normalNames[] = {"nx", "ny", "nz"};
+    static const char *const texNames[2][4] = {{"u", "s", "texture_u", "texture_s"},
+                                               {"v", "t", "texture_v", "texture_t"}};
+    for (int i = 0; i < 3; ++i) {
+      pos[i] = find(e, posNames[i]);
+      normal[i] = find(e, normalNames[i]);
+    }
+    for (int i = 0; i < 2; ++i) {
+      tex[i] = -1;
+      for (int k = 0; k < 4 && tex[i] < 0; ++k) {
+        tex[i] = find(e, texNames[i][k]);
+      }
+    }
+    for (size_t k = 0; k < e.props.size(); ++k) {
+      if (e.props[k].isList)
+        throw runtime_error("importPly: list property in vertex element");
+    }
+    if (pos[0] < 0 || pos[1] < 0 || pos[2] < 0)
+      throw runtime_error("importPly: vertices without x, y, z");
+  }
+
+  bool hasNormal() const {
+    return normal[0] >= 0 && normal[1] >= 0 && normal[2] >= 0;
+  }
+
+  void store(const double *values, const int i, ImportedMesh& mesh) const {
+    for (int k = 0; k < 3; ++k) {
+      mesh.positions[i][k] = float(values[pos[k]]);
+    }
+    if (hasNormal()) {
+      const Cvec3f n(values[normal[0]], values[normal[1]], values[normal[2]]);
+      mesh.normals[i] = dot(n, n) > CS150_EPS2 ? normalize(n) : Cvec3f(0, 0, 1);
+    }
+    for (int k = 0; k < 2; ++k) {
+      mesh.texCoords[i][k] = tex[k] >= 0 ? float(values[tex[k]]) : 0;
+    }
+  }
+
+private:
+  static int find(const PlyElement& e, const char *name) {
+    for (size_t k = 0; k < e.props.size(); ++k) {
+      if (e.props[k].name == name)
+        return int(k);
+    }
+    return -1;
+  }
+};
+
+static int plyFaceIndexProperty(const PlyElement& e) {
+  for (size_t k = 0; k < e.props.size(); ++k) {
+    if (e.props[k].isList && (e.props[k].name == "vertex_indices" || e.props[k].name == "vertex_index"))
+      return int(k);
+  }
+  throw runtime_error("importPly: faces without vertex_indices");
+}
+
+// Fans the polygon idx[0..n) into triangles
+static void plyAddPolygon(const long long *idx, const int n, const long long numVertices, vector<unsigned int>& out) {
+  for (int k = 0; k < n; ++k) {
+    if (idx[k] < 0 || idx[k] >= numVertices)
+      throw runtime_error("importPly: index out of range");
+  }
+  for (int k = 2; k < n; ++k) {
+    out.push_back(idx[0]);
+    out.push_back(idx[k - 1]);
+    out.push_back(idx[k]);
+  }
+}
+
+void importPly(const char *filename, ImportedMesh& mesh, const int numThreads) {
+  MappedFile file(filename);
+  const char *p = file.begin(), *end = file.end();
+
+  vector<PlyElement> elements;
+  const PlyFormat format = plyParseHeader(p, end, elements);
+  const uint16_t one = 1;
+  const bool littleEndianHost = *reinterpret_cast<const char*>(&one) == 1;
+  const bool swap = format != PLY_ASCII && (format == PLY_BINARY_LE) != littleEndianHost;
+
+  mesh.positions.clear();
+  mesh.normals.clear();
+  mesh.texCoords.clear();
+  mesh.indices.clear();
+  bool gotVertices = false, hasNormals = false;
+  long long numVertices = 0;
+  vector<const char*> blocks;
+
+  for (size_t ei = 0; ei < elements.size(); ++ei) {
+    const PlyElement& e = elements[ei];
+
+    if (e.name == "vertex") {
+      if (e.count >= INT_MAX)
+        throw runtime_error("importPly: too many vertices");
+      const PlyVertexLayout layout(e);
+      const int n = int(e.count);
+      numVertices = n;
+      gotVertices = true;
+      hasNormals = layout.hasNormal();
+      mesh.positions.resize(n);
+      mesh.normals.resize(n);
+      mesh.texCoords.resize(n);
+
+      if (format == PLY_ASCII) {
+        const char *sectionEnd = plySplitLines(p, end, n, blocks);
+        parallelForRange(blocks.size() - 1, numThreads, [&](int begin, int blockEnd) {
+          vector<double> values(e.props.size());
+          for (int b = begin; b < blockEnd; ++b) {
+            int i = b * PLY_LINES_PER_BLOCK;
+            for (const char *s = blocks[b]; s < blocks[b + 1]; ++i) {
+              const char *eol = nextLine(s, blocks[b + 1]);
+              for (size_t k = 0; k < values.size(); ++k) {
+                float x = 0;
+                s = parseFloat(s, eol, x);
+                values[k] = x;
+              }
+              layout.store(&values[0], i, mesh);
+              s = eol;
+            }
+          }
+        }, 1);
+        p = sectionEnd;
+      }
+      else {
+        vector<int> offsets(e.props.size());
+        int stride = 0;
+        for (size_t k = 0; k < e.props.size(); ++k) {
+          offsets[k] = stride;
+          stride += plyTypeSize(e.props[k].type);
+        }
+        if (end - p < (long long)stride * n)
+          throw runtime_error("importPly: file ends early");
+        const char *data = p;
+        parallelForRange(n, numThreads, [&](int begin, int vEnd) {
+          vector<double> values(e.props.size());
+          for (int i = begin; i < vEnd; ++i) {
+            const char *v = data + (long long)stride * i;
+            for (size_t k = 0; k < values.size(); ++k) {
+              values[k] = plyRead(v + offsets[k], e.props[k].type, swap);
+            }
+            layout.store(&values[0], i, mesh);
+          }
+        });
+        p += (long long)stride * n;
+      }
+    }
+    else if (e.name == "face") {
+      if (!gotVertices)
+        throw runtime_error("importPly: faces before vertices");
+      const int indexProp = plyFaceIndexProperty(e);
+
+      if (format == PLY_ASCII) {
+        const char *sectionEnd = plySplitLines(p, end, e.count, blocks);
+        const int numBlocks = blocks.size() - 1;
+        vector<vector<unsigned int> > blockIndices(numBlocks);
+        parallelForRange(numBlocks, numThreads, [&](int begin, int blockEnd) {
+          vector<long long> idx;
+          for (int b = begin; b < blockEnd; ++b) {
+            for (const char *s = blocks[b]; s < blocks[b + 1];) {
+              const char *eol = nextLine(s, blocks[b + 1]);
+              for (size_t k = 0; k < e.props.size(); ++k) {
+                long long count = 1;
+                if (e.props[k].isList)
+                  s = parseInt(s, eol, count);
+                idx.resize(max(0LL, count));
+                for (long long j = 0; j < count; ++j) {
+                  // indices past 2^24 do not survive a float
+                  if (int(k) == indexProp) {
+                    idx[j] = 0;
+                    s = parseInt(s, eol, idx[j]);
+                  }
+                  else {
+                    float x = 0;
+                    s = parseFloat(s, eol, x);
+                  }
+                }
+                if (int(k) == indexProp)
+                  plyAddPolygon(idx.empty() ? 0 : &idx[0], int(count), numVertices, blockIndices[b]);
+              }
+              s = eol;
+            }
+          }
+        }, 1);
+        for (int b = 0; b < numBlocks; ++b) {
+          mesh.indices.insert(mesh.indices.end(), blockIndices[b].begin(), blockIndices[b].end());
+        }
+        p = sectionEnd;
+      }
+      else {
+        // faces have varying sizes, so they are read in order
+        vector<long long> idx;
+        for (long long f = 0; f < e.count; ++f) {
+          const int size = plyBinaryElementSize(e, p, end, swap);
+          const char *s = p;
+          for (size_t k = 0; k < e.props.size(); ++k) {
+            const PlyProperty& prop = e.props[k];
+            int count = 1;
+            if (prop.isList) {
+              count = plyListCount(prop, s, p + size, swap);
+              s += plyTypeSize(prop.countType);
+            }
+            if (int(k) == indexProp) {
+              idx.resize(count);
+              for (int j = 0; j < count; ++j) {
+                idx[j] = (long long)plyRead(s + j * plyTypeSize(prop.type), prop.type, swap);
+              }
+              plyAddPolygon(idx.empty() ? 0 : &idx[0], count, numVertices, mesh.indices);
+            }
+            s += count * plyTypeSize(prop.type);
+          }
+          p += size;
+        }
+      }
+    }
+    else {
+      // skip elements we do not use
+      if (format == PLY_ASCII)
+        p = plySplitLines(p, end, e.count, blocks);
+      else {
+        for (long long i = 0; i < e.count; ++i) {
+          p += plyBinaryElementSize(e, p, end, swap);
+        }
+      }
+    }
+  }
+
+  if (!gotVertices)
+    throw runtime_error(string("importPly: no vertices in ") + filename);
+  if (!hasNormals) {
+    vector<int> positionIndex(numVertices);
+    for (int i = 0; i < numVertices; ++i) {
+      positionIndex[i] = i;
+    }
+    computeMissingNormals(mesh.positions, positionIndex, mesh.indices, vector<char>(numVertices, 0), mesh.normals);
+  }
+}
+
+void importMesh(const char *filename, ImportedMesh& mesh, const int numThreads) {
+  string ext(filename);
+  const size_t dot = ext.rfind('.');
+  ext = dot == string::npos ? "" : ext.substr(dot + 1);
+  for (size_t i = 0; i < ext.size(); ++i) {
+    ext[i] = tolower(ext[i]);
+  }
+
+  if (ext == "obj")
+    importObj(filename, mesh, numThreads);
+  else if (ext == "ply")
+    importPly(filename, mesh, numThreads);
+  else
+    throw runtime_error(string("importMesh: unknown file type ") + filename);
+}
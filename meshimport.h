@@ -0,0 +1,50 @@
+#ifndef MESHIMPORT_H
+#define MESHIMPORT_H
+
+#include <vector>
+
+#include "cvec.h"
+#include "geometrymaker.h"
+
+//--------------------------------------------------------------------------------
+// Reading triangle meshes from Wavefront OBJ and PLY files
+//--------------------------------------------------------------------------------
+//
+// Files are memory mapped and split into pieces that are parsed on
+// numThreads threads (0 means one per core). Polygons are fanned into
+// triangles. Vertices without a normal in the file get the area-weighted
+// average of the normals of the faces around their position, and vertices
+// without texture coordinates get (0, 0).
+
+// A triangle list with one vertex per distinct position/normal/texture
+// coordinate combination of the file. The three vertex arrays have the
+// same length.
+struct ImportedMesh {
+  std::vector<Cvec3f> positions, normals;
+  std::vector<Cvec2f> texCoords;
+  std::vector<unsigned int> indices;
+};
+
+// Reads an OBJ file, merging the v/vt/vn triples of the faces into indexed
+// vertices with a hash table. Throws runtime_error on error.
+void importObj(const char *filename, ImportedMesh& mesh, const int numThreads = 0);
+
+// Reads an ASCII or binary (either byte order) PLY file with a vertex
+// element and a face element holding vertex_indices. Throws runtime_error on
+// error.
+void importPly(const char *filename, ImportedMesh& mesh, const int numThreads = 0);
+
+// Calls importObj or importPly depending on the file name's extension
+void importMesh(const char *filename, ImportedMesh& mesh, const int numThreads = 0);
+
+// Writes the vertices of mesh as any vertex type the make* functions accept,
+// e.g. VertexPNX
+template<typename Vertex>
+void getImportedVertices(const ImportedMesh& mesh, std::vector<Vertex>& vtx) {
+  vtx.resize(mesh.positions.size());
+  for (std::size_t i = 0; i < vtx.size(); ++i) {
+    putVertex(vtx.begin() + i, mesh.positions[i], mesh.normals[i], mesh.texCoords[i], Cvec3f(), Cvec3f());
+  }
+}
+
+#endif
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <cmath>
+
+#include "halfedge.h"
+#include "meshsimplify.h"
+
+using namespace std;
+
+// Weight of the boundary planes relative to the triangle planes
+static const double SIMPLIFY_BOUNDARY_WEIGHT = 10;
+
+// A collapse is refused if it turns a triangle's normal by more than about
+// 75 degrees
+static const double SIMPLIFY_MIN_NORMAL_COS = 0.25;
+
+// Sum of w * (dot(n, p) + d)^2 over weighted planes, as the upper triangle of
+// a symmetric 4x4 matrix, plus the sum of the weights
+struct Quadric {
+  double xx, xy, xz, xw, yy, yz, yw, zz, zw, ww;
+  double weight;
+
+  Quadric() : xx(0), xy(0), xz(0), xw(0), yy(0), yz(0), yw(0), zz(0), zw(0), ww(0), weight(0) {}
+
+  // The plane dot(n, p) + d = 0 with weight w
+  Quadric(const Cvec3& n, const double d, const double w)
+    : xx(w * n[0] * n[0]), xy(w * n[0] * n[1]), xz(w * n[0] * n[2]), xw(w * n[0] * d),
+      yy(w * n[1] * n[1]), yz(w * n[1] * n[2]), yw(w * n[1] * d),
+      zz(w * n[2] * n[2]), zw(w * n[2] * d), ww(w * d * d), weight(w) {}
+
+  Quadric& operator += (const Quadric& q) {
+    xx += q.xx; xy += q.xy; xz += q.xz; xw += q.xw;
+    yy += q.yy; yz += q.yz; yw += q.yw;
+    zz += q.zz; zw += q.zw; ww += q.ww;
+    weight += q.weight;
+    return *this;
+  }
+
+  Quadric operator + (const Quadric& q) const {
+    return Quadric(*this) += q;
+  }
+
+  // Weighted mean squared distance of p from the planes
+  double error(const Cvec3f& p) const {
+    const double x = p[0], y = p[1], z = p[2];
+    const double e = xx * x * x + yy * y * y + zz * z * z
+                     + 2 * (xy * x * y + xz * x * z + yz * y * z + xw * x + yw * y + zw * z) + ww;
+    return weight > 0 ? max(0.0, e) / weight : 0;
+  }
+};
+
+// Binary min-heap of vertices keyed by the cost of their cheapest collapse.
+// Keys change in place, so the heap never holds stale entries.
+class CollapseHeap {
+public:
+  explicit CollapseHeap(const int numVertices) : pos_(numVertices, -1), key_(numVertices) {}
+
+  bool empty() const {
+    return heap_.empty();
+  }
+
+  int top() const {
+    return heap_[0];
+  }
+
+  double key(const int v) const {
+    return key_[v];
+  }
+
+  // Inserts v or changes its key
+  void update(const int v, const double key) {
+    key_[v] = key;
+    if (pos_[v] < 0) {
+      pos_[v] = heap_.size();
+      heap_.push_back(v);
+    }
+    siftDown(siftUp(pos_[v]));
+  }
+
+  void remove(const int v) {
+    const int i = pos_[v];
+    if (i < 0)
+      return;
+    pos_[v] = -1;
+    const int last = heap_.back();
+    heap_.pop_back();
+    if (last != v) {
+      heap_[i] = last;
+      pos_[last] = i;
+      siftDown(siftUp(i));
+    }
+  }
+
+private:
+  std::vector<int> heap_, pos_;
+  std::vector<double> key_;
+
+  void place(const int i, const int v) {
+    heap_[i] = v;
+    pos_[v] = i;
+  }
+
+  int siftUp(int i) {
+    const int v = heap_[i];
+    while (i > 0 && key_[heap_[(i - 1) / 2]] > key_[v]) {
+      place(i, heap_[(i - 1) / 2]);
+      i = (i - 1) / 2;
+    }
+    place(i, v);
+    return i;
+  }
+
+  void siftDown(int i) {
+    const int v = heap_[i], n = heap_.size();
+    for (int c = 2 * i + 1; c < n; c = 2 * i + 1) {
+      if (c + 1 < n && key_[heap_[c + 1]] < key_[heap_[c]])
+        ++c;
+      if (key_[heap_[c]] >= key_[v])
+        break;
+      place(i, heap_[c]);
+      i = c;
+    }
+    place(i, v);
+  }
+};
+
+static inline Cvec3 toCvec3(const Cvec3f& v) {
+  return Cvec3(v[0], v[1], v[2]);
+}
+
+// Whether moving u onto v turns over, or nearly turns over, one of the
+// triangles around u that survive the collapse
+static bool collapseFlips(const HalfEdgeMesh& mesh, const Cvec3f *pos, const int u, const int v,
+                          vector<int>& ring) {
+  mesh.outgoingEdges(u, ring);
+  const Cvec3 pu = toCvec3(pos[u]), pv = toCvec3(pos[v]);
+  for (size_t i = 0; i < ring.size(); ++i) {
+    const int b = mesh.dest(ring[i]), c = mesh.dest(HalfEdgeMesh::next(ring[i]));
+    if (b == v || c == v)
+      continue;
+    const Cvec3 pb = toCvec3(pos[b]), pc = toCvec3(pos[c]);
+    const Cvec3 n0 = cross(pb - pu, pc - pu), n1 = cross(pb - pv, pc - pv);
+    if (dot(n0, n1) <= SIMPLIFY_MIN_NORMAL_COS * norm(n0) * norm(n1))
+      return true;
+  }
+  return false;
+}
+
+double simplifyMesh(const Cvec3f *pos, const int numVertices, const unsigned int *idx, const int ibLen,
+                    const int targetIbLen, const double maxError, vector<unsigned int>& out) {
+  HalfEdgeMesh mesh(idx, ibLen, numVertices);
+  const int numHalfEdges = 3 * mesh.numFaces();
+
+  // quadrics of the triangle planes and of planes along boundary edges
+  vector<Quadric> quadrics(numVertices);
+  int liveIbLen = 0;
+  for (int f = 0; f < mesh.numFaces(); ++f) {
+    if (mesh.faceRemoved(f))
+      continue;
+    liveIbLen += 3;
+
+    const int h = 3 * f;
+    const Cvec3 p0 = toCvec3(pos[mesh.origin(h)]), p1 = toCvec3(pos[mesh.origin(h + 1)]),
+                p2 = toCvec3(pos[mesh.origin(h + 2)]);
+    Cvec3 n = cross(p1 - p0, p2 - p0);
+    const double len = norm(n);
+    if (len < CS150_EPS2)
+      continue;
+    n /= len;
+    const Quadric q(n, -dot(n, p0), len * 0.5);
+    for (int k = 0; k < 3; ++k) {
+      quadrics[mesh.origin(h + k)] += q;
+    }
+
+    for (int k = h; k < h + 3; ++k) {
+      if (mesh.twin(k) >= 0)
+        continue;
+      const Cvec3 a = toCvec3(pos[mesh.origin(k)]), e = toCvec3(pos[mesh.dest(k)]) - a;
+      const Cvec3 side = cross(e, n);
+      if (dot(side, side) < CS150_EPS2)
+        continue;
+      const Quadric b(normalize(side), -dot(normalize(side), a), dot(e, e) * SIMPLIFY_BOUNDARY_WEIGHT);
+      quadrics[mesh.origin(k)] += b;
+      quadrics[mesh.dest(k)] += b;
+    }
+  }
+
+  // lock vertices on seams, found by sorting on position, and vertices
+  // where the half-edge walk does not reach all their triangles
+  vector<char> locked(numVertices, 0), boundary(numVertices, 0);
+  vector<int> order(numVertices), ring;
+  for (int i = 0; i < numVertices; ++i) {
+    order[i] = i;
+  }
+  sort(order.begin(), order.end(), [pos](const int a, const int b) {
+    for (int k = 0; k < 3; ++k) {
+      if (pos[a][k] != pos[b][k])
+        return pos[a][k] < pos[b][k];
+    }
+    return false;
+  });
+  for (int i = 1; i < numVertices; ++i) {
+    const Cvec3f &a = pos[order[i - 1]], &b = pos[order[i]];
+    if (a[0] == b[0] && a[1] == b[1] && a[2] == b[2])
+      locked[order[i - 1]] = locked[order[i]] = 1;
+  }
+  vector<int> corners(numVertices, 0);
+  for (int h = 0; h < numHalfEdges; ++h) {
+    if (!mesh.faceRemoved(HalfEdgeMesh::face(h)))
+      ++corners[mesh.origin(h)];
+  }
+  for (int v = 0; v < numVertices; ++v) {
+    boundary[v] = mesh.outgoingEdges(v, ring);
+    if (int(ring.size()) != corners[v])
+      locked[v] = 1;
+  }
+
+  // each vertex is queued with its cheapest allowed move onto a neighbour
+  CollapseHeap heap(numVertices);
+  vector<int> target(numVertices, -1), neighbours;
+  const double maxCost = maxError * maxError;
+  auto findTarget = [&](const int u) {
+    target[u] = -1;
+    double best = maxCost;
+    if (!locked[u]) {
+      // a boundary vertex may only slide along the boundary
+      mesh.outgoingEdges(u, neighbours);
+      for (size_t i = 0; i < neighbours.size(); ++i) {
+        const int h = neighbours[i], p = HalfEdgeMesh::prev(h);
+        for (int k = 0; k < 2; ++k) {
+          const int x = k ? mesh.origin(p) : mesh.dest(h);
+          if (boundary[u] && mesh.twin(k ? p : h) >= 0)
+            continue;
+          const double cost = (quadrics[u] + quadrics[x]).error(pos[x]);
+          if (cost <= best) {
+            best = cost;
+            target[u] = x;
+          }
+        }
+      }
+    }
+    if (target[u] >= 0)
+      heap.update(u, best);
+    else
+      heap.remove(u);
+  };
+
+  // A vertex whose move is refused for topology or flips leaves the heap
+  // until a neighbour changes, so run passes until one makes no progress
+  double worst = 0;
+  for (bool progress = true; progress && liveIbLen > targetIbLen;) {
+    progress = false;
+    for (int v = 0; v < numVertices; ++v) {
+      findTarget(v);
+    }
+
+    while (liveIbLen > targetIbLen && !heap.empty()) {
+      const int u = heap.top(), v = target[u];
+      const double cost = heap.key(u);
+      heap.remove(u);
+      target[u] = -1;
+      int h = mesh.findEdge(u, v);
+      if (h < 0)
+        h = mesh.findEdge(v, u);
+      if (h < 0 || !mesh.canCollapse(h) || collapseFlips(mesh, pos, u, v, ring))
+        continue;
+
+      liveIbLen -= 3 * mesh.collapse(h, u);
+      quadrics[v] += quadrics[u];
+      worst = max(worst, cost);
+      progress = true;
+
+      // Neighbours that were headed for u or v, or had nowhere to go, look
+      // again; for the others only the move onto v has a new cost
+      findTarget(v);
+      mesh.outgoingEdges(v, ring);
+      for (size_t i = 0; i < ring.size(); ++i) {
+        const int p = HalfEdgeMesh::prev(ring[i]);
+        for (int k = 0; k < 2; ++k) {
+          if (k && mesh.twin(p) >= 0)
+            continue; // only an open fan has a neighbour not reached through dest
+          const int x = k ? mesh.origin(p) : mesh.dest(ring[i]);
+          if (target[x] < 0 || target[x] == u || target[x] == v)
+            findTarget(x);
+          else if (!boundary[x] || mesh.twin(k ? p : ring[i]) < 0) {
+            const double c = (quadrics[x] + quadrics[v]).error(pos[v]);
+            if (c < heap.key(x)) {
+              target[x] = v;
+              heap.update(x, c);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  mesh.getIndices(out);
+  return sqrt(worst);
+}
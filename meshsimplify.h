@@ -0,0 +1,32 @@
+#ifndef MESHSIMPLIFY_H
+#define MESHSIMPLIFY_H
+
+#include <vector>
+
+#include "cvec.h"
+
+//--------------------------------------------------------------------------------
+// Mesh simplification by quadric error edge collapses (Garland and Heckbert)
+//--------------------------------------------------------------------------------
+//
+// Every vertex gets the quadric of the planes of its triangles, weighted by
+// area, plus planes standing on its boundary edges so open borders keep their
+// shape. Edges are collapsed cheapest first, one end into the other, on a
+// HalfEdgeMesh, so the result uses a subset of the original vertices along
+// with their normals and texture coordinates. Each vertex is queued once, keyed
+// by its cheapest move, and only the neighbours of a collapse are re-costed.
+//
+// Vertices sharing their position with another vertex (seams where normals or
+// texture coordinates are split) and vertices where several fans meet are
+// never moved, so the mesh cannot tear open along them.
+
+// Simplifies the triangle list idx[0..ibLen) over positions pos[0..numVertices)
+// until at most targetIbLen indices are left or every remaining collapse
+// would cost more than maxError. Writes the triangles that are left to out
+// and returns the error of the result, the largest RMS distance between a
+// kept vertex and the planes of the triangles it replaced (0 if nothing was
+// collapsed).
+double simplifyMesh(const Cvec3f *pos, const int numVertices, const unsigned int *idx, const int ibLen,
+                    const int targetIbLen, const double maxError, std::vector<unsigned int>& out);
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef MESHTOOLS_H
+#define MESHTOOLS_H
+
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+//--------------------------------------------------------------------------------
+// Helpers for processing indexed triangle meshes, e.g. the output of the
+// make* functions, before they are uploaded
+//--------------------------------------------------------------------------------
+
+// Largest number of vertices that unsigned short indices can address
+static const int CS150_MAX_SHORT_INDEXED_VERTICES = 65536;
+
+// A piece of a larger mesh that references few enough vertices to use
+// 16-bit indices
+template<typename Vertex>
+struct MeshChunk {
+  std::vector<Vertex> vtx;
+  std::vector<unsigned short> idx;
+};
+
+// Splits the triangle list idx[0..ibLen) over vtx[0..vbLen) into chunks that
+// each reference at most maxVertices vertices, keeping the triangle order.
+// Vertices used by triangles of more than one chunk are duplicated into each.
+template<typename Vertex, typename Index>
+void splitIntoChunks(const Vertex *vtx, const int vbLen, const Index *idx, const int ibLen,
+                     const int maxVertices, std::vector<MeshChunk<Vertex> >& chunks) {
+  assert(ibLen % 3 == 0);
+  assert(maxVertices >= 3 && maxVertices <= CS150_MAX_SHORT_INDEXED_VERTICES);
+
+  // owner[v] is the last chunk v was copied into and local[v] its index there
+  std::vector<int> owner(vbLen, -1), local(vbLen);
+
+  chunks.clear();
+  for (int t = 0; t < ibLen; t += 3) {
+    if (chunks.empty()) {
+      chunks.push_back(MeshChunk<Vertex>());
+    }
+
+    int cur = int(chunks.size()) - 1;
+    int fresh = 0;
+    for (int k = 0; k < 3; ++k) {
+      fresh += owner[idx[t + k]] != cur;
+    }
+    if (int(chunks[cur].vtx.size()) + fresh > maxVertices) {
+      chunks.push_back(MeshChunk<Vertex>());
+      ++cur;
+    }
+
+    MeshChunk<Vertex>& c = chunks[cur];
+    for (int k = 0; k < 3; ++k) {
+      const int v = idx[t + k];
+      assert(v >= 0 && v < vbLen);
+      if (owner[v] != cur) {
+        owner[v] = cur;
+        local[v] = int(c.vtx.size());
+        c.vtx.push_back(vtx[v]);
+      }
+      c.idx.push_back((unsigned short)local[v]);
+    }
+  }
+}
+
+// Like splitIntoChunks, for triangle strips separated by restartIndex. Whole
+// strips go to the chunks, which use 0xFFFF as their restart index and so
+// hold at most maxVertices < 65536 vertices. Returns false, leaving chunks
+// empty, if a single strip uses more than maxVertices vertices.
+template<typename Vertex, typename Index>
+bool splitStripsIntoChunks(const Vertex *vtx, const int vbLen, const Index *idx, const int ibLen,
+                           const Index restartIndex, const int maxVertices,
+                           std::vector<MeshChunk<Vertex> >& chunks) {
+  assert(maxVertices >= 3 && maxVertices < CS150_MAX_SHORT_INDEXED_VERTICES);
+
+  std::vector<int> owner(vbLen, -1), local(vbLen);
+
+  chunks.clear();
+  for (int begin = 0; begin < ibLen;) {
+    int end = begin;
+    while (end < ibLen && idx[end] != restartIndex)
+      ++end;
+
+    if (chunks.empty())
+      chunks.push_back(MeshChunk<Vertex>());
+
+    // count the strip's vertices not yet in the current chunk; a vertex seen
+    // twice in the strip is marked with owner -2 - cur so it counts once
+    int cur = int(chunks.size()) - 1;
+    int fresh = 0;
+    for (int i = begin; i < end; ++i) {
+      const int v = idx[i];
+      assert(v >= 0 && v < vbLen);
+      if (owner[v] != cur && owner[v] != -2 - cur) {
+        owner[v] = -2 - cur;
+        ++fresh;
+      }
+    }
+    for (int i = begin; i < end; ++i) {
+      if (owner[idx[i]] == -2 - cur)
+        owner[idx[i]] = -1;
+    }
+    if (fresh > maxVertices) {
+      chunks.clear();
+      return false;
+    }
+    if (int(chunks[cur].vtx.size()) + fresh > maxVertices) {
+      chunks.push_back(MeshChunk<Vertex>());
+      ++cur;
+    }
+
+    MeshChunk<Vertex>& c = chunks[cur];
+    if (!c.idx.empty())
+      c.idx.push_back(0xFFFF);
+    for (int i = begin; i < end; ++i) {
+      const int v = idx[i];
+      if (owner[v] != cur) {
+        owner[v] = cur;
+        local[v] = int(c.vtx.size());
+        c.vtx.push_back(vtx[v]);
+      }
+      c.idx.push_back((unsigned short)local[v]);
+    }
+    begin = end + 1;
+  }
+  return true;
+}
+
+// Number of entries of the FIFO post-transform vertex cache that
+// measureVertexCache simulates and optimizeVertexCache optimizes for
+static const int CS150_VERTEX_CACHE_SIZE = 16;
+
+// How well an index order uses the post-transform vertex cache
+struct VertexCacheStats {
+  double acmr; // cache misses per triangle, at best about 0.5 for big grids
+  double atvr; // cache misses per referenced vertex, at best 1
+};
+
+// Counts the vertex shader runs of a FIFO cache of cacheSize entries drawing
+// the triangle list idx[0..ibLen)
+template<typename Index>
+VertexCacheStats measureVertexCache(const Index *idx, const int ibLen, const int vbLen,
+                                    const int cacheSize = CS150_VERTEX_CACHE_SIZE) {
+  // v is cached while fewer than cacheSize misses happened since its own
+  std::vector<int> missedAt(vbLen, -cacheSize - 1);
+  int misses = 0, referenced = 0;
+  for (int i = 0; i < ibLen; ++i) {
+    const int v = idx[i];
+    assert(v >= 0 && v < vbLen);
+    if (misses - missedAt[v] >= cacheSize) {
+      referenced += missedAt[v] < -cacheSize;
+      missedAt[v] = misses++;
+    }
+  }
+
+  VertexCacheStats stats;
+  stats.acmr = ibLen ? misses / (ibLen / 3.0) : 0;
+  stats.atvr = referenced ? misses / double(referenced) : 0;
+  return stats;
+}
+
+// Score of a vertex in Forsyth's "Linear-speed vertex cache optimisation":
+// recently used vertices and vertices with few triangles left score high
+inline float vertexCacheScore(const int cachePos, const int remaining, const int cacheSize) {
+  if (remaining == 0)
+    return -1;
+
+  float score = 0;
+  if (cachePos >= 0) {
+    // the vertices of the last triangle get a fixed score so the next one
+    // does not simply reuse its edge and produce strips
+    if (cachePos < 3)
+      score = 0.75f;
+    else
+      score = std::pow(1 - float(cachePos - 3) / (cacheSize - 3), 1.5f);
+  }
+  return score + 2 / std::sqrt(float(remaining));
+}
+
+// Reorders the triangles of idx[0..ibLen) in place so that consecutive
+// triangles share vertices while they are still in a cache of cacheSize
+// entries. Each step emits the best scoring triangle next to the cached
+// vertices, falling back to the first triangle left when there is none.
+template<typename Index>
+void optimizeVertexCache(Index *idx, const int ibLen, const int vbLen,
+                         const int cacheSize = CS150_VERTEX_CACHE_SIZE) {
+  assert(ibLen % 3 == 0);
+  assert(cacheSize > 3);
+  const int numTris = ibLen / 3;
+
+  // triangles not yet emitted that use vertex v are
+  // tris[first[v] .. first[v] + remaining[v])
+  std::vector<int> first(vbLen + 1, 0), remaining(vbLen, 0), tris(ibLen);
+  for (int i = 0; i < ibLen; ++i) {
+    assert(idx[i] >= 0 && int(idx[i]) < vbLen);
+    ++remaining[idx[i]];
+  }
+  for (int v = 0; v < vbLen; ++v) {
+    first[v + 1] = first[v] + remaining[v];
+    remaining[v] = 0;
+  }
+  for (int i = 0; i < ibLen; ++i) {
+    tris[first[idx[i]] + remaining[idx[i]]++] = i / 3;
+  }
+
+  std::vector<int> cachePos(vbLen, -1);
+  std::vector<float> score(vbLen);
+  for (int v = 0; v < vbLen; ++v) {
+    score[v] = vertexCacheScore(-1, remaining[v], cacheSize);
+  }
+
+  std::vector<char> emitted(numTris, 0);
+  std::vector<int> cache, newCache;
+  std::vector<Index> out;
+  out.reserve(ibLen);
+
+  int best = -1, nextUnused = 0;
+  for (int n = 0; n < numTris; ++n) {
+    if (best < 0) {
+      while (emitted[nextUnused])
+        ++nextUnused;
+      best = nextUnused;
+    }
+
+    emitted[best] = 1;
+    newCache.clear();
+    for (int k = 0; k < 3; ++k) {
+      const int v = idx[3 * best + k];
+      out.push_back(Index(v));
+
+      // drop best from the triangles of v
+      int *t = &tris[first[v]];
+      int j = 0;
+      while (t[j] != best)
+        ++j;
+      t[j] = t[--remaining[v]];
+
+      if (cachePos[v] != -2) {
+        cachePos[v] = -2; // marks v as already in newCache
+        newCache.push_back(v);
+      }
+    }
+    for (size_t i = 0; i < cache.size(); ++i) {
+      if (cachePos[cache[i]] != -2)
+        newCache.push_back(cache[i]);
+    }
+
+    // vertices pushed past the end of the cache are evicted
+    for (size_t i = 0; i < newCache.size(); ++i) {
+      const int v = newCache[i];
+      cachePos[v] = int(i) < cacheSize ? int(i) : -1;
+      score[v] = vertexCacheScore(cachePos[v], remaining[v], cacheSize);
+    }
+    if (int(newCache.size()) > cacheSize)
+      newCache.resize(cacheSize);
+    cache.swap(newCache);
+
+    // the next triangle is the best one using a cached vertex
+    best = -1;
+    float bestScore = -1;
+    for (size_t i = 0; i < cache.size(); ++i) {
+      const int v = cache[i];
+      for (int j = 0; j < remaining[v]; ++j) {
+        const int t = tris[first[v] + j];
+        const float s = score[idx[3 * t]] + score[idx[3 * t + 1]] + score[idx[3 * t + 2]];
+        if (s > bestScore) {
+          bestScore = s;
+          best = t;
+        }
+      }
+    }
+  }
+
+  std::copy(out.begin(), out.end(), idx);
+}
+
+// Renumbers the vertices in the order idx first uses them, moving them in
+// vtx to match, so vertex fetches walk the buffer front to back. Vertices no
+// triangle uses are dropped; returns the number of vertices left.
+template<typename Vertex, typename Index>
+int optimizeVertexFetch(Vertex *vtx, const int vbLen, Index *idx, const int ibLen) {
+  const std::vector<Vertex> old(vtx, vtx + vbLen);
+  std::vector<int> remap(vbLen, -1);
+  int next = 0;
+  for (int i = 0; i < ibLen; ++i) {
+    const int v = idx[i];
+    assert(v >= 0 && v < vbLen);
+    if (remap[v] < 0) {
+      remap[v] = next;
+      vtx[next++] = old[v];
+    }
+    idx[i] = Index(remap[v]);
+  }
+  return next;
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef MODELVIEW_H
+#define MODELVIEW_H
+
+#include <cmath>
+
+#include "matrix4.h"
+#include "transformbatch.h"
+
+//--------------------------------------------------------------------------------
+// Batched model-view and normal matrices, ready to upload
+//--------------------------------------------------------------------------------
+
+// What the linear part of an affine transform is, which decides how much
+// work its normal matrix takes
+enum TransformClass {
+  TRANSFORM_RIGID,         // rotation only: the normal matrix is the matrix itself
+  TRANSFORM_UNIFORM_SCALE, // rotation times s: the normal matrix is the matrix / s^2
+  TRANSFORM_GENERAL        // anything else: needs the inverse transpose
+};
+
+// Classifies the upper 3x3 of an affine matrix by the dot products of its
+// columns. If the class is TRANSFORM_UNIFORM_SCALE or TRANSFORM_RIGID and
+// scale2 is given, it receives the squared scale factor.
+inline TransformClass classifyTransform(const Matrix4& m, double *scale2 = 0) {
+  static const double tol = 1e-6;
+  double g[3][3];
+  for (int i = 0; i < 3; ++i) {
+    for (int j = i; j < 3; ++j) {
+      g[i][j] = m(0,i)*m(0,j) + m(1,i)*m(1,j) + m(2,i)*m(2,j);
+    }
+  }
+  const double s2 = g[0][0];
+  if (s2 < CS150_EPS2 ||
+      std::abs(g[0][1]) + std::abs(g[0][2]) + std::abs(g[1][2]) > tol * s2 ||
+      std::abs(g[1][1] - s2) + std::abs(g[2][2] - s2) > tol * s2)
+    return TRANSFORM_GENERAL;
+
+  if (scale2)
+    *scale2 = s2;
+  return std::abs(s2 - 1) < tol ? TRANSFORM_RIGID : TRANSFORM_UNIFORM_SCALE;
+}
+
+// Computes MVM = invEyeRbt * models[i] and its normal matrix for objects
+// begin..end-1, writing both into column-major float arrays of 16 entries per
+// object. The product is built once per object in a Matrix4 on the stack, and
+// the normal matrix is read from it with no separate transpose and no inverse
+// unless the transform has a non-uniform scale or shear. If indices is given,
+// object o is models[indices[o]].
+inline void computeModelViewNormalRange(const Matrix4& invEyeRbt, const Matrix4 models[],
+                                        float mvmOut[], float nmvmOut[], TransformClass classOut[],
+                                        const int begin, const int end, const int indices[] = 0) {
+  for (int o = begin; o < end; ++o) {
+    const Matrix4& m = models[indices ? indices[o] : o];
+    float *mvm = mvmOut + 16 * o;
+    float *nm = nmvmOut + 16 * o;
+
+    // rows 0..2 of the product; row 3 stays [0,0,0,1] for affine inputs
+    Matrix4 p;
+    for (int i = 0; i < 3; ++i) {
+      for (int k = 0; k < 4; ++k) {
+        p(i,k) = invEyeRbt(i,0) * m(0,k) + invEyeRbt(i,1) * m(1,k) + invEyeRbt(i,2) * m(2,k);
+      }
+      p(i,3) += invEyeRbt(i,3);
+    }
+    for (int i = 0; i < 4; ++i) {
+      for (int k = 0; k < 4; ++k) {
+        mvm[(k << 2) + i] = float(p(i,k));
+      }
+    }
+
+    double s2 = 1;
+    const TransformClass tc = classifyTransform(p, &s2);
+    if (classOut)
+      classOut[o] = tc;
+
+    if (tc == TRANSFORM_GENERAL) {
+      // inverse transpose of the linear part is its cofactor matrix / det
+      double c[3][3];
+      for (int i = 0; i < 3; ++i) {
+        const int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+        for (int j = 0; j < 3; ++j) {
+          const int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+          c[i][j] = p(i1,j1) * p(i2,j2) - p(i1,j2) * p(i2,j1);
+        }
+      }
+      const double det = p(0,0) * c[0][0] + p(0,1) * c[0][1] + p(0,2) * c[0][2];
+      assert(std::abs(det) > CS150_EPS3);
+      const double invDet = 1 / det;
+      for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+          nm[(j << 2) + i] = float(c[i][j] * invDet);
+        }
+      }
+    }
+    else {
+      const double invS2 = 1 / s2;
+      for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+          nm[(j << 2) + i] = float(p(i,j) * invS2);
+        }
+      }
+    }
+    nm[3] = nm[7] = nm[11] = nm[12] = nm[13] = nm[14] = 0;
+    nm[15] = 1;
+  }
+}
+
+// Fills mvmOut and nmvmOut (16 floats per object each) for n objects, and the
+// class of each transform if classOut is given. numThreads is as in
+// transformbatch.h, and indices as in computeModelViewNormalRange.
+inline void computeModelViewNormalMatrices(const Matrix4& invEyeRbt, const Matrix4 models[], const int n,
+                                           float mvmOut[], float nmvmOut[], TransformClass classOut[] = 0,
+                                           const int numThreads = 1, const int indices[] = 0) {
+  parallelForRange(n, numThreads, [&](int begin, int end) {
+    computeModelViewNormalRange(invEyeRbt, models, mvmOut, nmvmOut, classOut, begin, end, indices);
+  });
+}
+
+#endif
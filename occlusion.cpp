@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "occlusion.h"
+#include "parallel.h"
+
+// the edge functions step in 32-bit integer lanes
+#if defined(CS150_SSE) && (defined(__SSE2__) || defined(_M_X64))
+#   include <emmintrin.h>
+#   define OCCLUSION_SSE2 1
+#endif
+
+using namespace std;
+
+OcclusionBuffer::OcclusionBuffer(const int width, const int height) {
+  assert(width >= 4 && width <= OCCLUSION_MAX_SIZE && (width & (width - 1)) == 0);
+  assert(height >= OCCLUSION_BAND_HEIGHT && height <= OCCLUSION_MAX_SIZE && (height & (height - 1)) == 0);
+  for (int w = width, h = height;; w /= 2, h /= 2) {
+    const Level l = {w, h, vector<float>(w * h, -1)};
+    levels_.push_back(l);
+    if (w == 1 || h == 1)
+      break;
+  }
+}
+
+void OcclusionBuffer::clear() {
+  fill(levels_[0].depth.begin(), levels_[0].depth.end(), -1.0f);
+  triangles_.clear();
+}
+
+// Clips poly[0..n) to the side of a plane where dist is non-negative, into
+// out. New vertices are always interpolated from the vertex inside to the
+// one outside, so an edge shared by two triangles is cut at the same point
+// in both.
+template<typename Dist>
+int OcclusionBuffer::clipPolygon(const ClipVertex *poly, const int n, ClipVertex *out, Dist dist) {
+  int m = 0;
+  for (int k = 0; k < n; ++k) {
+    const ClipVertex &a = poly[k], &b = poly[(k + 1) % n];
+    const float da = dist(a), db = dist(b);
+    if (da >= 0)
+      out[m++] = a;
+    if ((da >= 0) != (db >= 0)) {
+      const ClipVertex &in = da >= 0 ? a : b, &o = da >= 0 ? b : a;
+      const float di = da >= 0 ? da : db, dout = da >= 0 ? db : da;
+      const float t = di / (di - dout);
+      const ClipVertex c = {in.x + t * (o.x - in.x), in.y + t * (o.y - in.y),
+                           in.z + t * (o.z - in.z), in.w + t * (o.w - in.w)};
+      out[m++] = c;
+    }
+  }
+  return m;
+}
+
+void OcclusionBuffer::addOccluder(const Matrix4& modelViewProj, const Cvec3f *vtx, const int numVertices,
+                                  const int *idx, const int numIndices) {
+  const Matrix4& m = modelViewProj;
+  clipped_.resize(numVertices);
+  for (int i = 0; i < numVertices; ++i) {
+    const Cvec3f& p = vtx[i];
+    ClipVertex& c = clipped_[i];
+    c.x = float(m(0,0) * p[0] + m(0,1) * p[1] + m(0,2) * p[2] + m(0,3));
+    c.y = float(m(1,0) * p[0] + m(1,1) * p[1] + m(1,2) * p[2] + m(1,3));
+    c.z = float(m(2,0) * p[0] + m(2,1) * p[1] + m(2,2) * p[2] + m(2,3));
+    c.w = float(m(3,0) * p[0] + m(3,1) * p[1] + m(3,2) * p[2] + m(3,3));
+  }
+
+  const float g = OCCLUSION_GUARD_BAND;
+  for (int i = 0; i + 2 < numIndices; i += 3) {
+    // cut off what is in front of the near plane z = w, which also cuts off
+    // everything behind the eye, then what is outside the guard band
+    ClipVertex poly[8], tmp[8];
+    const ClipVertex v[3] = {clipped_[idx[i]], clipped_[idx[i + 1]], clipped_[idx[i + 2]]};
+    int n = clipPolygon(v, 3, poly, [](const ClipVertex& c) { return c.w - c.z; });
+    n = clipPolygon(poly, n, tmp, [g](const ClipVertex& c) { return g * c.w - c.x; });
+    n = clipPolygon(tmp, n, poly, [g](const ClipVertex& c) { return g * c.w + c.x; });
+    n = clipPolygon(poly, n, tmp, [g](const ClipVertex& c) { return g * c.w - c.y; });
+    n = clipPolygon(tmp, n, poly, [g](const ClipVertex& c) { return g * c.w + c.y; });
+    for (int k = 2; k < n; ++k) {
+      addTriangle(poly[0], poly[k - 1], poly[k]);
+    }
+  }
+}
+
+// floor(a / b) for b > 0
+static long long floorDiv(const long long a, const long long b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+void OcclusionBuffer::addTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c) {
+  const int width = levels_[0].width, height = levels_[0].height;
+  const int S = 1 << OCCLUSION_SUBTEXEL_BITS;
+  const float g = OCCLUSION_GUARD_BAND;
+  const ClipVertex *v[3] = {&a, &b, &c};
+
+  // snapped to 1/S texel, clamped in case rounding left the guard band
+  long long x[3], y[3];
+  float d[3];
+  for (int k = 0; k < 3; ++k) {
+    const float nx = max(-g, min(g, v[k]->x / v[k]->w)), ny = max(-g, min(g, v[k]->y / v[k]->w));
+    x[k] = (long long)floor((nx + 1) * 0.5f * width * S + 0.5f);
+    y[k] = (long long)floor((ny + 1) * 0.5f * height * S + 0.5f);
+    d[k] = v[k]->z / v[k]->w;
+  }
+
+  // either side of a triangle hides what is behind it, so make it counter
+  // clockwise
+  long long area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+  if (area == 0)
+    return;
+  if (area < 0) {
+    swap(x[1], x[2]);
+    swap(y[1], y[2]);
+    swap(d[1], d[2]);
+    area = -area;
+  }
+
+  // texel px covers the sample (px * S + S / 2) / S
+  const long long minX = min(min(x[0], x[1]), x[2]), maxX = max(max(x[0], x[1]), x[2]);
+  const long long minY = min(min(y[0], y[1]), y[2]), maxY = max(max(y[0], y[1]), y[2]);
+  Triangle t;
+  t.x0 = int(max(0LL, -floorDiv(S / 2 - minX, S)));
+  t.x1 = int(min((long long)width - 1, floorDiv(maxX - S / 2, S)));
+  t.y0 = int(max(0LL, -floorDiv(S / 2 - minY, S)));
+  t.y1 = int(min((long long)height - 1, floorDiv(maxY - S / 2, S)));
+  if (t.x0 > t.x1 || t.y0 > t.y1)
+    return;
+
+  // Edge k runs from vertex k to the next. At the sample of texel (px, py)
+  // it is E = S * (A * px + B * py) + K, exact in integers, and the sample
+  // is inside if E >= 0 on top and left edges and E > 0 on the others, so
+  // of two triangles sharing an edge exactly one covers a sample on it.
+  // Being inside is then A * px + B * py + floor((K - bias) / S) >= 0,
+  // which the guard band keeps in 32 bits.
+  double depthA = 0, depthB = 0, depthC = 0;
+  for (int k = 0; k < 3; ++k) {
+    const int j = (k + 1) % 3, o = (k + 2) % 3;
+    const long long dx = x[j] - x[k], dy = y[j] - y[k];
+    const bool topLeft = dy < 0 || (dy == 0 && dx < 0);
+    const long long K = dx * (S / 2 - y[k]) - dy * (S / 2 - x[k]);
+    t.edgeA[k] = int(-dy);
+    t.edgeB[k] = int(dx);
+    t.edgeC[k] = int(floorDiv(K - (topLeft ? 0 : 1), S));
+
+    // the edge function is the barycentric coordinate of the vertex
+    // opposite, times twice the area
+    depthA += double(-dy) * S * d[o];
+    depthB += double(dx) * S * d[o];
+    depthC += double(K) * d[o];
+  }
+  t.depthA = float(depthA / area);
+  t.depthB = float(depthB / area);
+  t.depthC = float(depthC / area);
+  triangles_.push_back(t);
+}
+
+void OcclusionBuffer::rasterize(const int numThreads) {
+  parallelForRange(levels_[0].height, numThreads, [this](const int begin, const int end) {
+    rasterizeRows(begin, end);
+  }, OCCLUSION_BAND_HEIGHT);
+
+  for (size_t k = 1; k < levels_.size(); ++k) {
+    const Level& s = levels_[k - 1];
+    Level& l = levels_[k];
+    for (int y = 0; y < l.height; ++y) {
+      const float *r0 = &s.depth[2 * y * s.width], *r1 = r0 + s.width;
+      for (int x = 0; x < l.width; ++x) {
+        l.depth[y * l.width + x] = min(min(r0[2 * x], r0[2 * x + 1]), min(r1[2 * x], r1[2 * x + 1]));
+      }
+    }
+  }
+}
+
+void OcclusionBuffer::rasterizeRows(const int y0, const int y1) {
+  Level& l = levels_[0];
+  for (size_t i = 0; i < triangles_.size(); ++i) {
+    const Triangle& t = triangles_[i];
+    const int ty0 = max(t.y0, y0), ty1 = min(t.y1, y1 - 1);
+#ifdef OCCLUSION_SSE2
+    const __m128 offsets = _mm_setr_ps(0, 1, 2, 3), da = _mm_set1_ps(t.depthA);
+    __m128i edgeOffsets[3], edgeSteps[3];
+    for (int k = 0; k < 3; ++k) {
+      edgeOffsets[k] = _mm_setr_epi32(0, t.edgeA[k], 2 * t.edgeA[k], 3 * t.edgeA[k]);
+      edgeSteps[k] = _mm_set1_epi32(4 * t.edgeA[k]);
+    }
+#endif
+    for (int y = ty0; y <= ty1; ++y) {
+      float *row = &l.depth[y * l.width];
+      const int e0 = t.edgeB[0] * y + t.edgeC[0], e1 = t.edgeB[1] * y + t.edgeC[1], e2 = t.edgeB[2] * y + t.edgeC[2];
+      const float d = t.depthB * y + t.depthC;
+      int x = t.x0;
+#ifdef OCCLUSION_SSE2
+      // whole groups of four, which the width is a multiple of
+      x &= ~3;
+      __m128i ve0 = _mm_add_epi32(_mm_set1_epi32(t.edgeA[0] * x + e0), edgeOffsets[0]);
+      __m128i ve1 = _mm_add_epi32(_mm_set1_epi32(t.edgeA[1] * x + e1), edgeOffsets[1]);
+      __m128i ve2 = _mm_add_epi32(_mm_set1_epi32(t.edgeA[2] * x + e2), edgeOffsets[2]);
+      const __m128 vd = _mm_set1_ps(d);
+      for (; x <= t.x1; x += 4) {
+        // inside where no edge function has its sign bit set
+        const __m128i outside = _mm_srai_epi32(_mm_or_si128(_mm_or_si128(ve0, ve1), ve2), 31);
+        const __m128 inside = _mm_castsi128_ps(_mm_xor_si128(outside, _mm_set1_epi32(-1)));
+        const __m128 depth = _mm_add_ps(_mm_mul_ps(da, _mm_add_ps(_mm_set1_ps(float(x)), offsets)), vd);
+        const __m128 old = _mm_loadu_ps(row + x);
+        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, _mm_max_ps(old, depth)), _mm_andnot_ps(inside, old)));
+        ve0 = _mm_add_epi32(ve0, edgeSteps[0]);
+        ve1 = _mm_add_epi32(ve1, edgeSteps[1]);
+        ve2 = _mm_add_epi32(ve2, edgeSteps[2]);
+      }
+#endif
+      for (; x <= t.x1; ++x) {
+        if (((t.edgeA[0] * x + e0) | (t.edgeA[1] * x + e1) | (t.edgeA[2] * x + e2)) >= 0)
+          row[x] = max(row[x], t.depthA * x + d);
+      }
+    }
+  }
+}
+
+bool OcclusionBuffer::isVisible(const Matrix4& viewProj, const BoundingBox& box) const {
+  const Matrix4& m = viewProj;
+  double minX = 1, maxX = -1, minY = 1, maxY = -1, nearest = -1;
+  for (int k = 0; k < 8; ++k) {
+    double p[3];
+    for (int i = 0; i < 3; ++i) {
+      p[i] = box.center[i] + (k >> i & 1 ? box.extent[i] : -box.extent[i]);
+    }
+    const double x = m(0,0) * p[0] + m(0,1) * p[1] + m(0,2) * p[2] + m(0,3);
+    const double y = m(1,0) * p[0] + m(1,1) * p[1] + m(1,2) * p[2] + m(1,3);
+    const double z = m(2,0) * p[0] + m(2,1) * p[1] + m(2,2) * p[2] + m(2,3);
+    const double w = m(3,0) * p[0] + m(3,1) * p[1] + m(3,2) * p[2] + m(3,3);
+    if (z > w)
+      return true; // in front of the near plane or behind the eye
+    minX = min(minX, x / w);
+    maxX = max(maxX, x / w);
+    minY = min(minY, y / w);
+    maxY = max(maxY, y / w);
+    nearest = max(nearest, z / w);
+  }
+
+  // the texels under the box, and one more on each side
+  const Level& l0 = levels_[0];
+  const int x0 = max(0, int(floor((max(minX, -1.0) + 1) * 0.5 * l0.width)) - 1);
+  const int x1 = min(l0.width - 1, int(floor((min(maxX, 1.0) + 1) * 0.5 * l0.width)) + 1);
+  const int y0 = max(0, int(floor((max(minY, -1.0) + 1) * 0.5 * l0.height)) - 1);
+  const int y1 = min(l0.height - 1, int(floor((min(maxY, 1.0) + 1) * 0.5 * l0.height)) + 1);
+  if (x0 > x1 || y0 > y1)
+    return true; // off screen, which is for frustum culling to decide
+
+  // the level where that is at most 3 x 3 texels
+  int level = 0;
+  while (level + 1 < int(levels_.size()) && max(x1 - x0, y1 - y0) >> level >= 2) {
+    ++level;
+  }
+  const Level& l = levels_[level];
+  for (int y = y0 >> level; y <= y1 >> level; ++y) {
+    for (int x = x0 >> level; x <= x1 >> level; ++x) {
+      if (nearest >= l.depth[y * l.width + x])
+        return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,125 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <vector>
+
+#include "bvh.h"
+#include "cvec.h"
+#include "matrix4.h"
+
+//--------------------------------------------------------------------------------
+// Occlusion culling against a small depth buffer drawn on the CPU
+//--------------------------------------------------------------------------------
+//
+// A few big objects near the eye are drawn as occluders into a low
+// resolution depth buffer, and every other object is tested against it
+// before it is queued, so objects hidden behind the occluders cost no draw.
+// Nothing is read back from the GPU and no GL is needed, so the buffer can
+// be filled and tested anywhere.
+//
+// Depth is z / w after the projection, which with Matrix4::makeProjection
+// is 1 at the near plane and -1 at the far one, so bigger is nearer, as
+// with the glDepthFunc(GL_GREATER) of the scene. Occluders keep the nearest
+// depth of each texel. The rows of the buffer are split into bands of
+// OCCLUSION_BAND_HEIGHT rows, each rasterized by one thread with SSE, four
+// texels at a time.
+//
+// Vertices are snapped to 1 / 2^OCCLUSION_SUBTEXEL_BITS of a texel and
+// texels are tested against exact integer edge functions with a top-left
+// fill rule, as GPUs do, so triangles sharing an edge leave no texel
+// between them uncovered. Triangles are clipped to a guard band around the
+// buffer, which keeps those integers in 32 bits.
+//
+// A pyramid above the buffer holds at each level the farthest depth of the
+// 2 x 2 texels below it. A box is tested at the level where its screen
+// rectangle covers a few texels, and is hidden if its nearest corner is
+// farther than all of them.
+//
+// Occluders are only sampled at texel centers, so a test first grows the
+// box's rectangle by a texel. Occluders must lie inside the objects they
+// stand for, or they may hide objects that show.
+
+// Rows of the buffer rasterized by one thread at a time
+static const int OCCLUSION_BAND_HEIGHT = 8;
+
+// Largest width and height, which with the guard band and subtexel bits
+// below keeps the edge functions in 32 bits
+static const int OCCLUSION_MAX_SIZE = 512;
+static const int OCCLUSION_SUBTEXEL_BITS = 8;
+
+// Triangles are clipped to -g <= x / w, y / w <= g, which leaves half the
+// buffer's size around it
+static const float OCCLUSION_GUARD_BAND = 2.0f;
+
+class OcclusionBuffer {
+public:
+  // width and height are powers of two up to OCCLUSION_MAX_SIZE, width at
+  // least 4 and height at least OCCLUSION_BAND_HEIGHT
+  OcclusionBuffer(int width, int height);
+
+  // Empties the buffer and drops the occluders added so far
+  void clear();
+
+  // Adds the triangle list idx[0..numIndices) over vtx, taken to clip space
+  // by modelViewProj. Parts in front of the near plane are clipped off.
+  void addOccluder(const Matrix4& modelViewProj, const Cvec3f *vtx, int numVertices, const int *idx, int numIndices);
+
+  // Draws the occluders added since clear, with up to numThreads threads (0
+  // for one per core, as in parallel.h), and builds the pyramid
+  void rasterize(int numThreads = 0);
+
+  // Whether some of box, in the space viewProj takes to clip space, may be
+  // in front of the occluders. Boxes reaching the near plane always may.
+  bool isVisible(const Matrix4& viewProj, const BoundingBox& box) const;
+
+  int numTriangles() const {
+    return triangles_.size();
+  }
+
+  int numLevels() const {
+    return levels_.size();
+  }
+
+  int width(const int level = 0) const {
+    return levels_[level].width;
+  }
+
+  int height(const int level = 0) const {
+    return levels_[level].height;
+  }
+
+  // Depth at a texel of a level, -1 where there is no occluder
+  float depth(const int level, const int x, const int y) const {
+    return levels_[level].depth[y * levels_[level].width + x];
+  }
+
+private:
+  struct Level {
+    int width, height;
+    std::vector<float> depth;
+  };
+
+  // A triangle set up for rasterizing: its three edge functions and its
+  // depth as A * x + B * y + C of the texel (x, y), each edge function
+  // non-negative at the texels it covers, and its bounds in texels
+  struct Triangle {
+    int edgeA[3], edgeB[3], edgeC[3];
+    float depthA, depthB, depthC;
+    int x0, x1, y0, y1;
+  };
+
+  struct ClipVertex {
+    float x, y, z, w;
+  };
+
+  std::vector<Level> levels_; // the buffer, then the pyramid
+  std::vector<Triangle> triangles_;
+  std::vector<ClipVertex> clipped_; // scratch for addOccluder
+
+  template<typename Dist>
+  static int clipPolygon(const ClipVertex *poly, int n, ClipVertex *out, Dist dist);
+  void addTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c);
+  void rasterizeRows(int y0, int y1);
+};
+
+#endif
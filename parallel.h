@@ -0,0 +1,53 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Work items each thread should get at least, so short loops stay inline
+static const int CS150_BATCH_MIN_PER_THREAD = 16384;
+
+// Calls f(begin, end) on disjoint subranges covering [0, n) using up to
+// numThreads threads, where 0 means one per core. Each subrange starts at a
+// multiple of 8 so SIMD loops only see a ragged tail in the last one.
+// Fewer threads are used when they would get under minPerThread items each.
+// If f throws, every thread is still joined and then the exception of the
+// lowest subrange that threw is rethrown on the calling thread.
+template<typename Func>
+void parallelForRange(const int n, int numThreads, Func f,
+                      const int minPerThread = CS150_BATCH_MIN_PER_THREAD) {
+  if (numThreads <= 0)
+    numThreads = std::max(1, int(std::thread::hardware_concurrency()));
+  numThreads = std::min(numThreads, std::max(1, n / std::max(1, minPerThread)));
+  if (numThreads <= 1) {
+    f(0, n);
+    return;
+  }
+
+  const int chunk = ((n + numThreads - 1) / numThreads + 7) & ~7;
+  std::vector<std::exception_ptr> errors((n + chunk - 1) / chunk);
+  const auto run = [&f, &errors, chunk, n](const int begin) {
+    try {
+      f(begin, std::min(n, begin + chunk));
+    }
+    catch (...) {
+      errors[begin / chunk] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int begin = chunk; begin < n; begin += chunk) {
+    threads.push_back(std::thread(run, begin));
+  }
+  run(0);
+  for (std::size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+  for (std::size_t i = 0; i < errors.size(); ++i) {
+    if (errors[i])
+      std::rethrow_exception(errors[i]);
+  }
+}
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef QUAT_H
+#define QUAT_H
+
+#include <cassert>
+#include <cmath>
+
+#include "cvec.h"
+#include "matrix4.h"
+
+// Forward declarations used in the definition of Quat;
+class Quat;
+double dot(const Quat& q, const Quat& p);
+double norm2(const Quat& q);
+Quat inv(const Quat& q);
+Quat normalize(const Quat& q);
+Matrix4 quatToMatrix(const Quat& q);
+
+// A quaternion, used here to represent 3D rotations. All the rotations built
+// by the make* functions are unit quaternions, and so are their products (up
+// to round-off, see normalize), which is what lets inv be a plain conjugate.
+class Quat {
+  Cvec4 q_;  // layout is: q_[0]==w, q_[1]==x, q_[2]==y, q_[3]==z
+
+public:
+  double operator [] (const int i) const {
+    return q_[i];
+  }
+
+  double& operator [] (const int i) {
+    return q_[i];
+  }
+
+  double operator () (const int i) const {
+    return q_[i];
+  }
+
+  double& operator () (const int i) {
+    return q_[i];
+  }
+
+  Quat()
+    : q_(1,0,0,0)
+  {}
+
+  Quat(const double w, const Cvec3& v)
+    : q_(w, v[0], v[1], v[2])
+  {}
+
+  Quat(const double w, const double x, const double y, const double z)
+    : q_(w, x,y,z)
+  {}
+
+  Quat& operator += (const Quat& a) {
+    q_ += a.q_;
+    return *this;
+  }
+
+  Quat& operator -= (const Quat& a) {
+    q_ -= a.q_;
+    return *this;
+  }
+
+  Quat& operator *= (const double a) {
+    q_ *= a;
+    return *this;
+  }
+
+  Quat& operator /= (const double a) {
+    q_ /= a;
+    return *this;
+  }
+
+  Quat operator + (const Quat& a) const {
+    return Quat(*this) += a;
+  }
+
+  Quat operator - (const Quat& a) const {
+    return Quat(*this) -= a;
+  }
+
+  Quat operator * (const double a) const {
+    return Quat(*this) *= a;
+  }
+
+  Quat operator / (const double a) const {
+    return Quat(*this) /= a;
+  }
+
+  Quat operator * (const Quat& a) const {
+    const Cvec3 u(q_[1], q_[2], q_[3]), v(a.q_[1], a.q_[2], a.q_[3]);
+    return Quat(q_[0]*a.q_[0] - dot(u, v), (v*q_[0] + u*a.q_[0]) + cross(u, v));
+  }
+
+  // Rotates the xyz part of a and leaves a[3] alone. Expands q * (0,v) * q^-1
+  // for a unit q into v + 2w (u x v) + 2 u x (u x v), which costs two cross
+  // products instead of two quaternion products.
+  Cvec4 operator * (const Cvec4& a) const {
+    const Cvec3 u(q_[1], q_[2], q_[3]), v(a[0], a[1], a[2]);
+    const Cvec3 t = cross(u, v) * 2;
+    const Cvec3 r = v + t * q_[0] + cross(u, t);
+    return Cvec4(r[0], r[1], r[2], a[3]);
+  }
+
+  static Quat makeXRotation(const double ang) {
+    Quat r;
+    const double h = 0.5 * ang * CS150_PI/180;
+    r.q_[1] = std::sin(h);
+    r.q_[0] = std::cos(h);
+    return r;
+  }
+
+  static Quat makeYRotation(const double ang) {
+    Quat r;
+    const double h = 0.5 * ang * CS150_PI/180;
+    r.q_[2] = std::sin(h);
+    r.q_[0] = std::cos(h);
+    return r;
+  }
+
+  static Quat makeZRotation(const double ang) {
+    Quat r;
+    const double h = 0.5 * ang * CS150_PI/180;
+    r.q_[3] = std::sin(h);
+    r.q_[0] = std::cos(h);
+    return r;
+  }
+};
+
+inline double dot(const Quat& q, const Quat& p) {
+  double s = 0.0;
+  for (int i = 0; i < 4; ++i) {
+    s += q(i) * p(i);
+  }
+  return s;
+}
+
+inline double norm2(const Quat& q) {
+  return dot(q, q);
+}
+
+// inverse of a unit quaternion is its conjugate
+inline Quat inv(const Quat& q) {
+  assert(std::abs(norm2(q) - 1) < 1e-6);
+  return Quat(q[0], -q[1], -q[2], -q[3]);
+}
+
+// Scales q back to unit length. Products of many unit quaternions slowly
+// drift away from it, so frames that are updated every frame should be
+// renormalized now and then.
+inline Quat normalize(const Quat& q) {
+  return q / std::sqrt(norm2(q));
+}
+
+inline Matrix4 quatToMatrix(const Quat& q) {
+  Matrix4 r;
+  const double n = norm2(q);
+  if (n < CS150_EPS2)
+    return Matrix4(0);
+
+  const double two_over_n = 2/n;
+  r(0, 0) -= (q(2)*q(2) + q(3)*q(3)) * two_over_n;
+  r(0, 1) += (q(1)*q(2) - q(0)*q(3)) * two_over_n;
+  r(0, 2) += (q(1)*q(3) + q(2)*q(0)) * two_over_n;
+  r(1, 0) += (q(1)*q(2) + q(0)*q(3)) * two_over_n;
+  r(1, 1) -= (q(1)*q(1) + q(3)*q(3)) * two_over_n;
+  r(1, 2) += (q(2)*q(3) - q(1)*q(0)) * two_over_n;
+  r(2, 0) += (q(1)*q(3) - q(2)*q(0)) * two_over_n;
+  r(2, 1) += (q(2)*q(3) + q(1)*q(0)) * two_over_n;
+  r(2, 2) -= (q(1)*q(1) + q(2)*q(2)) * two_over_n;
+
+  assert(isAffine(r));
+  return r;
+}
+
+#endif
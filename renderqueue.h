@@ -0,0 +1,162 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <GL/glew.h>
+
+//--------------------------------------------------------------------------------
+// Sorting draws by state and skipping redundant state changes
+//--------------------------------------------------------------------------------
+//
+// Scene code pushes one RenderItem per object, keyed by makeRenderKey, and
+// the queue sorts them so objects needing the same program, geometry and
+// level of detail end up next to each other. GlStateCache sits in front of
+// the GL calls that change that state and drops the ones that would not
+// change anything, counting both in RenderStats.
+
+// Sort key, most significant first: shader (8 bits), geometry (12 bits),
+// level of detail (12 bits), then the distance from the eye, so the objects
+// of one batch go front to back and early depth testing rejects what they
+// hide. The top 32 bits are the state an item needs.
+inline uint64_t makeRenderKey(const unsigned shader, const unsigned geometry, const unsigned level, float depth) {
+  // the bits of a non-negative float sort like the float
+  if (!(depth > 0))
+    depth = 0;
+  uint32_t d;
+  memcpy(&d, &depth, sizeof(d));
+  return uint64_t(shader & 0xFF) << 56 | uint64_t(geometry & 0xFFF) << 44 | uint64_t(level & 0xFFF) << 32 | d;
+}
+
+inline unsigned renderKeyShader(const uint64_t key) {
+  return key >> 56;
+}
+
+inline unsigned renderKeyGeometry(const uint64_t key) {
+  return key >> 44 & 0xFFF;
+}
+
+inline unsigned renderKeyLevel(const uint64_t key) {
+  return key >> 32 & 0xFFF;
+}
+
+// Whether two items can be drawn without changing state in between
+inline bool sameRenderState(const uint64_t a, const uint64_t b) {
+  return (a >> 32) == (b >> 32);
+}
+
+struct RenderItem {
+  uint64_t key;
+  int object; // the caller's index of the object
+};
+
+class RenderQueue {
+public:
+  void clear() {
+    items_.clear();
+  }
+
+  void push(const uint64_t key, const int object) {
+    const RenderItem item = {key, object};
+    items_.push_back(item);
+  }
+
+  int size() const {
+    return items_.size();
+  }
+
+  const RenderItem& operator [] (const int i) const {
+    return items_[i];
+  }
+
+  // Sorts by key with a byte-wise radix sort, which is stable and skips the
+  // bytes every key has in common, like the shader of a scene using just one
+  void sort() {
+    const int n = items_.size();
+    int count[8][256];
+    memset(count, 0, sizeof(count));
+    for (int i = 0; i < n; ++i) {
+      for (int b = 0; b < 8; ++b) {
+        ++count[b][items_[i].key >> (8 * b) & 0xFF];
+      }
+    }
+
+    tmp_.resize(n);
+    for (int b = 0; b < 8; ++b) {
+      if (n == 0 || count[b][items_[0].key >> (8 * b) & 0xFF] == n)
+        continue;
+      int offset[256];
+      for (int d = 0, sum = 0; d < 256; ++d) {
+        offset[d] = sum;
+        sum += count[b][d];
+      }
+      for (int i = 0; i < n; ++i) {
+        tmp_[offset[items_[i].key >> (8 * b) & 0xFF]++] = items_[i];
+      }
+      items_.swap(tmp_);
+    }
+  }
+
+private:
+  std::vector<RenderItem> items_, tmp_;
+};
+
+// State changes of one frame. The requested counts are what the draws would
+// have cost without GlStateCache.
+struct RenderStats {
+  int items, draws;
+  int culled, occluded; // objects outside the frustum and hidden, left out before queueing
+  int programs, programRequests;
+  int vertexArrays, vertexArrayRequests;
+
+  RenderStats() {
+    memset(this, 0, sizeof(*this));
+  }
+};
+
+// Remembers the bound program and vertex array object and only calls GL when
+// they change. Anything binding them behind its back must call forget.
+class GlStateCache {
+public:
+  RenderStats stats;
+
+  GlStateCache() {
+    forget();
+  }
+
+  void forget() {
+    program_ = vertexArray_ = ~0u;
+  }
+
+  void useProgram(const GLuint program) {
+    ++stats.programRequests;
+    if (program == program_)
+      return;
+    program_ = program;
+    ++stats.programs;
+    glUseProgram(program);
+  }
+
+  void bindVertexArray(const GLuint vao) {
+    ++stats.vertexArrayRequests;
+    if (vao == vertexArray_)
+      return;
+    vertexArray_ = vao;
+    ++stats.vertexArrays;
+    glBindVertexArray(vao);
+  }
+
+  // Starts counting a new frame and returns the counts of the last one
+  RenderStats endFrame() {
+    const RenderStats s = stats;
+    stats = RenderStats();
+    return s;
+  }
+
+private:
+  GLuint program_, vertexArray_;
+};
+
+#endif
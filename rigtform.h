@@ -0,0 +1,86 @@
+#ifndef RIGTFORM_H
+#define RIGTFORM_H
+
+#include "matrix4.h"
+#include "quat.h"
+
+// A rigid body transform: a rotation (unit quaternion) followed by a
+// translation, i.e. the matrix T(t) * R(r). Composition and inversion stay
+// rigid by construction, so unlike a general Matrix4 no determinant or
+// division is ever needed, and there is no shear or scale to creep in over
+// many products.
+class RigTForm {
+  Cvec3 t_; // translation component
+  Quat r_;  // rotation component represented as a quaternion
+
+public:
+  RigTForm() : t_(0) {}
+
+  RigTForm(const Cvec3& t, const Quat& r)
+    : t_(t), r_(r)
+  {}
+
+  explicit RigTForm(const Cvec3& t)
+    : t_(t)
+  {}
+
+  explicit RigTForm(const Quat& r)
+    : t_(0), r_(r)
+  {}
+
+  Cvec3 getTranslation() const {
+    return t_;
+  }
+
+  Quat getRotation() const {
+    return r_;
+  }
+
+  RigTForm& setTranslation(const Cvec3& t) {
+    t_ = t;
+    return *this;
+  }
+
+  RigTForm& setRotation(const Quat& r) {
+    r_ = r;
+    return *this;
+  }
+
+  Cvec4 operator * (const Cvec4& a) const {
+    return r_ * a + Cvec4(t_, 0) * a[3];
+  }
+
+  RigTForm operator * (const RigTForm& a) const {
+    return RigTForm(t_ + Cvec3(r_ * Cvec4(a.t_, 0)), r_ * a.r_);
+  }
+};
+
+// (T R)^-1 = R^-1 T^-1 = T(-R^-1 t) R^-1: a conjugate and a rotate
+inline RigTForm inv(const RigTForm& tform) {
+  const Quat ri = inv(tform.getRotation());
+  return RigTForm(Cvec3(ri * Cvec4(-tform.getTranslation(), 0)), ri);
+}
+
+inline RigTForm transFact(const RigTForm& tform) {
+  return RigTForm(tform.getTranslation());
+}
+
+inline RigTForm linFact(const RigTForm& tform) {
+  return RigTForm(tform.getRotation());
+}
+
+// renormalizes the rotation, see normalize(const Quat&)
+inline RigTForm normalize(const RigTForm& tform) {
+  return RigTForm(tform.getTranslation(), normalize(tform.getRotation()));
+}
+
+inline Matrix4 rigTFormToMatrix(const RigTForm& tform) {
+  Matrix4 m = quatToMatrix(tform.getRotation());
+  const Cvec3 t = tform.getTranslation();
+  for (int i = 0; i < 3; ++i) {
+    m(i,3) = t[i];
+  }
+  return m;
+}
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <stdexcept>
+
+#include <GL/glew.h>
+
+#include "glsupport.h"
+
+//--------------------------------------------------------------------------------
+// A buffer object the CPU streams per-frame data into
+//--------------------------------------------------------------------------------
+//
+// The buffer is split into numRegions regions used in turn, one per frame,
+// and each region is fenced after the frame's draws, so the CPU writes frame
+// N+1 into one region while the GPU still reads frame N from another and
+// only waits if it gets numRegions frames ahead.
+//
+// With persistent mapping (OpenGL 4.4 or ARB_buffer_storage) the buffer is
+// mapped once, coherently, for its whole life. Without it, each region is
+// mapped unsynchronized while the frame is written, which the fences make
+// safe, and unmapped again before the draws.
+
+class GlRingBuffer : Noncopyable {
+public:
+  // target is where the buffer gets bound to map it, and every offset
+  // allocate hands out is a multiple of alignment
+  GlRingBuffer(const GLenum target, const GLsizeiptr alignment, const bool persistent, const int numRegions = 3)
+    : target_(target), alignment_(alignment), persistent_(persistent), numRegions_(numRegions),
+      fences_(new GLsync[numRegions]()), regionSize_(0), used_(0), region_(0), base_(0), regionPtr_(0) {
+    assert(alignment > 0 && numRegions > 0);
+  }
+
+  ~GlRingBuffer() {
+    for (int i = 0; i < numRegions_; ++i) {
+      if (fences_[i])
+        glDeleteSync(fences_[i]);
+    }
+  }
+
+  // Starts writing the next region, waiting until the GPU is done with it.
+  // The regions grow to at least size bytes if they are smaller, which waits
+  // for all of them.
+  void beginFrame(const GLsizeiptr size) {
+    assert(!regionPtr_);
+    region_ = (region_ + 1) % numRegions_;
+    if (size > regionSize_ || !buffer_)
+      grow(size);
+    waitFence(fences_[region_]);
+    used_ = 0;
+
+    if (persistent_)
+      regionPtr_ = base_ + region_ * regionSize_;
+    else {
+      glBindBuffer(target_, *buffer_);
+      regionPtr_ = static_cast<char *>(glMapBufferRange(target_, region_ * regionSize_, regionSize_,
+                                                        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT));
+      if (!regionPtr_)
+        throw std::runtime_error("cannot map ring buffer region");
+    }
+  }
+
+  // Takes size bytes of the current region. Returns where to write them and
+  // sets offset to where they are in the buffer, for glBindBufferRange.
+  void *allocate(const GLsizeiptr size, GLintptr& offset) {
+    assert(regionPtr_);
+    const GLsizeiptr start = alignUp(used_);
+    assert(start + size <= regionSize_);
+    used_ = start + size;
+    offset = region_ * regionSize_ + start;
+    return regionPtr_ + start;
+  }
+
+  // Ends the writes of this frame. Draws reading them go after this.
+  void endWrites() {
+    assert(regionPtr_);
+    if (!persistent_) {
+      glBindBuffer(target_, *buffer_);
+      glUnmapBuffer(target_);
+    }
+    regionPtr_ = 0;
+  }
+
+  // Fences the draws reading the current region, so it is not written again
+  // before they are done
+  void endFrame() {
+    assert(!regionPtr_ && !fences_[region_]);
+    fences_[region_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+
+  // size rounded up to the alignment, which is what allocate takes of a
+  // region, padding included
+  GLsizeiptr alignUp(const GLsizeiptr size) const {
+    return (size + alignment_ - 1) / alignment_ * alignment_;
+  }
+
+  // A new buffer object after the regions grow
+  operator GLuint() const {
+    return *buffer_;
+  }
+
+private:
+  const GLenum target_;
+  const GLsizeiptr alignment_;
+  const bool persistent_;
+  const int numRegions_;
+  std::unique_ptr<GLsync[]> fences_; // 0 where nothing is pending
+  std::unique_ptr<GlBufferObject> buffer_;
+  GLsizeiptr regionSize_, used_;
+  int region_;
+  char *base_;      // whole buffer when persistent
+  char *regionPtr_; // current region while writing, else 0
+
+  static void waitFence(GLsync& fence) {
+    if (!fence)
+      return;
+    GLenum r;
+    while ((r = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000)) == GL_TIMEOUT_EXPIRED) {}
+    glDeleteSync(fence);
+    fence = 0;
+    if (r == GL_WAIT_FAILED)
+      throw std::runtime_error("waiting for ring buffer fence failed");
+  }
+
+  // Reallocates with regions of at least size bytes, at least doubling
+  void grow(const GLsizeiptr size) {
+    for (int i = 0; i < numRegions_; ++i) {
+      waitFence(fences_[i]);
+    }
+    regionSize_ = std::max(alignment_, alignUp(std::max(size, 2 * regionSize_)));
+    region_ = 0;
+
+    buffer_.reset(new GlBufferObject); // deleting the old one unmaps it
+    glBindBuffer(target_, *buffer_);
+    const GLsizeiptr total = regionSize_ * numRegions_;
+    if (persistent_) {
+      const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBufferStorage(target_, total, NULL, flags);
+      base_ = static_cast<char *>(glMapBufferRange(target_, 0, total, flags));
+      if (!base_)
+        throw std::runtime_error("cannot map ring buffer");
+    }
+    else
+      glBufferData(target_, total, NULL, GL_STREAM_DRAW);
+    checkGlErrors();
+  }
+};
+
+#endif
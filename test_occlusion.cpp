@@ -0,0 +1,167 @@
+////////////////////////////////////////////////////////////////////////
+//
+//   Checks of the CPU occlusion buffer (occlusion.h). Occluders are drawn
+//   in front of a camera at the origin looking down -z, and boxes behind,
+//   in front of and beside them are tested. Needs no GL context:
+//
+//     make test_occlusion
+//     ./test_occlusion
+//
+//   Prints every failed check and exits with 1 if there was one.
+//
+////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <vector>
+
+#include "occlusion.h"
+
+using namespace std;
+
+static int g_failures = 0;
+
+#define CHECK(cond, ...) \
+  do { \
+    if (!(cond)) { \
+      printf("FAILED %s:%d: ", __FILE__, __LINE__); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      ++g_failures; \
+    } \
+  } while (0)
+
+static const Matrix4 g_proj = Matrix4::makeProjection(45, 2, -0.1, -50);
+
+// A grid of n x n quads, two triangles each, over [lo, hi] in x and y at
+// depth z, so every inner edge is shared
+static void addGrid(OcclusionBuffer& b, const int n, const float lo, const float hi, const float z) {
+  vector<Cvec3f> vtx;
+  vector<int> idx;
+  for (int j = 0; j <= n; ++j) {
+    for (int i = 0; i <= n; ++i) {
+      vtx.push_back(Cvec3f(lo + (hi - lo) * i / n, lo + (hi - lo) * j / n, z));
+    }
+  }
+  for (int j = 0; j < n; ++j) {
+    for (int i = 0; i < n; ++i) {
+      const int a = j * (n + 1) + i, c = a + n + 2;
+      const int t[] = {a, a + 1, c, a, c, c - 1};
+      idx.insert(idx.end(), t, t + 6);
+    }
+  }
+  b.addOccluder(g_proj, &vtx[0], vtx.size(), &idx[0], idx.size());
+}
+
+// How many of the 21 x 21 boxes of half size e over [lo, hi] in x and y at
+// depth z are visible
+static int countVisible(const OcclusionBuffer& b, const float lo, const float hi, const float z, const float e) {
+  int visible = 0;
+  for (int j = 0; j <= 20; ++j) {
+    for (int i = 0; i <= 20; ++i) {
+      const Cvec3f c(lo + (hi - lo) * i / 20, lo + (hi - lo) * j / 20, z);
+      visible += b.isVisible(g_proj, BoundingBox(c, Cvec3f(e)));
+    }
+  }
+  return visible;
+}
+
+// Texels whose center projects inside [lo, hi] at depth z that no occluder
+// covers
+static int countCracks(const OcclusionBuffer& b, const float lo, const float hi, const float z) {
+  int cracks = 0;
+  for (int y = 0; y < b.height(); ++y) {
+    for (int x = 0; x < b.width(); ++x) {
+      // the eye space point under the texel center at depth z
+      const double nx = (x + 0.5) / b.width() * 2 - 1, ny = (y + 0.5) / b.height() * 2 - 1;
+      const double px = nx * -z / g_proj(0,0), py = ny * -z / g_proj(1,1);
+      if (px > lo && px < hi && py > lo && py < hi)
+        cracks += b.depth(0, x, y) == -1;
+    }
+  }
+  return cracks;
+}
+
+static void testSharedEdges() {
+  for (int n = 1; n <= 16; n *= 2) {
+    OcclusionBuffer b(256, 128);
+    b.clear();
+    addGrid(b, n, -2, 2, -5);
+    b.rasterize(1);
+    CHECK(countCracks(b, -2, 2, -5) == 0, "%d x %d grid: %d texels uncovered", n, n, countCracks(b, -2, 2, -5));
+    CHECK(countVisible(b, -1.5f, 1.5f, -10, 0.2f) == 0, "%d x %d grid: %d of 441 boxes behind it visible", n, n,
+          countVisible(b, -1.5f, 1.5f, -10, 0.2f));
+    CHECK(countVisible(b, -1.5f, 1.5f, -3, 0.2f) == 441, "%d x %d grid: %d of 441 boxes in front of it visible", n, n,
+          countVisible(b, -1.5f, 1.5f, -3, 0.2f));
+    CHECK(countVisible(b, 4, 6, -10, 0.2f) == 441, "%d x %d grid: %d of 441 boxes beside it visible", n, n,
+          countVisible(b, 4, 6, -10, 0.2f));
+  }
+}
+
+// Texel centers on the diagonal shared by a quad's two triangles are covered
+// by one of them, whichever way the quad is split, so the boxes behind stay
+// hidden. Without a consistent fill rule, a single texel missed there makes
+// every texel above it in the pyramid empty.
+static void testQuads() {
+  const int splits[2][6] = {{0, 1, 2, 0, 2, 3}, {0, 1, 3, 1, 2, 3}};
+  for (int k = 5; k <= 40; ++k) {
+    for (int split = 0; split < 2; ++split) {
+      const float h = 0.1f * k;
+      const Cvec3f vtx[] = {Cvec3f(-h, -h, -5), Cvec3f(h, -h, -5), Cvec3f(h, h, -5), Cvec3f(-h, h, -5)};
+      OcclusionBuffer b(256, 128);
+      b.clear();
+      b.addOccluder(g_proj, vtx, 4, splits[split], 6);
+      b.rasterize(1);
+      const int visible = countVisible(b, -0.6f * h, 0.6f * h, -10, 0.02f);
+      CHECK(visible == 0, "quad of half size %g split %d: %d of 441 boxes behind it visible", h, split, visible);
+    }
+  }
+}
+
+// Occluders reaching behind the eye are clipped and still hide what is
+// behind them, and boxes reaching the near plane are always visible
+static void testNearPlane() {
+  OcclusionBuffer b(256, 128);
+  b.clear();
+  const Cvec3f vtx[] = {Cvec3f(-20, -20, 5), Cvec3f(20, -20, 5), Cvec3f(20, 20, -15), Cvec3f(-20, 20, -15)};
+  const int idx[] = {0, 1, 2, 0, 2, 3};
+  b.addOccluder(g_proj, vtx, 4, idx, 6);
+  b.rasterize(1);
+  CHECK(b.numTriangles() > 0, "occluder crossing the near plane dropped");
+  CHECK(!b.isVisible(g_proj, BoundingBox(Cvec3f(0, 10, -30), Cvec3f(0.5f))), "box behind a clipped occluder visible");
+  CHECK(b.isVisible(g_proj, BoundingBox(Cvec3f(0, 0, 0), Cvec3f(0.5f))), "box around the eye hidden");
+}
+
+// Any number of threads draws the same buffer
+static void testThreads() {
+  OcclusionBuffer one(256, 128), many(256, 128);
+  one.clear();
+  many.clear();
+  addGrid(one, 16, -3, 1, -4);
+  addGrid(many, 16, -3, 1, -4);
+  addGrid(one, 5, -1, 2, -6);
+  addGrid(many, 5, -1, 2, -6);
+  one.rasterize(1);
+  many.rasterize(8);
+  int differ = 0;
+  for (int k = 0; k < one.numLevels(); ++k) {
+    for (int y = 0; y < one.height(k); ++y) {
+      for (int x = 0; x < one.width(k); ++x) {
+        differ += one.depth(k, x, y) != many.depth(k, x, y);
+      }
+    }
+  }
+  CHECK(differ == 0, "%d texels differ between 1 and 8 threads", differ);
+}
+
+int main() {
+  testSharedEdges();
+  testQuads();
+  testNearPlane();
+  testThreads();
+  if (g_failures) {
+    printf("%d checks failed\n", g_failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,228 @@
+#ifndef TRANSFORMBATCH_H
+#define TRANSFORMBATCH_H
+
+#include <cstring>
+
+#include "cvec.h"
+#include "matrix4f.h"
+#include "parallel.h"
+
+//--------------------------------------------------------------------------------
+// Transforming whole arrays of points and normals by one Matrix4f
+//--------------------------------------------------------------------------------
+//
+// Points get the full affine transform (w = 1), normals and other directions
+// only the upper 3x3 (w = 0), so pass normalMatrix(m) when transforming
+// normals. The SoA versions take separate x/y/z streams; the strided versions
+// walk any array whose elements contain a Cvec3f, such as the p or n member of
+// a VertexPNX array. Input and output may be the same array.
+//
+// numThreads > 1 splits large batches across threads, and 0 means one thread
+// per core (see parallel.h). Batches too small to amortize a thread are always
+// done inline.
+
+inline void transformSoARange(const Matrix4f& m, const float w,
+                              const float *x, const float *y, const float *z,
+                              float *ox, float *oy, float *oz,
+                              const int begin, const int end) {
+  int i = begin;
+#if defined(CS150_AVX)
+  {
+    __m256 c[12];
+    for (int k = 0; k < 3; ++k) {
+      c[4*k] = _mm256_set1_ps(m(k,0));
+      c[4*k + 1] = _mm256_set1_ps(m(k,1));
+      c[4*k + 2] = _mm256_set1_ps(m(k,2));
+      c[4*k + 3] = _mm256_set1_ps(m(k,3) * w);
+    }
+    for (; i + 8 <= end; i += 8) {
+      const __m256 vx = _mm256_loadu_ps(x + i);
+      const __m256 vy = _mm256_loadu_ps(y + i);
+      const __m256 vz = _mm256_loadu_ps(z + i);
+      __m256 r[3];
+      for (int k = 0; k < 3; ++k) {
+        r[k] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[4*k], vx), _mm256_mul_ps(c[4*k + 1], vy)),
+                             _mm256_add_ps(_mm256_mul_ps(c[4*k + 2], vz), c[4*k + 3]));
+      }
+      _mm256_storeu_ps(ox + i, r[0]);
+      _mm256_storeu_ps(oy + i, r[1]);
+      _mm256_storeu_ps(oz + i, r[2]);
+    }
+  }
+#endif
+#ifdef CS150_SSE
+  {
+    __m128 c[12];
+    for (int k = 0; k < 3; ++k) {
+      c[4*k] = _mm_set1_ps(m(k,0));
+      c[4*k + 1] = _mm_set1_ps(m(k,1));
+      c[4*k + 2] = _mm_set1_ps(m(k,2));
+      c[4*k + 3] = _mm_set1_ps(m(k,3) * w);
+    }
+    for (; i + 4 <= end; i += 4) {
+      const __m128 vx = _mm_loadu_ps(x + i);
+      const __m128 vy = _mm_loadu_ps(y + i);
+      const __m128 vz = _mm_loadu_ps(z + i);
+      __m128 r[3];
+      for (int k = 0; k < 3; ++k) {
+        r[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[4*k], vx), _mm_mul_ps(c[4*k + 1], vy)),
+                          _mm_add_ps(_mm_mul_ps(c[4*k + 2], vz), c[4*k + 3]));
+      }
+      _mm_storeu_ps(ox + i, r[0]);
+      _mm_storeu_ps(oy + i, r[1]);
+      _mm_storeu_ps(oz + i, r[2]);
+    }
+  }
+#endif
+  for (; i < end; ++i) {
+    const float vx = x[i], vy = y[i], vz = z[i];
+    ox[i] = m(0,0) * vx + m(0,1) * vy + m(0,2) * vz + m(0,3) * w;
+    oy[i] = m(1,0) * vx + m(1,1) * vy + m(1,2) * vz + m(1,3) * w;
+    oz[i] = m(2,0) * vx + m(2,1) * vy + m(2,2) * vz + m(2,3) * w;
+  }
+}
+
+// Strides are in bytes. Every element but the last of the range is read as
+// four floats so that four elements can be transposed into SoA registers; the
+// stride has to be at least that of a packed Cvec3f array. Stopping short of
+// end keeps the extra float out of the next thread's range, which it may be
+// writing when in and out are the same array.
+inline void transformStridedRange(const Matrix4f& m, const float w,
+                                  const char *in, const int inStride,
+                                  char *out, const int outStride,
+                                  const int begin, const int end) {
+  assert(inStride >= int(sizeof(Cvec3f)) && outStride >= int(sizeof(Cvec3f)));
+  int i = begin;
+#ifdef CS150_SSE
+  __m128 c[12];
+  for (int k = 0; k < 3; ++k) {
+    c[4*k] = _mm_set1_ps(m(k,0));
+    c[4*k + 1] = _mm_set1_ps(m(k,1));
+    c[4*k + 2] = _mm_set1_ps(m(k,2));
+    c[4*k + 3] = _mm_set1_ps(m(k,3) * w);
+  }
+  for (; i + 4 < end; i += 4) {
+    __m128 vx = _mm_loadu_ps(reinterpret_cast<const float*>(in + i * inStride));
+    __m128 vy = _mm_loadu_ps(reinterpret_cast<const float*>(in + (i + 1) * inStride));
+    __m128 vz = _mm_loadu_ps(reinterpret_cast<const float*>(in + (i + 2) * inStride));
+    __m128 vw = _mm_loadu_ps(reinterpret_cast<const float*>(in + (i + 3) * inStride));
+    _MM_TRANSPOSE4_PS(vx, vy, vz, vw);
+    __m128 r[4];
+    for (int k = 0; k < 3; ++k) {
+      r[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[4*k], vx), _mm_mul_ps(c[4*k + 1], vy)),
+                        _mm_add_ps(_mm_mul_ps(c[4*k + 2], vz), c[4*k + 3]));
+    }
+    r[3] = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+
+    // only three floats per element may be written back
+    alignas(16) float tmp[16];
+    for (int k = 0; k < 4; ++k) {
+      _mm_store_ps(tmp + 4*k, r[k]);
+      std::memcpy(out + (i + k) * outStride, tmp + 4*k, 3 * sizeof(float));
+    }
+  }
+#endif
+  for (; i < end; ++i) {
+    const float *v = reinterpret_cast<const float*>(in + i * inStride);
+    const float vx = v[0], vy = v[1], vz = v[2];
+    float *o = reinterpret_cast<float*>(out + i * outStride);
+    o[0] = m(0,0) * vx + m(0,1) * vy + m(0,2) * vz + m(0,3) * w;
+    o[1] = m(1,0) * vx + m(1,1) * vy + m(1,2) * vz + m(1,3) * w;
+    o[2] = m(2,0) * vx + m(2,1) * vy + m(2,2) * vz + m(2,3) * w;
+  }
+}
+
+inline void transformCvec4Range(const Matrix4f& m, const Cvec4f *in, Cvec4f *out,
+                                const int begin, const int end) {
+  int i = begin;
+#ifdef CS150_SSE
+  __m128 c[16];
+  for (int k = 0; k < 16; ++k) {
+    c[k] = _mm_set1_ps(m[k]);
+  }
+  for (; i + 4 <= end; i += 4) {
+    __m128 vx = _mm_loadu_ps(&in[i][0]);
+    __m128 vy = _mm_loadu_ps(&in[i + 1][0]);
+    __m128 vz = _mm_loadu_ps(&in[i + 2][0]);
+    __m128 vw = _mm_loadu_ps(&in[i + 3][0]);
+    _MM_TRANSPOSE4_PS(vx, vy, vz, vw);
+    __m128 r[4];
+    for (int k = 0; k < 4; ++k) {
+      r[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[4*k], vx), _mm_mul_ps(c[4*k + 1], vy)),
+                        _mm_add_ps(_mm_mul_ps(c[4*k + 2], vz), _mm_mul_ps(c[4*k + 3], vw)));
+    }
+    _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+    for (int k = 0; k < 4; ++k) {
+      _mm_storeu_ps(&out[i + k][0], r[k]);
+    }
+  }
+#endif
+  for (; i < end; ++i) {
+    out[i] = m * in[i];
+  }
+}
+
+// Transforms n points given as separate x, y, z streams
+inline void transformPoints(const Matrix4f& m,
+                            const float *x, const float *y, const float *z,
+                            float *ox, float *oy, float *oz,
+                            const int n, const int numThreads = 1) {
+  parallelForRange(n, numThreads, [&](int begin, int end) {
+    transformSoARange(m, 1, x, y, z, ox, oy, oz, begin, end);
+  });
+}
+
+// Transforms n normals given as separate x, y, z streams. The result is not
+// renormalized.
+inline void transformNormals(const Matrix4f& nm,
+                             const float *x, const float *y, const float *z,
+                             float *ox, float *oy, float *oz,
+                             const int n, const int numThreads = 1) {
+  parallelForRange(n, numThreads, [&](int begin, int end) {
+    transformSoARange(nm, 0, x, y, z, ox, oy, oz, begin, end);
+  });
+}
+
+// Transforms n points found every inStride bytes starting at in
+inline void transformPoints(const Matrix4f& m,
+                            const Cvec3f *in, const int inStride,
+                            Cvec3f *out, const int outStride,
+                            const int n, const int numThreads = 1) {
+  parallelForRange(n, numThreads, [&](int begin, int end) {
+    transformStridedRange(m, 1, reinterpret_cast<const char*>(in), inStride,
+                          reinterpret_cast<char*>(out), outStride, begin, end);
+  });
+}
+
+// Transforms n normals found every inStride bytes starting at in
+inline void transformNormals(const Matrix4f& nm,
+                             const Cvec3f *in, const int inStride,
+                             Cvec3f *out, const int outStride,
+                             const int n, const int numThreads = 1) {
+  parallelForRange(n, numThreads, [&](int begin, int end) {
+    transformStridedRange(nm, 0, reinterpret_cast<const char*>(in), inStride,
+                          reinterpret_cast<char*>(out), outStride, begin, end);
+  });
+}
+
+// Transforms a packed array of n homogeneous vectors
+inline void transformCvec4s(const Matrix4f& m, const Cvec4f *in, Cvec4f *out,
+                            const int n, const int numThreads = 1) {
+  parallelForRange(n, numThreads, [&](int begin, int end) {
+    transformCvec4Range(m, in, out, begin, end);
+  });
+}
+
+// Transforms the position and normal of n vertices in place. Works for any
+// vertex type with Cvec3f members p and n, e.g. VertexPNX.
+template<typename Vertex>
+void transformVertices(const Matrix4f& m, const Matrix4f& nm, Vertex *vtx,
+                       const int n, const int numThreads = 1) {
+  if (n <= 0)
+    return;
+  transformPoints(m, &vtx[0].p, sizeof(Vertex), &vtx[0].p, sizeof(Vertex), n, numThreads);
+  transformNormals(nm, &vtx[0].n, sizeof(Vertex), &vtx[0].n, sizeof(Vertex), n, numThreads);
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef VERTEXPACK_H
+#define VERTEXPACK_H
+
+#include <algorithm>
+#include <cmath>
+
+#include "cvec.h"
+
+//--------------------------------------------------------------------------------
+// Quantizing vertex attributes into 16-bit integers for compact vertex buffers
+//--------------------------------------------------------------------------------
+//
+// Positions are stored as signed 16-bit integers q with p = q * scale + bias,
+// where scale and bias are chosen per mesh from its bounding box. Unit normals
+// are octahedrally encoded into two signed 16-bit integers, and texture
+// coordinates in [0, 1] become unsigned 16-bit integers. The integers are
+// meant to be fed to the shader unnormalized (except for the texture
+// coordinates), so the shader does not depend on how a particular GL version
+// maps snorm values to floats.
+
+static const float CS150_SNORM16_MAX = 32767.0f;
+static const float CS150_UNORM16_MAX = 65535.0f;
+
+// Maps positions in the box [lo, hi] to the full signed 16-bit range
+struct PositionQuantization {
+  Cvec3f scale, bias;
+
+  PositionQuantization() : scale(1), bias(0) {}
+
+  PositionQuantization(const Cvec3f& lo, const Cvec3f& hi) {
+    for (int i = 0; i < 3; ++i) {
+      bias[i] = (lo[i] + hi[i]) * 0.5f;
+      // a flat box still needs a nonzero scale
+      scale[i] = std::max(hi[i] - lo[i], float(CS150_EPS)) * 0.5f / CS150_SNORM16_MAX;
+    }
+  }
+};
+
+// Bounding box of the p members of vtx[0..n), e.g. a VertexPNX array
+template<typename Vertex>
+PositionQuantization makePositionQuantization(const Vertex *vtx, const int n) {
+  Cvec3f lo(0), hi(0);
+  if (n > 0)
+    lo = hi = vtx[0].p;
+  for (int i = 1; i < n; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      lo[j] = std::min(lo[j], vtx[i].p[j]);
+      hi[j] = std::max(hi[j], vtx[i].p[j]);
+    }
+  }
+  return PositionQuantization(lo, hi);
+}
+
+inline short quantizeSnorm16(const float x) {
+  return short(std::floor(std::max(-1.0f, std::min(1.0f, x)) * CS150_SNORM16_MAX + 0.5f));
+}
+
+inline unsigned short quantizeUnorm16(const float x) {
+  return (unsigned short)(std::floor(std::max(0.0f, std::min(1.0f, x)) * CS150_UNORM16_MAX + 0.5f));
+}
+
+inline void quantizePosition(const Cvec3f& p, const PositionQuantization& q, short out[3]) {
+  for (int i = 0; i < 3; ++i) {
+    out[i] = quantizeSnorm16((p[i] - q.bias[i]) / (q.scale[i] * CS150_SNORM16_MAX));
+  }
+}
+
+inline Cvec3f dequantizePosition(const short in[3], const PositionQuantization& q) {
+  return Cvec3f(in[0] * q.scale[0] + q.bias[0],
+                in[1] * q.scale[1] + q.bias[1],
+                in[2] * q.scale[2] + q.bias[2]);
+}
+
+// Projects a unit vector onto the octahedron |x| + |y| + |z| = 1 and unfolds
+// the lower half over the corners of the upper one, giving a point of the
+// square [-1, 1]^2 stored as two snorm16 values
+inline void octEncodeNormal(const Cvec3f& n, short out[2]) {
+  const float l1 = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+  float x = l1 > 0 ? n[0] / l1 : 0;
+  float y = l1 > 0 ? n[1] / l1 : 0;
+  if (n[2] < 0) {
+    const float fx = (1 - std::abs(y)) * (x >= 0 ? 1 : -1);
+    const float fy = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+    x = fx, y = fy;
+  }
+  out[0] = quantizeSnorm16(x);
+  out[1] = quantizeSnorm16(y);
+}
+
+// The inverse of octEncodeNormal, as done by the compact vertex shaders
+inline Cvec3f octDecodeNormal(const short in[2]) {
+  float x = in[0] / CS150_SNORM16_MAX, y = in[1] / CS150_SNORM16_MAX;
+  const float z = 1 - std::abs(x) - std::abs(y);
+  if (z < 0) {
+    const float fx = (1 - std::abs(y)) * (x >= 0 ? 1 : -1);
+    const float fy = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+    x = fx, y = fy;
+  }
+  return normalize(Cvec3f(x, y, z));
+}
+
+#endif